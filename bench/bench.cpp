@@ -0,0 +1,551 @@
+// lct_bench: micro- and macro-benchmarks for the registry's hot paths.
+//
+//   lct_bench [--filter <substring>] [--min-time-ms <ms>] [--samples <n>] [--out <file>]
+//
+// Prints one JSON document (environment + one entry per case) so runs can
+// be diffed between releases. A case's full name is "<name>/<k>=<v>,..."
+// and --filter matches against it. lct_bench links the counting allocator
+// (alloc_accounting.h), so every case also reports heap allocations and
+// bytes per op.
+
+#include "bench_util.h"
+
+#include "llama_cpp_tools/alloc_accounting.h"
+#include "llama_cpp_tools/conversation_builder.h"
+#include "llama_cpp_tools/tool_registry.h"
+#include "llama_cpp_tools/wire_format.h"
+#ifdef __linux__
+#include "llama_cpp_tools/worker_pool.h"
+#endif
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace lct_bench;
+using lct::ToolRegistry;
+using lct::ToolSpec;
+
+namespace {
+
+class Runner {
+public:
+    Runner(std::string filter, std::uint64_t min_time_ns, size_t samples)
+        : filter_(std::move(filter)), min_time_ns_(min_time_ns), samples_(std::max<size_t>(samples, 1)) {}
+
+    bool wants(const std::string& name, const json& params) const {
+        return filter_.empty() || full_name(name, params).find(filter_) != std::string::npos;
+    }
+
+    // Runs `op` in timed batches: the batch size doubles until one batch
+    // takes min_time / samples, then `samples` batches are timed. Reports
+    // the median (and spread) of the per-op time. `bytes` / `items` per op
+    // turn into throughput fields when non-zero.
+    void run(const std::string& name, const json& params, const std::function<void()>& op,
+             double bytes = 0, double items = 0) {
+        if (!wants(name, params)) return;
+        const std::uint64_t batch_target = std::max<std::uint64_t>(min_time_ns_ / samples_, 1);
+        std::uint64_t iters = 1;
+        while (true) {
+            const auto t0 = Clock::now();
+            for (std::uint64_t i = 0; i < iters; ++i) op();
+            const std::uint64_t took = ns_since(t0);
+            if (took >= batch_target || iters >= (std::uint64_t(1) << 30)) break;
+            iters = took == 0 ? iters * 16 : std::max(iters * 2, static_cast<std::uint64_t>(
+                static_cast<double>(iters) * 1.2 * static_cast<double>(batch_target) / static_cast<double>(took)));
+        }
+        std::vector<double> per_op;
+        lct::AllocationCounts allocs;
+        for (size_t s = 0; s < samples_; ++s) {
+            const lct::AllocationScope scope;
+            const auto t0 = Clock::now();
+            for (std::uint64_t i = 0; i < iters; ++i) op();
+            per_op.push_back(static_cast<double>(ns_since(t0)) / static_cast<double>(iters));
+            const lct::AllocationCounts d = scope.delta();
+            allocs.allocations += d.allocations;
+            allocs.bytes += d.bytes;
+        }
+        record(name, params, iters, per_op, bytes, items);
+        if (lct::allocation_hook_installed()) {
+            const double ops = static_cast<double>(iters * samples_);
+            results_.back()["allocs_per_op"] = static_cast<double>(allocs.allocations) / ops;
+            results_.back()["alloc_bytes_per_op"] = static_cast<double>(allocs.bytes) / ops;
+        }
+    }
+
+    // For cases too expensive to repeat (building a 100k-tool registry):
+    // one measurement of `total_ns` covering `items` operations.
+    void run_once(const std::string& name, const json& params, std::uint64_t total_ns, double items,
+                  const lct::AllocationCounts& allocs = {}) {
+        if (!wants(name, params)) return;
+        record(name, params, 1, { static_cast<double>(total_ns) / items }, 0, 1);
+        if (lct::allocation_hook_installed()) {
+            results_.back()["allocs_per_op"] = static_cast<double>(allocs.allocations) / items;
+            results_.back()["alloc_bytes_per_op"] = static_cast<double>(allocs.bytes) / items;
+        }
+    }
+
+    json report() const {
+        return json{ {"benchmark", "lct_bench"}, {"environment", environment_json()}, {"results", results_} };
+    }
+
+private:
+    static std::string full_name(const std::string& name, const json& params) {
+        std::string out = name;
+        char sep = '/';
+        for (auto it = params.begin(); it != params.end(); ++it) {
+            out += sep;
+            out += it.key() + "=" + (it->is_string() ? it->get<std::string>() : it->dump());
+            sep = ',';
+        }
+        return out;
+    }
+
+    void record(const std::string& name, const json& params, std::uint64_t iters,
+                const std::vector<double>& per_op, double bytes, double items) {
+        const double median = percentile(per_op, 0.5);
+        json r = {
+            {"name", full_name(name, params)},
+            {"case", name},
+            {"params", params},
+            {"iterations", iters},
+            {"samples", per_op.size()},
+            {"ns_per_op", median},
+            {"ns_per_op_min", *std::min_element(per_op.begin(), per_op.end())},
+            {"ns_per_op_max", *std::max_element(per_op.begin(), per_op.end())},
+        };
+        if (bytes > 0 && median > 0) r["bytes_per_sec"] = bytes * 1e9 / median;
+        if (items > 0 && median > 0) r["items_per_sec"] = items * 1e9 / median;
+        std::cerr << r["name"].get<std::string>() << ": " << median << " ns/op\n";
+        results_.push_back(std::move(r));
+    }
+
+    std::string filter_;
+    std::uint64_t min_time_ns_;
+    size_t samples_;
+    json results_ = json::array();
+};
+
+// Synthetic tool `i`: three typed parameters and a one-line description,
+// roughly the size of a real function schema.
+ToolSpec make_tool(size_t i, std::function<lct::json(const lct::json&)> handler) {
+    ToolSpec s;
+    s.name = "tool_" + std::to_string(i);
+    s.description = "Look up record " + std::to_string(i) + " in the inventory service and return its fields";
+    s.parameters = {
+        {"type", "object"},
+        {"properties", {
+            {"id", {{"type", "string"}, {"description", "record identifier"}}},
+            {"limit", {{"type", "integer"}, {"minimum", 1}}},
+            {"verbose", {{"type", "boolean"}}}
+        }},
+        {"required", {"id"}}
+    };
+    s.handler = std::move(handler);
+    return s;
+}
+
+lct::json echo_handler(const lct::json& args) { return args; }
+
+// One response carrying `calls` tool calls to `tool`, each with
+// `arg_bytes` of string argument payload.
+lct::json make_response(size_t calls, const std::string& tool, size_t arg_bytes) {
+    lct::json tool_calls = lct::json::array();
+    for (size_t i = 0; i < calls; ++i) {
+        lct::json args = {{"id", std::to_string(i)}, {"blob", std::string(arg_bytes, 'x')}};
+        tool_calls.push_back({{"id", "call_" + std::to_string(i)}, {"type", "function"},
+                              {"function", {{"name", tool}, {"arguments", args.dump()}}}});
+    }
+    return {{"choices", {{{"message", {{"role", "assistant"}, {"tool_calls", tool_calls}}}}}}};
+}
+
+// ---------- cases ----------
+
+void bench_registry_sizes(Runner& run) {
+    for (size_t n : {size_t(10), size_t(1000), size_t(10000), size_t(100000)}) {
+        const json p = {{"tools", n}};
+        const bool wanted = run.wants("register", p) || run.wants("invoke", p) || run.wants("tools_for_query", {{"tools", n}, {"k", 8}}) ||
+                            run.wants("tools_for_openai_string", {{"tools", n}, {"order", "by_name"}}) ||
+                            run.wants("tools_for_openai_string", {{"tools", n}, {"order", "stable"}});
+        if (!wanted) continue;      // building a 100k registry is not free
+        const lct::AllocationScope scope;
+        const auto t0 = Clock::now();
+        ToolRegistry reg;
+        for (size_t i = 0; i < n; ++i) reg.register_tool_spec(make_tool(i, echo_handler));
+        run.run_once("register", p, ns_since(t0), static_cast<double>(n), scope.delta());
+
+        const std::string target = "tool_" + std::to_string(n / 2);
+        const lct::json args = {{"id", "42"}};
+        run.run("invoke", p, [&] { reg.invoke(target, args); });
+
+        run.run("tools_for_openai_string", {{"tools", n}, {"order", "by_name"}}, [&] {
+            volatile size_t sink = reg.tools_for_openai_string().size(); (void)sink;
+        });
+        run.run("tools_for_openai_string", {{"tools", n}, {"order", "stable"}}, [&] {
+            volatile size_t sink = reg.tools_for_openai_string(lct::ToolOrder::stable).size(); (void)sink;
+        });
+        run.run("tools_for_query", {{"tools", n}, {"k", 8}}, [&] {
+            reg.tools_for_query("look up inventory record 42 verbose", 8);
+        });
+    }
+}
+
+void bench_argument_parsing(Runner& run) {
+    for (size_t bytes : {size_t(64), size_t(4096), size_t(262144)}) {
+        const lct::json resp = make_response(4, "echo", bytes);
+        const std::string text = resp.dump();
+        run.run("find_tool_calls", {{"calls", 4}, {"arg_bytes", bytes}}, [&] {
+            lct::ToolRegistry::find_tool_calls(resp);
+        }, 0, 4);
+        run.run("parse_and_find_tool_calls", {{"calls", 4}, {"arg_bytes", bytes}}, [&] {
+            lct::ToolRegistry::find_tool_calls(lct::json::parse(text));
+        }, static_cast<double>(text.size()), 4);
+    }
+}
+
+// Whole-body processing with the response DOM on the heap versus in an Arena
+// (reset per request), with and without huge pages.
+void bench_arena(Runner& run) {
+    ToolRegistry reg;
+    reg.register_tool("noop", [](const lct::json&) { return lct::json(); }, {{"name", "noop"}});
+    lct::Arena arena;
+    lct::ArenaOptions huge_opts;
+    huge_opts.huge_pages = true;
+    lct::Arena huge(huge_opts);
+    for (size_t calls : {size_t(4), size_t(64)}) {
+        for (size_t bytes : {size_t(64), size_t(4096)}) {
+            const std::string text = make_response(calls, "noop", bytes).dump();
+            const double items = static_cast<double>(calls);
+            run.run("execute_body", {{"calls", calls}, {"arg_bytes", bytes}, {"dom", "heap"}}, [&] {
+                reg.process_remote_response_and_execute(lct::json::parse(text));
+            }, static_cast<double>(text.size()), items);
+            run.run("execute_body", {{"calls", calls}, {"arg_bytes", bytes}, {"dom", "arena"}}, [&] {
+                reg.process_remote_response_and_execute(text, arena);
+            }, static_cast<double>(text.size()), items);
+            run.run("execute_body", {{"calls", calls}, {"arg_bytes", bytes}, {"dom", "arena_huge_pages"}}, [&] {
+                reg.process_remote_response_and_execute(text, huge);
+            }, static_cast<double>(text.size()), items);
+        }
+    }
+}
+
+void bench_streaming(Runner& run) {
+    ToolRegistry reg;
+    reg.register_tool("echo", echo_handler, {{"name", "echo"}});
+    std::string body;
+    for (size_t i = 0; i < 64; ++i) body += "data: " + make_response(1, "echo", 48).dump() + "\n\n";
+
+    for (size_t chunk : {size_t(1), size_t(16), size_t(256), size_t(4096), size_t(65536)}) {
+        run.run("stream_extract", {{"chunk_bytes", chunk}, {"calls", 64}}, [&] {
+            size_t pos = 0;
+            reg.process_streaming_response_and_execute(
+                [&](std::string& out) {
+                    if (pos >= body.size()) return false;
+                    out.assign(body, pos, chunk);
+                    pos += chunk;
+                    return true;
+                },
+                [](const ToolRegistry::ExecutionResult&) {});
+        }, static_cast<double>(body.size()), 64);
+    }
+}
+
+void bench_fanout(Runner& run) {
+    ToolRegistry reg;
+    reg.register_tool("sleep_1ms", [](const lct::json&) {
+        simulate_latency(1000000);
+        return lct::json::object();
+    }, {{"name", "sleep_1ms"}});
+    for (size_t calls : {size_t(1), size_t(2), size_t(4), size_t(8), size_t(16), size_t(32), size_t(64)}) {
+        const lct::json resp = make_response(calls, "sleep_1ms", 16);
+        run.run("fanout_concurrent", {{"calls", calls}, {"tool_us", 1000}}, [&] {
+            reg.process_remote_response_and_execute(resp, true);
+        }, 0, static_cast<double>(calls));
+        run.run("fanout_as_completed", {{"calls", calls}, {"tool_us", 1000}}, [&] {
+            reg.process_remote_response_and_execute_as_completed(resp, [](size_t, const ToolRegistry::ExecutionResult&) {});
+        }, 0, static_cast<double>(calls));
+    }
+}
+
+// Multi-megabyte arguments: after decoding, each call's arguments should be
+// shared through execution and delivery, never copied.
+void bench_large_arguments(Runner& run) {
+    ToolRegistry reg;
+    reg.register_tool("size", [](const lct::json& a) {
+        return lct::json{{"bytes", a.at("blob").get_ref<const std::string&>().size()}};
+    }, {{"name", "size"}});
+    const size_t bytes = 10 * 1024 * 1024;
+    for (size_t calls : {size_t(1), size_t(4)}) {
+        const lct::json resp = make_response(calls, "size", bytes);
+        for (bool concurrent : {false, true}) {
+            run.run("large_arguments", {{"calls", calls}, {"arg_bytes", bytes}, {"concurrent", concurrent}}, [&] {
+                reg.process_remote_response_and_execute(resp, concurrent);
+            }, static_cast<double>(calls * bytes), static_cast<double>(calls));
+        }
+    }
+}
+
+#ifdef __linux__
+// Round trip of one call through a WorkerPool versus the in-process handler.
+void bench_worker_pool(Runner& run) {
+    const std::vector<size_t> sizes = {16, 4096, 65536};
+    const lct::WireFormat wires[] = {lct::WireFormat::json, lct::WireFormat::msgpack};
+    bool wanted = false;
+    for (size_t bytes : sizes) {
+        wanted = wanted || run.wants("ipc_roundtrip", {{"arg_bytes", bytes}, {"mode", "in_process"}});
+        for (auto wire : wires) {
+            wanted = wanted || run.wants("ipc_roundtrip", {{"arg_bytes", bytes}, {"mode", "worker_pool"},
+                                                           {"wire", lct::wire_format_name(wire)}});
+        }
+    }
+    if (!wanted) return;    // don't fork for nothing
+    ToolRegistry local;
+    local.register_tool("echo", echo_handler, {{"name", "echo"}});
+    std::vector<std::unique_ptr<ToolRegistry>> routed;
+    for (auto wire : wires) {
+        routed.push_back(std::make_unique<ToolRegistry>());
+        routed.back()->register_tool("echo", echo_handler, {{"name", "echo"}});
+        lct::WorkerPool::Options opts;
+        opts.workers = 1;
+        opts.wire = wire;
+        lct::WorkerPool::route(*routed.back(), std::make_shared<lct::WorkerPool>(*routed.back(), opts), {"echo"});
+    }
+
+    for (size_t bytes : sizes) {
+        const lct::json args = {{"blob", std::string(bytes, 'x')}};
+        run.run("ipc_roundtrip", {{"arg_bytes", bytes}, {"mode", "in_process"}}, [&] { local.invoke("echo", args); });
+        for (size_t w = 0; w < routed.size(); ++w) {
+            run.run("ipc_roundtrip", {{"arg_bytes", bytes}, {"mode", "worker_pool"},
+                                      {"wire", lct::wire_format_name(wires[w])}},
+                    [&] { routed[w]->invoke("echo", args); });
+        }
+    }
+}
+#endif
+
+// Encode and decode of three payload shapes -- small arguments, a 1000-row
+// result, a 64 KiB string -- as JSON text (dump/parse) versus MessagePack
+// and CBOR.
+void bench_wire_format(Runner& run) {
+    lct::json rows = lct::json::array();
+    for (int i = 0; i < 1000; ++i) {
+        rows.push_back({{"id", i}, {"name", "item " + std::to_string(i)}, {"price", (i + 1) / 7.0}, {"ok", i % 2 == 0}});
+    }
+    const std::pair<const char*, lct::json> payloads[] = {
+        {"args", {{"city", "Paris"}, {"days", 3}, {"units", "metric"}}},
+        {"rows", rows},
+        {"blob", {{"blob", std::string(65536, 'x')}}},
+    };
+    for (const auto& [name, value] : payloads) {
+        for (auto wire : {lct::WireFormat::json, lct::WireFormat::msgpack, lct::WireFormat::cbor}) {
+            const std::string bytes = lct::wire_encode(value, wire);
+            const double n = static_cast<double>(bytes.size());
+            std::string out;
+            run.run("wire_encode", {{"payload", name}, {"wire", lct::wire_format_name(wire)}}, [&] {
+                out.clear();
+                lct::wire_encode(value, wire, out);
+            }, n);
+            run.run("wire_decode", {{"payload", name}, {"wire", lct::wire_format_name(wire)}}, [&] {
+                volatile size_t sink = lct::wire_decode(bytes, wire).size(); (void)sink;
+            }, n);
+        }
+    }
+}
+
+void bench_dag(Runner& run) {
+    ToolRegistry reg;
+    reg.register_tool("inc", [](const lct::json& a) { return lct::json{{"v", a.value("v", 0) + 1}}; }, {{"name", "inc"}});
+    for (size_t depth : {size_t(1), size_t(4), size_t(16)}) {
+        // `width` independent chains of `depth` calls each.
+        const size_t width = 4;
+        lct::json tool_calls = lct::json::array();
+        for (size_t w = 0; w < width; ++w) {
+            for (size_t d = 0; d < depth; ++d) {
+                const std::string id = "c" + std::to_string(w) + "_" + std::to_string(d);
+                lct::json args = d == 0 ? lct::json{{"v", 0}}
+                    : lct::json{{"v", {{"$ref", "c" + std::to_string(w) + "_" + std::to_string(d - 1) + ".result.v"}}}};
+                tool_calls.push_back({{"id", id}, {"function", {{"name", "inc"}, {"arguments", args.dump()}}}});
+            }
+        }
+        const lct::json resp = {{"choices", {{{"message", {{"tool_calls", tool_calls}}}}}}};
+        run.run("dag", {{"width", width}, {"depth", depth}}, [&] {
+            reg.process_remote_response_and_execute_dag(resp);
+        }, 0, static_cast<double>(width * depth));
+    }
+}
+
+void bench_conversation(Runner& run) {
+    const lct::json msg = {{"role", "tool"}, {"tool_call_id", "call_1"}, {"content", std::string(512, 'r')}};
+    for (size_t turns : {size_t(10), size_t(200)}) {
+        lct::ConversationBuilder conv(lct::json{{"model", "m"}});
+        for (size_t i = 0; i < turns; ++i) conv.append(msg);
+        run.run("conversation_append", {{"turns", turns}}, [&] { conv.append(msg); });
+        std::string out;
+        run.run("conversation_write", {{"turns", turns}}, [&] {
+            out.clear();
+            lct::StringBodySink sink(out);
+            conv.write_to(sink);
+        }, static_cast<double>(conv.body_size()));
+    }
+}
+
+// One 4 MiB tool result into a request body written to /dev/null: as a json
+// string (dumped into the tool message, then into the body) versus a
+// ResultBody in memory (writev) or in a file (sendfile). "lines" is text with
+// a newline every 50 bytes, so the body goes out as runs between escapes.
+void bench_result_body(Runner& run) {
+    const size_t bytes = 4 << 20;
+    const int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0) return;
+    lct::FdBodySink sink(null_fd);
+    const lct::json user = {{"role", "user"}, {"content", "dump the table"}};
+
+    for (const char* data : {"plain", "lines"}) {
+        std::string text(bytes, 'r');
+        if (std::string(data) == "lines") {
+            for (size_t i = 49; i < bytes; i += 50) text[i] = '\n';
+        }
+        FILE* f = std::tmpfile();
+        if (!f) break;
+        std::fwrite(text.data(), 1, text.size(), f);
+        std::fflush(f);
+        const auto in_memory = lct::ResultBody::from_string(text);
+        const auto in_file = lct::ResultBody::from_fd(fileno(f), 0, bytes);
+        std::fclose(f);
+
+        run.run("tool_result", {{"bytes", bytes}, {"data", data}, {"mode", "json"}}, [&] {
+            lct::ConversationBuilder conv(lct::json{{"model", "m"}});
+            conv.append(user);
+            const lct::json result = text;     // what a handler returning the text builds
+            conv.append(lct::json{{"role", "tool"}, {"tool_call_id", "c1"}, {"content", result.dump()}});
+            conv.write_to(sink);
+        }, static_cast<double>(bytes));
+        for (const auto& [mode, body] : {std::make_pair("body_memory", in_memory), std::make_pair("body_file", in_file)}) {
+            run.run("tool_result", {{"bytes", bytes}, {"data", data}, {"mode", mode}}, [&] {
+                lct::ConversationBuilder conv(lct::json{{"model", "m"}});
+                conv.append(user);
+                conv.append_tool_result("c1", body);
+                conv.write_to(sink);
+            }, static_cast<double>(bytes));
+        }
+    }
+    ::close(null_fd);
+}
+
+// A streaming tool writing 10k small chunks: collected into one result (no
+// consumer for partial updates) versus delivered one by one as they come.
+void bench_streaming_result(Runner& run) {
+    const int chunks = 10000;
+    ToolRegistry reg;
+    reg.register_streaming_tool("tail", [&](const lct::json&, lct::ResultSink& out) {
+        for (int i = 0; i < chunks; ++i) out.write(lct::json{{"line", i}, {"text", "GET /index.html 200"}});
+        return lct::json();
+    }, {{"name", "tail"}});
+    const lct::json response = {{"choices", {{{"message", {{"tool_calls", {{
+        {"id", "t1"}, {"function", {{"name", "tail"}, {"arguments", "{}"}}}}}}}}}}}};
+
+    run.run("streaming_result", {{"chunks", chunks}, {"mode", "collected"}}, [&] {
+        volatile size_t sink = reg.process_remote_response_and_execute(response)[0].result.size(); (void)sink;
+    }, 0, chunks);
+    const std::string body = response.dump();
+    run.run("streaming_result", {{"chunks", chunks}, {"mode", "partial"}}, [&] {
+        bool fed = false;
+        size_t seen = 0;
+        reg.process_streaming_response_and_execute(
+            [&](std::string& out) { if (fed) return false; out = body; return fed = true; },
+            [&](const ToolRegistry::ExecutionResult& r) { seen += r.partial; });
+        volatile size_t sink = seen; (void)sink;
+    }, 0, chunks);
+}
+
+// A tool returning 10 MiB of text, executed as is versus under a 4 KiB
+// result budget (first page serialized, the rest parked under a cursor).
+void bench_result_budget(Runner& run) {
+    const lct::json text = std::string(10 << 20, 'x');
+    const lct::json response = {{"choices", {{{"message", {{"tool_calls", {{
+        {"id", "d1"}, {"function", {{"name", "dump"}, {"arguments", "{}"}}}}}}}}}}}};
+    for (const size_t budget : {size_t(0), size_t(4096)}) {
+        ToolRegistry reg;
+        reg.register_tool("dump", [&](const lct::json&) { return text; }, {{"name", "dump"}});
+        if (budget) reg.set_result_budget(lct::ResultBudget{budget, 0});
+        run.run("result_budget", {{"result_bytes", 10 << 20}, {"budget", budget}}, [&] {
+            // What goes into the next prompt.
+            volatile size_t sink = reg.process_remote_response_and_execute(response)[0].result.dump().size(); (void)sink;
+            if (budget) reg.result_cursors()->clear();
+        });
+    }
+}
+
+void bench_schema_optimizer(Runner& run) {
+    const ToolSpec spec = make_tool(7, echo_handler);
+    const lct::json schema = {{"name", spec.name}, {"description", spec.description}, {"parameters", spec.parameters}};
+    lct::SchemaOptimizeOptions opts;
+    opts.hoist_shared_definitions = true;
+    run.run("optimize_schema", json::object(), [&] { lct::optimize_schema(schema, opts); });
+}
+
+void bench_result_encoder(Runner& run) {
+    lct::json rows = lct::json::array();
+    for (int i = 0; i < 1000; ++i) {
+        rows.push_back({{"id", i}, {"name", "item " + std::to_string(i)}, {"price", (i + 1) / 7.0}, {"note", nullptr}});
+    }
+    lct::ResultEncodeOptions opts;
+    opts.float_digits = 4;
+    run.run("encode_result", {{"rows", 1000}}, [&] { lct::encode_result(rows, opts); }, 0, 1000);
+}
+
+void bench_metrics(Runner& run) {
+    ToolRegistry reg;
+    reg.register_tool_spec(make_tool(0, echo_handler));
+    for (int i = 0; i < 1000; ++i) reg.invoke("tool_0", {{"id", "1"}});
+    run.run("metrics_prometheus", {{"tools", 1}}, [&] {
+        volatile size_t sink = reg.metrics_prometheus().size(); (void)sink;
+    });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (has_flag(argc, argv, "help")) {
+        std::cout << "usage: lct_bench [--filter <substring>] [--min-time-ms <ms>] [--samples <n>] [--out <file>]\n";
+        return 0;
+    }
+    Runner run(arg_value(argc, argv, "filter", ""),
+               std::stoull(arg_value(argc, argv, "min-time-ms", "200")) * 1000000ull,
+               std::stoul(arg_value(argc, argv, "samples", "5")));
+
+    bench_registry_sizes(run);
+    bench_argument_parsing(run);
+    bench_arena(run);
+    bench_streaming(run);
+    bench_fanout(run);
+    bench_large_arguments(run);
+#ifdef __linux__
+    bench_worker_pool(run);
+#endif
+    bench_wire_format(run);
+    bench_dag(run);
+    bench_conversation(run);
+    bench_result_body(run);
+    bench_streaming_result(run);
+    bench_result_budget(run);
+    bench_schema_optimizer(run);
+    bench_result_encoder(run);
+    bench_metrics(run);
+
+    const std::string text = run.report().dump(2);
+    const std::string out = arg_value(argc, argv, "out", "");
+    if (out.empty()) {
+        std::cout << text << '\n';
+    } else {
+        std::ofstream f(out);
+        if (!f) { std::cerr << "cannot write " << out << '\n'; return 1; }
+        f << text << '\n';
+    }
+    return 0;
+}
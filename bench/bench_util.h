@@ -0,0 +1,93 @@
+#pragma once
+
+// Shared helpers for the benchmark / load tools under bench/. Not installed.
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace lct_bench {
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+inline std::uint64_t ns_since(Clock::time_point t0) {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+}
+
+// Nearest-rank percentile of an unsorted sample (sorts a copy).
+inline double percentile(std::vector<double> v, double q) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    const size_t rank = static_cast<size_t>(std::ceil(q * static_cast<double>(v.size())));
+    return v[std::min(v.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+// {"p50":..,"p90":..,"p99":..,"p999":..,"max":..} of `v`, in the unit of `v`.
+inline json percentiles_json(const std::vector<double>& v) {
+    json j = json::object();
+    j["count"] = v.size();
+    j["p50"] = percentile(v, 0.50);
+    j["p90"] = percentile(v, 0.90);
+    j["p99"] = percentile(v, 0.99);
+    j["p999"] = percentile(v, 0.999);
+    j["max"] = v.empty() ? 0.0 : *std::max_element(v.begin(), v.end());
+    return j;
+}
+
+// Build information stamped on every report so runs can be diffed.
+inline json environment_json() {
+    json env;
+#if defined(__clang__)
+    env["compiler"] = std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+    env["compiler"] = std::string("gcc ") + __VERSION__;
+#else
+    env["compiler"] = "unknown";
+#endif
+#ifdef NDEBUG
+    env["assertions"] = false;
+#else
+    env["assertions"] = true;
+#endif
+    env["hardware_threads"] = std::thread::hardware_concurrency();
+    return env;
+}
+
+// "--name value" / "--name=value" lookup; returns `fallback` if absent.
+inline std::string arg_value(int argc, char** argv, const std::string& name, const std::string& fallback) {
+    const std::string flag = "--" + name;
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        if (a == flag && i + 1 < argc) return argv[i + 1];
+        if (a.compare(0, flag.size() + 1, flag + "=") == 0) return a.substr(flag.size() + 1);
+    }
+    return fallback;
+}
+
+inline bool has_flag(int argc, char** argv, const std::string& name) {
+    for (int i = 1; i < argc; ++i) if (argv[i] == "--" + name) return true;
+    return false;
+}
+
+// Busy-waits `ns` (sleep granularity is too coarse for microsecond stubs).
+inline void spin_for(std::uint64_t ns) {
+    const auto t0 = Clock::now();
+    while (ns_since(t0) < ns) {}
+}
+
+// Tool latency stub: spin below 200 us, sleep above.
+inline void simulate_latency(std::uint64_t ns) {
+    if (ns == 0) return;
+    if (ns < 200000) spin_for(ns);
+    else std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+}
+
+} // namespace lct_bench
@@ -0,0 +1,316 @@
+// lct_loadgen: open-loop synthetic load against an in-process ToolRegistry.
+//
+//   lct_loadgen [--rate <req/s>] [--duration-s <s>] [--sessions <n>]
+//               [--fanout <calls>] [--arg-bytes <n>] [--stream-ratio <0..1>]
+//               [--chunk-bytes <n>] [--tool-latency <dist>] [--serial-tools]
+//               [--seed <n>] [--out <file>]
+//
+// Requests arrive as a Poisson process at --rate, independent of how fast
+// they complete (open loop). Each is a synthesized OpenAI-style response
+// with --fanout tool calls, or with probability --stream-ratio the same
+// response as an SSE stream cut into --chunk-bytes chunks. --sessions
+// worker threads drive them into the registry.
+//
+// Latency is measured from the request's *intended* arrival time, so time
+// spent queued behind a stalled worker is counted (coordinated-omission
+// correction); "service" latency, from when a worker picked it up, is
+// reported next to it.
+//
+// --tool-latency: fixed:<us> | exp:<mean_us> | lognormal:<median_us>,<sigma>
+
+#include "bench_util.h"
+
+#include "llama_cpp_tools/metrics.h"
+#include "llama_cpp_tools/tool_registry.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+using namespace lct_bench;
+using lct::LatencyHistogram;
+using lct::ToolRegistry;
+
+namespace {
+
+struct Options {
+    double rate = 200.0;
+    double duration_s = 10.0;
+    size_t sessions = 8;
+    size_t fanout = 4;
+    size_t arg_bytes = 256;
+    double stream_ratio = 0.5;
+    size_t chunk_bytes = 32;
+    std::string tool_latency = "exp:500";
+    bool concurrent_tools = true;
+    std::uint64_t seed = 1;
+};
+
+// Samples tool latencies (ns) from the --tool-latency distribution.
+class LatencyDist {
+public:
+    explicit LatencyDist(const std::string& spec) {
+        const size_t colon = spec.find(':');
+        kind_ = spec.substr(0, colon);
+        const std::string args = colon == std::string::npos ? "" : spec.substr(colon + 1);
+        const size_t comma = args.find(',');
+        a_ = args.empty() ? 0.0 : std::stod(args.substr(0, comma));
+        b_ = comma == std::string::npos ? 1.0 : std::stod(args.substr(comma + 1));
+        if (kind_ != "fixed" && kind_ != "exp" && kind_ != "lognormal")
+            throw std::runtime_error("unknown --tool-latency distribution: " + spec);
+    }
+
+    std::uint64_t sample(std::mt19937_64& rng) const {
+        double us = a_;
+        if (kind_ == "exp") us = std::exponential_distribution<double>(1.0 / std::max(a_, 1e-9))(rng);
+        else if (kind_ == "lognormal") us = std::lognormal_distribution<double>(std::log(std::max(a_, 1e-9)), b_)(rng);
+        return static_cast<std::uint64_t>(us * 1000.0);
+    }
+
+private:
+    std::string kind_;
+    double a_ = 0.0;
+    double b_ = 1.0;
+};
+
+struct Request {
+    Clock::time_point intended;
+    size_t payload;
+    bool stream;
+};
+
+// Pre-built payloads so generating load costs nothing during the run.
+struct Payload {
+    lct::json response;
+    std::string sse;
+};
+
+std::vector<Payload> build_payloads(const Options& o, std::mt19937_64& rng) {
+    std::vector<Payload> out;
+    std::uniform_int_distribution<int> letter('a', 'z');
+    for (size_t p = 0; p < 64; ++p) {
+        lct::json tool_calls = lct::json::array();
+        for (size_t i = 0; i < o.fanout; ++i) {
+            std::string blob(o.arg_bytes, 'x');
+            for (auto& c : blob) c = static_cast<char>(letter(rng));
+            lct::json args = {{"q", std::to_string(p) + "_" + std::to_string(i)}, {"blob", blob}};
+            tool_calls.push_back({{"id", "call_" + std::to_string(i)}, {"type", "function"},
+                                  {"function", {{"name", "tool_" + std::to_string(i % 8)}, {"arguments", args.dump()}}}});
+        }
+        Payload pl;
+        pl.response = {{"choices", {{{"message", {{"role", "assistant"}, {"tool_calls", tool_calls}}}}}}};
+        for (const auto& tc : tool_calls) {
+            lct::json delta = {{"choices", {{{"delta", {{"tool_calls", {tc}}}}}}}};
+            pl.sse += "data: " + delta.dump() + "\n\n";
+        }
+        pl.sse += "data: [DONE]\n\n";
+        out.push_back(std::move(pl));
+    }
+    return out;
+}
+
+// Current thread count of this process (Linux); 0 where unavailable.
+size_t process_threads() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) return std::stoul(line.substr(8));
+    }
+    return 0;
+}
+
+lct::json histogram_us(const LatencyHistogram& h) {
+    auto us = [&](double q) { return static_cast<double>(h.percentile(q)) / 1000.0; };
+    return {{"count", h.count()}, {"p50", us(0.50)}, {"p90", us(0.90)}, {"p99", us(0.99)},
+            {"p999", us(0.999)}, {"max", static_cast<double>(h.max_ns()) / 1000.0}};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (has_flag(argc, argv, "help")) {
+        std::cout << "usage: lct_loadgen [--rate <req/s>] [--duration-s <s>] [--sessions <n>] [--fanout <calls>]\n"
+                     "                   [--arg-bytes <n>] [--stream-ratio <0..1>] [--chunk-bytes <n>]\n"
+                     "                   [--tool-latency fixed:<us>|exp:<mean_us>|lognormal:<median_us>,<sigma>]\n"
+                     "                   [--serial-tools] [--seed <n>] [--out <file>]\n";
+        return 0;
+    }
+    try {
+        Options o;
+        o.rate = std::stod(arg_value(argc, argv, "rate", "200"));
+        o.duration_s = std::stod(arg_value(argc, argv, "duration-s", "10"));
+        o.sessions = std::max<size_t>(1, std::stoul(arg_value(argc, argv, "sessions", "8")));
+        o.fanout = std::max<size_t>(1, std::stoul(arg_value(argc, argv, "fanout", "4")));
+        o.arg_bytes = std::stoul(arg_value(argc, argv, "arg-bytes", "256"));
+        o.stream_ratio = std::stod(arg_value(argc, argv, "stream-ratio", "0.5"));
+        o.chunk_bytes = std::max<size_t>(1, std::stoul(arg_value(argc, argv, "chunk-bytes", "32")));
+        o.tool_latency = arg_value(argc, argv, "tool-latency", o.tool_latency);
+        o.concurrent_tools = !has_flag(argc, argv, "serial-tools");
+        o.seed = std::stoull(arg_value(argc, argv, "seed", "1"));
+        if (o.rate <= 0) throw std::runtime_error("--rate must be positive");
+
+        std::mt19937_64 rng(o.seed);
+        const LatencyDist dist(o.tool_latency);
+        const std::vector<Payload> payloads = build_payloads(o, rng);
+
+        ToolRegistry reg;
+        for (int t = 0; t < 8; ++t) {
+            const std::string name = "tool_" + std::to_string(t);
+            reg.register_tool(name, [&dist, seed = o.seed + t](const lct::json&) {
+                thread_local std::mt19937_64 tool_rng(seed ^ std::hash<std::thread::id>()(std::this_thread::get_id()));
+                simulate_latency(dist.sample(tool_rng));
+                return lct::json{{"ok", true}};
+            }, {{"name", name}, {"parameters", {{"type", "object"}}}});
+        }
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Request> queue;
+        bool closing = false;
+        size_t peak_backlog = 0;
+
+        struct WorkerStats {
+            LatencyHistogram latency, service;
+            std::uint64_t calls = 0, errors = 0, requests = 0;
+        };
+        std::vector<WorkerStats> wstats(o.sessions);
+
+        std::vector<std::thread> workers;
+        for (size_t w = 0; w < o.sessions; ++w) {
+            workers.emplace_back([&, w] {
+                WorkerStats& ws = wstats[w];
+                while (true) {
+                    Request req;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cv.wait(lock, [&] { return closing || !queue.empty(); });
+                        if (queue.empty()) return;
+                        req = queue.front();
+                        queue.pop_front();
+                    }
+                    const auto picked = Clock::now();
+                    const Payload& pl = payloads[req.payload];
+                    if (!req.stream) {
+                        for (const auto& r : reg.process_remote_response_and_execute(pl.response, o.concurrent_tools)) {
+                            ++ws.calls;
+                            ws.errors += !r.error.empty();
+                        }
+                    } else {
+                        size_t pos = 0;
+                        reg.process_streaming_response_and_execute(
+                            [&](std::string& out) {
+                                if (pos >= pl.sse.size()) return false;
+                                out.assign(pl.sse, pos, o.chunk_bytes);
+                                pos += o.chunk_bytes;
+                                return true;
+                            },
+                            [&](const ToolRegistry::ExecutionResult& r) {
+                                ++ws.calls;
+                                ws.errors += !r.error.empty();
+                            },
+                            o.concurrent_tools);
+                    }
+                    const auto done = Clock::now();
+                    ws.latency.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - req.intended).count()));
+                    ws.service.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - picked).count()));
+                    ++ws.requests;
+                }
+            });
+        }
+
+        std::atomic<bool> sampling{ true };
+        std::atomic<size_t> peak_threads{ process_threads() };
+        std::thread sampler([&] {
+            while (sampling.load()) {
+                const size_t n = process_threads();
+                if (n > peak_threads.load()) peak_threads.store(n);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+
+        // Open-loop arrivals: the schedule is fixed up front by the Poisson
+        // process and never waits on completions.
+        std::exponential_distribution<double> gap(o.rate);
+        std::bernoulli_distribution is_stream(std::min(std::max(o.stream_ratio, 0.0), 1.0));
+        std::uniform_int_distribution<size_t> pick(0, payloads.size() - 1);
+        const auto start = Clock::now();
+        const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(o.duration_s));
+        std::uint64_t issued = 0;
+        auto next = start;
+        while (true) {
+            next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(gap(rng)));
+            if (next >= end) break;
+            std::this_thread::sleep_until(next);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(Request{ next, pick(rng), is_stream(rng) });
+                peak_backlog = std::max(peak_backlog, queue.size());
+            }
+            cv.notify_one();
+            ++issued;
+        }
+        const double offered_s = std::chrono::duration<double>(Clock::now() - start).count();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        cv.notify_all();
+        for (auto& t : workers) t.join();
+        const double wall_s = std::chrono::duration<double>(Clock::now() - start).count();
+        sampling.store(false);
+        sampler.join();
+
+        WorkerStats total;
+        for (const auto& ws : wstats) {
+            total.latency.merge(ws.latency);
+            total.service.merge(ws.service);
+            total.calls += ws.calls;
+            total.errors += ws.errors;
+            total.requests += ws.requests;
+        }
+        LatencyHistogram tool_exec, tool_queue;
+        for (int t = 0; t < 8; ++t) {
+            const lct::ToolMetrics m = reg.tool_metrics("tool_" + std::to_string(t));
+            tool_exec.merge(m.exec);
+            tool_queue.merge(m.queue);
+        }
+
+        lct::json report = {
+            {"benchmark", "lct_loadgen"},
+            {"environment", environment_json()},
+            {"config", {{"rate", o.rate}, {"duration_s", o.duration_s}, {"sessions", o.sessions},
+                        {"fanout", o.fanout}, {"arg_bytes", o.arg_bytes}, {"stream_ratio", o.stream_ratio},
+                        {"chunk_bytes", o.chunk_bytes}, {"tool_latency", o.tool_latency},
+                        {"concurrent_tools", o.concurrent_tools}, {"seed", o.seed}}},
+            {"requests", {{"issued", issued}, {"completed", total.requests}, {"peak_backlog", peak_backlog}}},
+            {"throughput", {{"offered_rps", issued / offered_s}, {"achieved_rps", total.requests / wall_s},
+                            {"calls_per_sec", total.calls / wall_s}}},
+            {"calls", total.calls},
+            {"tool_errors", total.errors},
+            {"latency_us", histogram_us(total.latency)},
+            {"service_latency_us", histogram_us(total.service)},
+            {"tool_queue_us", histogram_us(tool_queue)},
+            {"tool_exec_us", histogram_us(tool_exec)},
+            {"threads", {{"sessions", o.sessions}, {"peak_process_threads", peak_threads.load()}}},
+            {"wall_seconds", wall_s},
+        };
+
+        const std::string text = report.dump(2);
+        const std::string out = arg_value(argc, argv, "out", "");
+        if (out.empty()) {
+            std::cout << text << '\n';
+        } else {
+            std::ofstream f(out);
+            if (!f) throw std::runtime_error("cannot write " + out);
+            f << text << '\n';
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "lct_loadgen: " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,338 @@
+// lct_replay: feeds a captured corpus of model responses and SSE streams
+// through the registry, with every tool stubbed, and reports throughput and
+// latency percentiles.
+//
+//   lct_replay <corpus> [--speed fast|recorded] [--tool-latency-us <us>]
+//              [--concurrent] [--repeat <n>] [--write-binary <file>] [--out <file>]
+//
+// Corpus formats (picked by the first byte; the file is mmapped):
+//
+//   JSONL, one record per line:
+//     {"kind":"response","body":{...}}
+//     {"kind":"stream","chunks":[{"delay_us":0,"data":"data: {...}\n\n"}, ...]}
+//
+//   Length-prefixed binary (magic "LCTR"), little-endian, chunks kept raw:
+//     "LCTR" u32 version=1, then per record:
+//       u32 record_bytes, u8 kind (0 response, 1 stream), then
+//       response: the JSON body
+//       stream:   u32 chunk_count, per chunk: u32 delay_us, u32 len, bytes
+//
+// --write-binary converts a JSONL corpus to the binary form.
+
+#include "bench_util.h"
+
+#include "llama_cpp_tools/tool_registry.h"
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace lct_bench;
+using lct::ToolRegistry;
+
+namespace {
+
+struct Chunk {
+    std::uint32_t delay_us = 0;     // gap before this chunk in the capture
+    std::string_view data;          // points into the mapping or into `owned`
+};
+
+struct Record {
+    bool stream = false;
+    std::string_view body;          // response records
+    std::vector<Chunk> chunks;      // stream records
+};
+
+// Read-only mapping of the corpus file.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            const int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "stat " + path);
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                const int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "mmap " + path);
+            }
+            data_ = static_cast<const char*>(p);
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+    ~MappedFile() { if (data_) ::munmap(const_cast<char*>(data_), size_); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const { return { data_, size_ }; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+class Corpus {
+public:
+    explicit Corpus(const std::string& path) : file_(path) {
+        const std::string_view v = file_.view();
+        if (v.substr(0, 4) == "LCTR") parse_binary(v);
+        else parse_jsonl(v);
+    }
+
+    const std::vector<Record>& records() const { return records_; }
+
+    void write_binary(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) throw std::runtime_error("cannot write " + path);
+        out.write("LCTR", 4);
+        put_u32(out, 1);
+        for (const auto& r : records_) {
+            std::string rec;
+            rec.push_back(r.stream ? 1 : 0);
+            if (!r.stream) {
+                rec.append(r.body);
+            } else {
+                append_u32(rec, static_cast<std::uint32_t>(r.chunks.size()));
+                for (const auto& c : r.chunks) {
+                    append_u32(rec, c.delay_us);
+                    append_u32(rec, static_cast<std::uint32_t>(c.data.size()));
+                    rec.append(c.data);
+                }
+            }
+            put_u32(out, static_cast<std::uint32_t>(rec.size()));
+            out.write(rec.data(), static_cast<std::streamsize>(rec.size()));
+        }
+    }
+
+private:
+    static void append_u32(std::string& s, std::uint32_t v) {
+        for (int i = 0; i < 4; ++i) s.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+    }
+    static void put_u32(std::ofstream& out, std::uint32_t v) {
+        std::string s;
+        append_u32(s, v);
+        out.write(s.data(), 4);
+    }
+    static std::uint32_t get_u32(std::string_view v, size_t& pos) {
+        if (pos + 4 > v.size()) throw std::runtime_error("corpus truncated at byte " + std::to_string(pos));
+        std::uint32_t x = 0;
+        for (int i = 0; i < 4; ++i) x |= static_cast<std::uint32_t>(static_cast<unsigned char>(v[pos + i])) << (8 * i);
+        pos += 4;
+        return x;
+    }
+
+    void parse_binary(std::string_view v) {
+        size_t pos = 4;
+        if (get_u32(v, pos) != 1) throw std::runtime_error("unsupported corpus version");
+        while (pos < v.size()) {
+            const std::uint32_t len = get_u32(v, pos);
+            if (len == 0 || pos + len > v.size()) throw std::runtime_error("corpus truncated at byte " + std::to_string(pos));
+            const std::string_view rec = v.substr(pos, len);
+            pos += len;
+            Record r;
+            r.stream = rec[0] == 1;
+            if (!r.stream) {
+                r.body = rec.substr(1);
+            } else {
+                size_t p = 1;
+                const std::uint32_t n = get_u32(rec, p);
+                for (std::uint32_t i = 0; i < n; ++i) {
+                    Chunk c;
+                    c.delay_us = get_u32(rec, p);
+                    const std::uint32_t clen = get_u32(rec, p);
+                    if (p + clen > rec.size()) throw std::runtime_error("corpus chunk overruns its record");
+                    c.data = rec.substr(p, clen);
+                    p += clen;
+                    r.chunks.push_back(c);
+                }
+            }
+            records_.push_back(std::move(r));
+        }
+    }
+
+    // JSON strings must be unescaped, so JSONL chunk data is copied into
+    // `owned_` once at load time; replay itself never copies.
+    void parse_jsonl(std::string_view v) {
+        size_t line_no = 0;
+        while (!v.empty()) {
+            const size_t nl = v.find('\n');
+            const std::string_view line = v.substr(0, nl);
+            v = nl == std::string_view::npos ? std::string_view() : v.substr(nl + 1);
+            ++line_no;
+            if (line.find_first_not_of(" \t\r") == std::string_view::npos) continue;
+
+            const lct::json j = lct::json::parse(line.begin(), line.end());
+            Record r;
+            const std::string kind = j.value("kind", "response");
+            if (kind == "response") {
+                owned_.push_back(j.at("body").dump());
+                r.body = owned_.back();
+            } else if (kind == "stream") {
+                r.stream = true;
+                for (const auto& c : j.at("chunks")) {
+                    owned_.push_back(c.at("data").get<std::string>());
+                    r.chunks.push_back(Chunk{ c.value("delay_us", 0u), owned_.back() });
+                }
+            } else {
+                throw std::runtime_error("line " + std::to_string(line_no) + ": unknown kind " + kind);
+            }
+            records_.push_back(std::move(r));
+        }
+    }
+
+    MappedFile file_;
+    std::deque<std::string> owned_;     // stable addresses
+    std::vector<Record> records_;
+};
+
+// Registers a stub for every tool name that occurs in the corpus.
+void register_stubs(ToolRegistry& reg, const Corpus& corpus, std::uint64_t latency_ns) {
+    std::set<std::string> names;
+    auto collect = [&](std::string_view text) {
+        lct::json j = lct::json::parse(text.begin(), text.end(), nullptr, false);
+        if (j.is_discarded()) return;
+        for (const auto& c : ToolRegistry::find_tool_calls(j)) names.insert(c.name);
+    };
+    for (const auto& r : corpus.records()) {
+        if (!r.stream) { collect(r.body); continue; }
+        // Stream values can span chunks; reassemble and scan each SSE event.
+        std::string all;
+        for (const auto& c : r.chunks) all.append(c.data);
+        size_t pos = 0;
+        while ((pos = all.find('{', pos)) != std::string::npos) {
+            const size_t end = all.find("\n\n", pos);
+            collect(std::string_view(all).substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+            if (end == std::string::npos) break;
+            pos = end;
+        }
+    }
+    for (const auto& name : names) {
+        reg.register_tool(name, [latency_ns](const lct::json&) {
+            simulate_latency(latency_ns);
+            return lct::json{{"ok", true}};
+        }, {{"name", name}, {"description", "replay stub"}, {"parameters", {{"type", "object"}}}});
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2 || has_flag(argc, argv, "help")) {
+        std::cerr << "usage: lct_replay <corpus> [--speed fast|recorded] [--tool-latency-us <us>] "
+                     "[--concurrent] [--repeat <n>] [--write-binary <file>] [--out <file>]\n";
+        return argc < 2 ? 2 : 0;
+    }
+    try {
+        const Corpus corpus(argv[1]);
+        const std::string binary_out = arg_value(argc, argv, "write-binary", "");
+        if (!binary_out.empty()) {
+            corpus.write_binary(binary_out);
+            std::cerr << "wrote " << corpus.records().size() << " records to " << binary_out << '\n';
+            return 0;
+        }
+
+        const bool recorded = arg_value(argc, argv, "speed", "fast") == "recorded";
+        const bool concurrent = has_flag(argc, argv, "concurrent");
+        const std::uint64_t latency_ns = std::stoull(arg_value(argc, argv, "tool-latency-us", "0")) * 1000;
+        const size_t repeat = std::stoul(arg_value(argc, argv, "repeat", "1"));
+
+        ToolRegistry reg;
+        register_stubs(reg, corpus, latency_ns);
+
+        std::vector<double> response_us, stream_us, first_result_us;
+        std::uint64_t bytes = 0, calls = 0, errors = 0, responses = 0, streams = 0;
+
+        const auto t0 = Clock::now();
+        for (size_t rep = 0; rep < repeat; ++rep) {
+            for (const auto& r : corpus.records()) {
+                if (!r.stream) {
+                    const auto start = Clock::now();
+                    auto results = reg.process_remote_response_and_execute(
+                        lct::json::parse(r.body.begin(), r.body.end()), concurrent);
+                    response_us.push_back(static_cast<double>(ns_since(start)) / 1000.0);
+                    bytes += r.body.size();
+                    calls += results.size();
+                    for (const auto& x : results) errors += !x.error.empty();
+                    ++responses;
+                    continue;
+                }
+
+                size_t next = 0;
+                bool first = true;
+                const auto start = Clock::now();
+                reg.process_streaming_response_and_execute(
+                    [&](std::string& out) {
+                        if (next >= r.chunks.size()) return false;
+                        const Chunk& c = r.chunks[next++];
+                        if (recorded && c.delay_us) std::this_thread::sleep_for(std::chrono::microseconds(c.delay_us));
+                        out.assign(c.data.data(), c.data.size());
+                        bytes += c.data.size();
+                        return true;
+                    },
+                    [&](const ToolRegistry::ExecutionResult& x) {
+                        if (first) first_result_us.push_back(static_cast<double>(ns_since(start)) / 1000.0);
+                        first = false;
+                        ++calls;
+                        errors += !x.error.empty();
+                    },
+                    concurrent);
+                stream_us.push_back(static_cast<double>(ns_since(start)) / 1000.0);
+                ++streams;
+            }
+        }
+        const double wall_s = static_cast<double>(ns_since(t0)) / 1e9;
+
+        const lct::StreamTotals st = reg.stream_stats();
+        lct::json report = {
+            {"benchmark", "lct_replay"},
+            {"environment", environment_json()},
+            {"corpus", argv[1]},
+            {"config", {{"speed", recorded ? "recorded" : "fast"}, {"concurrent", concurrent},
+                        {"tool_latency_us", latency_ns / 1000}, {"repeat", repeat}}},
+            {"records", {{"responses", responses}, {"streams", streams}}},
+            {"wall_seconds", wall_s},
+            {"throughput", {{"records_per_sec", (responses + streams) / wall_s},
+                            {"calls_per_sec", calls / wall_s},
+                            {"mb_per_sec", bytes / wall_s / 1e6}}},
+            {"calls", calls},
+            {"tool_errors", errors},
+            {"stream_parse_failures", {{"syntax", st.sum.syntax_errors}, {"truncated", st.sum.truncated},
+                                       {"dispatch", st.sum.dispatch_errors}}},
+            {"latency_us", {{"response", percentiles_json(response_us)},
+                            {"stream", percentiles_json(stream_us)},
+                            {"stream_first_result", percentiles_json(first_result_us)}}},
+        };
+
+        const std::string text = report.dump(2);
+        const std::string out = arg_value(argc, argv, "out", "");
+        if (out.empty()) {
+            std::cout << text << '\n';
+        } else {
+            std::ofstream f(out);
+            if (!f) throw std::runtime_error("cannot write " + out);
+            f << text << '\n';
+        }
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "lct_replay: " << e.what() << '\n';
+        return 1;
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "llama_cpp_tools/tool_registry.h"
+#include "llama_cpp_tools/conversation_builder.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lct {
+
+// Carries one chat-completions request body to a model server and returns the
+// raw response body. Implementations own HTTP, retries, auth...
+class ChatTransport {
+public:
+    virtual ~ChatTransport() = default;
+    virtual std::string send(const std::string& request_body) = 0;
+
+    // Gather form used by AgentLoop. The default concatenates once; socket
+    // transports override it to write body.segments() with writev().
+    virtual std::string send_body(const ConversationBuilder& body) { return send(body.str()); }
+};
+
+// In-process stand-in for a llama.cpp / OpenAI-compatible server, for tests
+// and benchmarks. Each request is parsed, handed to `responder`, and its
+// return value sent back after `latency`. Requests are recorded.
+class MockChatTransport : public ChatTransport {
+public:
+    using Responder = std::function<json(const json& request, size_t turn)>;
+
+    explicit MockChatTransport(Responder responder,
+                               std::chrono::microseconds latency = std::chrono::microseconds(0));
+
+    std::string send(const std::string& request_body) override;
+
+    std::vector<json> requests() const;
+
+    // Canned responses for the scripted case.
+    static json tool_call_response(const std::vector<ToolCall>& calls);
+    static json text_response(const std::string& content);
+
+private:
+    Responder responder_;
+    std::chrono::microseconds latency_;
+    mutable std::mutex mutex_;
+    std::vector<json> requests_;
+};
+
+struct AgentLoopOptions {
+    std::string model;
+    size_t max_turns = 8;
+    bool concurrent_tools = true;
+    ToolOrder tool_order = ToolOrder::stable;   // keeps the server's prompt cache warm
+    json request_extra = json::object();  // merged into every request (temperature, ...)
+};
+
+// Where the time of one model turn went. Serialization overlapping tool
+// execution is still counted in serialize_us.
+struct AgentTurnStats {
+    std::uint64_t model_us = 0;       // transport round-trip
+    std::uint64_t tools_us = 0;       // dispatch to last tool result
+    std::uint64_t serialize_us = 0;   // building the request body and parsing the response
+    size_t tool_calls = 0;
+    size_t request_bytes = 0;
+};
+
+struct AgentRunResult {
+    json messages = json::array();     // the whole conversation, final assistant message included
+    json final_message;                // last assistant message
+    std::vector<AgentTurnStats> turns;
+    bool finished = false;             // false if max_turns was reached with tool calls pending
+    // Tool messages whose content is a ResultBody (set_result_body): index in
+    // `messages` -> body. Those messages carry "content": null, so the bytes
+    // are not copied into the transcript.
+    std::map<size_t, std::shared_ptr<const ResultBody>> bodies;
+};
+
+// Multi-turn tool-calling loop: send the conversation with the registry's
+// tools, execute the tool calls the model asks for, append the assistant
+// message and one role:"tool" message per call (with its tool_call_id), and
+// repeat until the model answers without calling a tool.
+//
+// While a turn's tools run, the next request body is already being
+// serialized. The body lives in a ConversationBuilder, so each message is
+// serialized once for the whole run rather than once per turn.
+class AgentLoop {
+public:
+    AgentLoop(const ToolRegistry& reg, ChatTransport& transport);
+    AgentLoop(const ToolRegistry& reg, ChatTransport& transport, AgentLoopOptions opts);
+
+    AgentRunResult run(json messages);
+
+private:
+    const ToolRegistry& reg_;
+    ChatTransport& transport_;
+    AgentLoopOptions opts_;
+    ConversationBuilder conv_;
+};
+
+} // namespace lct
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace lct {
+
+// Process-wide heap allocation counters. They only move in programs that
+// link the lct_alloc_hook object library (the tests and benchmarks do),
+// which replaces the global operator new/delete; everywhere else
+// allocation_hook_installed() is false and the counts stay zero.
+struct AllocationCounts {
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    std::uint64_t bytes = 0;          // requested bytes, allocations only
+};
+
+bool allocation_hook_installed();
+AllocationCounts allocation_counts();
+
+// Allocations made (by any thread) between construction and delta().
+class AllocationScope {
+public:
+    AllocationScope() : start_(allocation_counts()) {}
+
+    AllocationCounts delta() const {
+        const AllocationCounts now = allocation_counts();
+        return { now.allocations - start_.allocations, now.deallocations - start_.deallocations,
+                 now.bytes - start_.bytes };
+    }
+
+private:
+    AllocationCounts start_;
+};
+
+namespace detail {
+    // Called by the replacement operators.
+    void note_allocation(std::size_t bytes) noexcept;
+    void note_deallocation() noexcept;
+    void mark_allocation_hook_installed() noexcept;
+} // namespace detail
+
+} // namespace lct
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace lct {
+
+struct ArenaOptions {
+    size_t chunk_bytes = 64 * 1024;   // size of each block taken from the system
+    // Back chunks with huge pages: explicit (MAP_HUGETLB) when the system has
+    // them reserved, otherwise transparent huge pages via madvise. Chunks are
+    // rounded up to 2 MiB. Linux only; ignored elsewhere.
+    bool huge_pages = false;
+};
+
+// Bump allocator for data that dies together (one parsed response, one
+// stream value). Individual frees are no-ops; reset() rewinds to the first
+// chunk in O(1) and keeps every chunk for reuse, release() gives the memory
+// back. Not thread-safe: use one arena per thread / per session.
+class Arena {
+public:
+    Arena() : Arena(ArenaOptions()) {}
+    explicit Arena(ArenaOptions opts) : opts_(opts) {}
+    ~Arena() { release(); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        auto p = reinterpret_cast<std::uintptr_t>(cursor_);
+        p = (p + align - 1) & ~(static_cast<std::uintptr_t>(align) - 1);
+        if (cursor_ && p + bytes <= reinterpret_cast<std::uintptr_t>(limit_)) {
+            cursor_ = reinterpret_cast<char*>(p + bytes);
+            used_ += bytes;
+            return reinterpret_cast<void*>(p);
+        }
+        return allocate_slow(bytes, align);
+    }
+
+    void reset();
+    void release();
+
+    size_t bytes_used() const { return used_; }           // since the last reset
+    size_t bytes_reserved() const { return reserved_; }
+    size_t chunk_count() const { return chunks_.size(); }
+    bool huge_pages_active() const { return huge_active_; }
+
+private:
+    struct Chunk {
+        char* base;
+        size_t size;
+        bool mapped;      // mmap'ed (huge-page backed) rather than operator new
+    };
+
+    void* allocate_slow(size_t bytes, size_t align);
+    Chunk new_chunk(size_t min_bytes);
+    void enter(size_t index);
+
+    ArenaOptions opts_;
+    std::vector<Chunk> chunks_;
+    size_t current_ = 0;
+    char* cursor_ = nullptr;
+    char* limit_ = nullptr;
+    size_t used_ = 0;
+    size_t reserved_ = 0;
+    bool huge_active_ = false;
+};
+
+// The arena that ArenaAllocator draws from on this thread (nullptr: heap).
+Arena* current_arena();
+
+// Makes `arena` the thread's current arena until the scope ends.
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena);
+    ~ArenaScope();
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena* previous_;
+};
+
+namespace detail {
+    void* arena_allocate(size_t bytes);
+    void arena_deallocate(void* p) noexcept;
+} // namespace detail
+
+// Stateless allocator over the current arena, so it can be plugged into
+// nlohmann::basic_json (which default-constructs its allocators). Each block
+// carries a 16-byte tag saying where it came from: blocks taken while no
+// arena was current are freed normally, arena blocks are left to reset().
+// Anything allocated from an arena must be destroyed before that arena is
+// reset or released.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    ArenaAllocator() noexcept = default;
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= 16, "ArenaAllocator aligns to 16 bytes");
+        return static_cast<T*>(detail::arena_allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t) noexcept { detail::arena_deallocate(p); }
+
+    template <typename U> bool operator==(const ArenaAllocator<U>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const ArenaAllocator<U>&) const noexcept { return false; }
+};
+
+using arena_string = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+// A JSON DOM whose nodes and strings live in the current arena. Convert a
+// subtree to lct::json with `json(value)` to keep it past the arena's life.
+using arena_json = nlohmann::basic_json<std::map, std::vector, arena_string, bool, std::int64_t,
+                                        std::uint64_t, double, ArenaAllocator>;
+
+} // namespace lct
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace lct {
+
+// Fixed-capacity lock-free queue (Vyukov's bounded MPMC algorithm), so it
+// serves SPSC and MPSC stages alike. Capacity is exact, not rounded. T must
+// be default constructible and move assignable. size() is approximate while
+// other threads are pushing or popping.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity_(capacity), ring_(capacity < 2 ? 2 : capacity), cells_(new Cell[ring_])
+    {
+        if (capacity == 0) throw std::invalid_argument("BoundedQueue capacity must be > 0");
+        for (size_t i = 0; i < ring_; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Moves from `v` only on success.
+    bool try_push(T&& v) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            // A one-slot ring can't tell "full" from "free on the next lap",
+            // so capacity 1 runs on two cells with an explicit bound.
+            if (ring_ != capacity_ && pos - tail_.load(std::memory_order_acquire) >= capacity_) return false;
+            Cell& c = cells_[pos % ring_];
+            const size_t seq = c.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = std::move(v);
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& out) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells_[pos % ring_];
+            const size_t seq = c.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(c.value);
+                    c.value = T();
+                    c.seq.store(pos + ring_, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t size() const {
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        return head > tail ? head - tail : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq{0};
+        T value{};
+    };
+
+    const size_t capacity_;
+    const size_t ring_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<size_t> head_{0};   // next enqueue position
+    alignas(64) std::atomic<size_t> tail_{0};   // next dequeue position
+};
+
+} // namespace lct
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include "llama_cpp_tools/result_body.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace lct {
+using json = nlohmann::json;
+
+// Destination for a request body handed over as scatter-gather segments.
+// write() must consume every byte or throw.
+class BodySink {
+public:
+    virtual ~BodySink() = default;
+    virtual void write(const iovec* iov, size_t count) = 0;
+
+    // `length` bytes of `fd` from `offset`, also mapped at `mapped`. The
+    // default writes the mapping; FdBodySink sends straight from the file.
+    virtual void write_file(int fd, off_t offset, size_t length, const void* mapped);
+};
+
+// writev()s straight to a socket, pipe or file; handles partial writes and
+// IOV_MAX batching. Does not own the descriptor.
+class FdBodySink : public BodySink {
+public:
+    explicit FdBodySink(int fd) : fd_(fd) {}
+    void write(const iovec* iov, size_t count) override;
+    void write_file(int fd, off_t offset, size_t length, const void* mapped) override;   // sendfile() on Linux
+
+private:
+    int fd_;
+    std::vector<iovec> batch_;   // reused across writes
+};
+
+// Appends to a string, for transports that need one contiguous body.
+class StringBodySink : public BodySink {
+public:
+    explicit StringBodySink(std::string& out) : out_(out) {}
+    void write(const iovec* iov, size_t count) override;
+
+private:
+    std::string& out_;
+};
+
+// Chat-completions request body built incrementally. Every message is
+// serialized exactly once, when appended, and kept as an immutable byte
+// segment; the request is emitted as head + messages + "]}" through a
+// BodySink without concatenating. Serialization cost per turn is therefore
+// proportional to the new messages, not to the conversation length.
+//
+// Layout: {<head fields>,"messages":[m0,m1,...]} -- messages go last so
+// appending never touches earlier bytes.
+class ConversationBuilder {
+public:
+    ConversationBuilder() { set_head(json::object()); }
+    explicit ConversationBuilder(const json& head) { set_head(head); }
+
+    // Request fields other than "messages" (model, tools, sampling...).
+    // Re-serializes only the head segment.
+    void set_head(const json& head);
+
+    void append(const json& message);
+
+    // Appends {"role":"tool","tool_call_id":id,"content":<body>} without
+    // copying the body: it is emitted as segments of the body's mapping (or
+    // sent from its file), and kept alive by the builder. Bytes that need
+    // escaping become short escape segments between those runs.
+    void append_tool_result(const std::string& tool_call_id, std::shared_ptr<const ResultBody> body);
+    void reset(const json& head);   // drops all messages
+
+    size_t message_count() const { return messages_.size(); }
+    size_t body_size() const { return head_.size() + messages_bytes_ + 2; }
+
+    // Bytes produced by JSON serialization over the builder's lifetime. It
+    // grows by the size of each appended message only; earlier messages are
+    // never serialized again.
+    std::uint64_t bytes_serialized() const { return bytes_serialized_; }
+
+    // The segments in order; valid until the builder is next modified.
+    std::vector<iovec> segments() const;
+    // Emits the body; file-backed tool results go through write_file().
+    void write_to(BodySink& sink) const;
+    std::string str() const;
+
+private:
+    // One message: `text`, or `text` + body bytes + `tail` for a tool result
+    // held in a ResultBody.
+    struct Message {
+        std::string text;                         // [i>0] carries its leading ','
+        std::shared_ptr<const ResultBody> body;
+        const char* tail = nullptr;
+    };
+
+    std::string head_;                  // {...,"messages":[
+    std::deque<Message> messages_;      // stable addresses
+    size_t messages_bytes_ = 0;
+    std::uint64_t bytes_serialized_ = 0;
+};
+
+} // namespace lct
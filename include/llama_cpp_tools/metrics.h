@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lct {
+
+// Log-linear latency histogram in nanoseconds (HDR style): exact below 32 ns,
+// then 16 sub-buckets per power of two, i.e. about 6% relative precision up
+// to ~18 minutes. Values above the range land in the last bucket. The
+// coarse Prometheus export buckets are counted exactly alongside, since
+// their bounds fall inside HDR buckets.
+class LatencyHistogram {
+public:
+    static constexpr size_t bucket_count = 608;
+    static constexpr size_t export_bucket_count = 16;   // plus one past the last bound
+
+    static size_t bucket_for(std::uint64_t ns);
+    static std::uint64_t bucket_upper(size_t bucket);   // largest value in the bucket
+
+    // Export bounds in seconds; export_bucket_for() is the first bound >= ns,
+    // or export_bucket_count above them all.
+    static double export_bound(size_t i);
+    static size_t export_bucket_for(std::uint64_t ns);
+
+    void record(std::uint64_t ns);
+    void merge(const LatencyHistogram& other);
+
+    std::uint64_t count() const { return count_; }
+    std::uint64_t sum_ns() const { return sum_ns_; }
+    std::uint64_t max_ns() const { return max_ns_; }
+    std::uint64_t bucket(size_t i) const { return buckets_.empty() ? 0 : buckets_[i]; }
+    std::uint64_t export_bucket(size_t i) const { return export_[i]; }   // i <= export_bucket_count
+
+    // Upper bound of the bucket holding the q-quantile (0 <= q <= 1); 0 if empty.
+    std::uint64_t percentile(double q) const;
+
+private:
+    friend class ToolMetricsTable;
+    std::vector<std::uint64_t> buckets_;   // allocated on first record
+    std::array<std::uint64_t, export_bucket_count + 1> export_{};
+    std::uint64_t count_ = 0;
+    std::uint64_t sum_ns_ = 0;
+    std::uint64_t max_ns_ = 0;
+};
+
+// Snapshot of one tool's counters. Queue wait runs from discovery (or, for
+// DAG calls, from the moment the inputs were ready) to handler start;
+// serialization is the time spent decoding the call's arguments.
+struct ToolMetrics {
+    std::uint64_t calls = 0;
+    std::uint64_t errors = 0;
+    LatencyHistogram queue;
+    LatencyHistogram exec;
+    LatencyHistogram serialize;
+};
+
+// What one streaming session (StreamSession, or one call of the streaming
+// entry points) saw.
+struct StreamStats {
+    std::uint64_t bytes = 0;              // bytes fed
+    std::uint64_t chunks = 0;             // feed() calls
+    std::uint64_t values = 0;             // complete top-level JSON values extracted
+    std::uint64_t calls = 0;              // tool calls dispatched
+    std::uint64_t dropped_bytes = 0;      // bytes outside any value (SSE framing, noise, an unterminated tail)
+    std::uint64_t syntax_errors = 0;      // balanced value that is not valid JSON
+    std::uint64_t truncated = 0;          // value still open at finish()
+    std::uint64_t dispatch_errors = 0;    // the executor or pipeline rejected a batch
+    std::uint64_t peak_buffer_bytes = 0;  // high-water mark of the reassembly buffer
+    std::uint64_t first_call_ns = 0;      // first byte -> first dispatched call; 0 if none
+};
+
+// Streaming sessions summed over their lifetime; a session is folded in
+// when it is destroyed. peak_buffer_bytes is the maximum over sessions and
+// `sum.first_call_ns` is unused -- see time_to_first_call.
+struct StreamTotals {
+    std::uint64_t streams = 0;
+    StreamStats sum;
+    LatencyHistogram time_to_first_call;
+
+    void add(const StreamStats& s);
+};
+
+// Prometheus text exposition of the streaming totals.
+std::string render_prometheus(const StreamTotals& totals);
+
+// Per-tool counters sharded by thread. Every live thread has a shard of its
+// own: threads get distinct indices (an exiting thread's index is reused by
+// the next one), and each tool holds its shards in blocks of 16, linked on
+// as higher indices first record. A shard's cells are only allocated the
+// first time its thread records that tool, so idle tools in a large registry
+// cost a few pointers. Histogram buckets are allocated 16 at a time (one
+// power of two) as values land there, so a shard costs about 1.5 KB plus the
+// latency ranges it actually saw.
+class ToolMetricsTable {
+public:
+    static constexpr size_t shard_count = 16;   // shards per block
+
+    ToolMetricsTable() = default;
+    // Copies the tools and their counters so far. Not thread-safe against
+    // record() on `other`: counters recorded meanwhile may be torn.
+    ToolMetricsTable(const ToolMetricsTable& other);
+    ToolMetricsTable& operator=(const ToolMetricsTable&) = delete;
+    ~ToolMetricsTable();
+
+    // Not thread-safe against record(): call while registering tools.
+    void add(const std::string& name);
+
+    void record(const std::string& name, std::uint64_t queue_ns, std::uint64_t exec_ns,
+                std::uint64_t serialize_ns, bool error);
+
+    ToolMetrics snapshot(const std::string& name) const;
+
+    // Prometheus text exposition (version 0.0.4) for every tool that has
+    // been called at least once.
+    std::string render_prometheus() const;
+
+private:
+    struct Histogram {
+        static constexpr size_t block_size = 16;
+        static constexpr size_t block_count = LatencyHistogram::bucket_count / block_size;
+        static_assert(LatencyHistogram::bucket_count % block_size == 0, "whole blocks");
+
+        Histogram() = default;
+        Histogram(const Histogram&) = delete;
+        Histogram& operator=(const Histogram&) = delete;
+        ~Histogram();
+
+        std::atomic<std::uint64_t> count{0};
+        std::atomic<std::uint64_t> sum_ns{0};
+        std::atomic<std::uint64_t> max_ns{0};
+        std::array<std::atomic<std::uint64_t>, LatencyHistogram::export_bucket_count + 1> exported{};
+        std::array<std::atomic<std::atomic<std::uint64_t>*>, block_count> blocks{};   // null until used
+    };
+    struct alignas(64) Cells {
+        std::atomic<std::uint64_t> calls{0};
+        std::atomic<std::uint64_t> errors{0};
+        Histogram queue, exec, serialize;
+    };
+    // One block of shards; `next` holds the following shard_count indices.
+    struct Slot {
+        Slot() = default;
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+        ~Slot();
+
+        std::atomic<Cells*>& shard(size_t index);   // links blocks on as needed
+
+        std::array<std::atomic<Cells*>, shard_count> shards{};
+        std::atomic<Slot*> next{nullptr};
+    };
+
+    static void fold(const Histogram& from, LatencyHistogram& into);
+    static void copy(const Histogram& from, Histogram& into);
+
+    std::map<std::string, std::unique_ptr<Slot>> slots_;
+};
+
+} // namespace lct
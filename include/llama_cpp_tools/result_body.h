@@ -0,0 +1,107 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace lct {
+
+// The text of a large tool result (a file, a query dump...) held outside the
+// JSON DOM. A handler attaches one with set_result_body(); it reaches the
+// caller as ExecutionResult::body and ConversationBuilder::append_tool_result
+// writes it into the next request body as the tool message's content: in
+// place from the mapping (writev), or with sendfile() for file-backed bodies
+// going to a descriptor. Never through an intermediate std::string: bytes
+// that need JSON escaping (quotes, backslashes, control characters, invalid
+// UTF-8) are found once, at construction, and written as short escape
+// segments between runs that still come straight from the mapping.
+//
+// File and shared-memory bodies are read-only mappings; the underlying data
+// must not change while the body is alive.
+class ResultBody {
+public:
+    static std::shared_ptr<const ResultBody> from_string(std::string text);
+    static std::shared_ptr<const ResultBody> from_file(const std::string& path);
+    // `length` bytes of `fd` from `offset`; the descriptor is dup()ed.
+    static std::shared_ptr<const ResultBody> from_fd(int fd, off_t offset, size_t length);
+    // A POSIX shared-memory object (shm_open name), whole or from `offset`.
+    static std::shared_ptr<const ResultBody> from_shared_memory(const std::string& name, size_t offset = 0,
+                                                                size_t length = std::string::npos);
+
+    ~ResultBody();
+    ResultBody(const ResultBody&) = delete;
+    ResultBody& operator=(const ResultBody&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    std::string_view view() const { return { data_, size_ }; }
+
+    // Backing descriptor and offset for sendfile(); -1 for in-memory bodies.
+    int fd() const { return fd_; }
+    off_t offset() const { return offset_; }
+
+    // True if the bytes can sit between the quotes of a JSON string as they
+    // are. Checked once, at construction.
+    bool json_safe() const { return escapes_.empty(); }
+
+    // Offsets of the bytes that can't, ascending; each is written as
+    // escape_for(byte) instead. Runs between them go out as they are.
+    const std::vector<size_t>& escapes() const { return escapes_; }
+    // What the byte at an escape offset becomes: \n, \", \u0001..., or
+    // U+FFFD for a byte that isn't part of valid UTF-8. Static storage.
+    static std::string_view escape_for(unsigned char c);
+    // size() once escaped.
+    size_t escaped_size() const { return escaped_size_; }
+
+    // The bytes as the inside of a JSON string literal (no quotes); invalid
+    // UTF-8 becomes U+FFFD, like json::dump with error_handler::replace.
+    std::string escaped() const;
+
+private:
+    ResultBody() = default;
+    void map(int fd, off_t offset, size_t length);
+    void finish();
+
+    std::string owned_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    int fd_ = -1;
+    off_t offset_ = 0;
+    std::vector<size_t> escapes_;
+    size_t escaped_size_ = 0;
+};
+
+// Called from inside a tool handler: makes `body` the content of the call's
+// result. The handler's own return value stays in ExecutionResult::result
+// (metadata such as a row count, or null). Only the execution paths that
+// produce an ExecutionResult pick the body up; invoke() drops it. A tool
+// routed to a WorkerPool that sets one fails, since the body can't leave
+// the worker. A tool invoked from inside another handler leaves the outer
+// handler's body alone.
+void set_result_body(std::shared_ptr<const ResultBody> body);
+
+namespace detail {
+    // Takes (and clears) the body set on this thread.
+    std::shared_ptr<const ResultBody> take_result_body();
+
+    // Sets this thread's body aside for the life of the scope and puts it
+    // back after, so a nested call neither sees nor drops it.
+    class ResultBodyScope {
+    public:
+        ResultBodyScope();
+        ~ResultBodyScope();
+        ResultBodyScope(const ResultBodyScope&) = delete;
+        ResultBodyScope& operator=(const ResultBodyScope&) = delete;
+
+    private:
+        std::shared_ptr<const ResultBody> outer_;
+    };
+} // namespace detail
+
+} // namespace lct
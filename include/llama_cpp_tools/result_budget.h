@@ -0,0 +1,93 @@
+#pragma once
+
+#include "llama_cpp_tools/shared_json.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace lct {
+
+// Most a single tool result may add to the next prompt. Limits apply to the
+// result's text: a string result's own bytes, anything else its compact
+// JSON, counted as it is sent, i.e. escaped inside a JSON string. Tokens
+// are estimate_tokens() units. 0 means no limit.
+struct ResultBudget {
+    size_t max_bytes = 0;
+    size_t max_tokens = 0;
+
+    bool limited() const { return max_bytes != 0 || max_tokens != 0; }
+
+    // The tighter of two budgets, limit by limit.
+    static ResultBudget combine(const ResultBudget& a, const ResultBudget& b);
+};
+
+// One budget-sized window of a result's text.
+struct ResultPage {
+    std::string text;
+    size_t next_offset = 0;   // where the following page starts
+    bool more = false;        // text was cut at the budget
+};
+
+// The page of `value`'s text starting at byte `offset`. Serialization stops
+// as soon as the budget is reached (plus at most one internal buffer), so a
+// page costs O(offset + budget), not O(result). Pages never split a UTF-8
+// sequence.
+ResultPage render_result_page(const json& value, size_t offset, const ResultBudget& budget);
+
+// The same page of text already serialized.
+ResultPage render_text_page(std::string_view text, size_t offset, const ResultBudget& budget);
+
+// Results cut at their budget, kept so the rest can be served page by page
+// without running the tool again. Thread-safe; the oldest cursor is evicted
+// past `max_cursors`.
+class ResultCursorStore {
+public:
+    struct Entry {
+        SharedJson value;
+        size_t offset = 0;
+        ResultBudget budget;
+        std::shared_ptr<const std::string> text;   // value's dump, once next_page needs it (non-strings)
+    };
+
+    explicit ResultCursorStore(size_t max_cursors = 256) : max_cursors_(max_cursors) {}
+
+    std::string put(Entry entry);
+    std::optional<Entry> find(const std::string& cursor) const;
+    // Moves `cursor` to `offset` (keeping `text` if it has none yet), or drops
+    // it when `more` is false.
+    void advance(const std::string& cursor, size_t offset, bool more,
+                 std::shared_ptr<const std::string> text = nullptr);
+
+    // Drops every cursor (at the end of a conversation, say); the values they
+    // hold are released once no ExecutionResult shares them.
+    void clear();
+
+    size_t size() const;
+    std::uint64_t evicted() const;
+
+    // The next page of `cursor` as the next_page tool returns it:
+    // {"content": text, "next_cursor": id} (no next_cursor on the last page).
+    // Throws std::runtime_error for an unknown or expired cursor. Concurrent
+    // calls on one cursor get consecutive pages, never the same one twice.
+    json next_page(const std::string& cursor);
+
+private:
+    void advance_locked(std::map<std::string, Entry>::iterator it, size_t offset, bool more,
+                        std::shared_ptr<const std::string> text);
+
+    size_t max_cursors_;
+    mutable std::mutex mutex_;
+    std::map<std::string, Entry> entries_;
+    std::deque<std::string> order_;     // live cursors, oldest first
+    std::uint64_t next_id_ = 0;
+    std::uint64_t evicted_ = 0;
+};
+
+} // namespace lct
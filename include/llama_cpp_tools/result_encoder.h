@@ -0,0 +1,45 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+
+namespace lct {
+using json = nlohmann::json;
+
+struct ResultEncodeOptions {
+    // Arrays of objects become {"columns": [keys...], "rows": [[values...]...]}
+    // so each key is written once instead of once per row. Rows missing a
+    // column get null there. Only applied where it makes the array shorter.
+    bool tabular = true;
+    size_t min_rows = 3;
+
+    // Drop object members whose value is null.
+    bool strip_nulls = true;
+
+    // Trim leading and trailing whitespace from string values.
+    bool trim_strings = false;
+
+    // Round floating-point numbers to this many significant digits (-1 keeps
+    // them); 0.30000000000000004 is 14 tokens, 0.3 is 3.
+    int float_digits = -1;
+};
+
+struct ResultEncodeReport {
+    size_t original_bytes = 0;      // compact dump
+    size_t encoded_bytes = 0;
+    size_t original_tokens = 0;     // estimate_tokens() of the compact dump
+    size_t encoded_tokens = 0;
+    size_t tables = 0;              // arrays rewritten as columns + rows
+    size_t stripped_nulls = 0;
+    size_t rounded_floats = 0;
+
+    size_t saved_tokens() const { return original_tokens > encoded_tokens ? original_tokens - encoded_tokens : 0; }
+};
+
+// Re-encodes a tool result for the prompt. The output carries the same
+// data, except for rounded floats and trimmed strings, but it is not the
+// same shape: consumers that walk the result should see the original.
+json encode_result(const json& result, const ResultEncodeOptions& opts, ResultEncodeReport* report = nullptr);
+
+} // namespace lct
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <string>
+
+namespace lct {
+using json = nlohmann::json;
+
+struct SchemaOptimizeOptions {
+    // Move sub-schemas that occur more than once (address, pagination...)
+    // into parameters.$defs and point at them with {"$ref":"#/$defs/<name>"}.
+    // Only for consumers that resolve local $ref (llama.cpp's grammar
+    // converter, OpenAI); off by default.
+    bool hoist_shared_definitions = false;
+    size_t min_hoist_bytes = 48;          // ignore tiny sub-schemas
+
+    // Drop keywords that restate JSON Schema defaults: "required": [],
+    // "additionalProperties": true, "default": null, "minItems": 0, empty
+    // descriptions, titles that repeat the property name, $comment/$schema.
+    bool drop_noop_keywords = true;
+
+    // Cut descriptions to this many bytes at a word boundary (0 keeps them).
+    size_t max_description_bytes = 0;
+};
+
+struct SchemaOptimizationReport {
+    size_t original_bytes = 0;
+    size_t optimized_bytes = 0;
+    size_t original_tokens = 0;           // estimate_tokens() of the compact dump
+    size_t optimized_tokens = 0;
+    size_t hoisted_definitions = 0;
+    size_t dropped_keywords = 0;
+    size_t truncated_descriptions = 0;
+
+    size_t saved_tokens() const { return original_tokens > optimized_tokens ? original_tokens - optimized_tokens : 0; }
+};
+
+// Rough BPE token count: each alphanumeric run costs one token per four
+// bytes (at least one), every other non-space byte costs one.
+size_t estimate_tokens(const std::string& text);
+
+// Optimizes a tool schema ({name, description, parameters}); the result is
+// semantically equivalent for validation except for truncated descriptions.
+json optimize_schema(const json& schema, const SchemaOptimizeOptions& opts,
+                     SchemaOptimizationReport* report = nullptr);
+
+} // namespace lct
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <nlohmann/json.hpp>
+
+namespace lct {
+
+using json = nlohmann::json;
+
+// Immutable, reference-counted JSON value: tool arguments and results are
+// materialized once and then shared, so handing a call to a worker thread
+// or copying an ExecutionResult costs a refcount bump instead of a deep
+// copy. Constructing from a json takes ownership (move it in); null needs
+// no allocation. Read access mirrors the const json API, or use `*` / `->`.
+// It is not a json: code that wrote through a json (`r.result["k"] = v`,
+// push_back) or passed it where a `json&` is expected has to copy it out
+// (`json j = *r.result;`) or assign a new value.
+class SharedJson {
+public:
+    SharedJson() noexcept = default;
+    SharedJson(json value)      // NOLINT: implicit, so json converts where a handle is expected
+        : value_(value.is_null() ? nullptr : std::make_shared<const json>(std::move(value))) {}
+    SharedJson(std::shared_ptr<const json> value) noexcept : value_(std::move(value)) {}
+
+    const json& get() const noexcept { return value_ ? *value_ : null_value(); }
+    const json& operator*() const noexcept { return get(); }
+    const json* operator->() const noexcept { return &get(); }
+    operator const json&() const noexcept { return get(); }
+
+    // Number of handles sharing the value; 0 for null.
+    long use_count() const noexcept { return value_.use_count(); }
+
+    template <typename T> const json& at(T&& key) const { return get().at(std::forward<T>(key)); }
+    template <typename T> const json& operator[](T&& key) const { return get()[std::forward<T>(key)]; }
+    template <typename T> bool contains(T&& key) const { return get().contains(std::forward<T>(key)); }
+    template <typename T> json::const_iterator find(T&& key) const { return get().find(std::forward<T>(key)); }
+    template <typename T> std::size_t count(T&& key) const { return get().count(std::forward<T>(key)); }
+    template <typename T> T get() const { return get().template get<T>(); }
+    template <typename T> T get_ref() const { return get().template get_ref<T>(); }
+    template <typename T> T& get_to(T& v) const { return get().get_to(v); }
+    template <typename K, typename V> auto value(K&& key, V&& fallback) const {
+        return get().value(std::forward<K>(key), std::forward<V>(fallback));
+    }
+
+    std::string dump(int indent = -1, char indent_char = ' ', bool ensure_ascii = false,
+                     json::error_handler_t error_handler = json::error_handler_t::strict) const {
+        return get().dump(indent, indent_char, ensure_ascii, error_handler);
+    }
+    json::value_t type() const noexcept { return get().type(); }
+    bool is_null() const noexcept { return get().is_null(); }
+    bool is_boolean() const noexcept { return get().is_boolean(); }
+    bool is_object() const noexcept { return get().is_object(); }
+    bool is_array() const noexcept { return get().is_array(); }
+    bool is_string() const noexcept { return get().is_string(); }
+    bool is_number() const noexcept { return get().is_number(); }
+    bool is_number_integer() const noexcept { return get().is_number_integer(); }
+    bool is_number_unsigned() const noexcept { return get().is_number_unsigned(); }
+    bool is_number_float() const noexcept { return get().is_number_float(); }
+    bool is_primitive() const noexcept { return get().is_primitive(); }
+    bool is_structured() const noexcept { return get().is_structured(); }
+    bool empty() const noexcept { return get().empty(); }
+    std::size_t size() const noexcept { return get().size(); }
+    const json& front() const { return get().front(); }
+    const json& back() const { return get().back(); }
+    json::const_iterator begin() const noexcept { return get().cbegin(); }
+    json::const_iterator end() const noexcept { return get().cend(); }
+    json::const_iterator cbegin() const noexcept { return get().cbegin(); }
+    json::const_iterator cend() const noexcept { return get().cend(); }
+    auto items() const noexcept { return get().items(); }
+
+    friend std::ostream& operator<<(std::ostream& os, const SharedJson& v) { return os << v.get(); }
+
+    friend bool operator==(const SharedJson& a, const SharedJson& b) { return a.value_ == b.value_ || a.get() == b.get(); }
+    friend bool operator!=(const SharedJson& a, const SharedJson& b) { return !(a == b); }
+    friend bool operator==(const SharedJson& a, const json& b) { return a.get() == b; }
+    friend bool operator!=(const SharedJson& a, const json& b) { return a.get() != b; }
+    friend bool operator==(const json& a, const SharedJson& b) { return a == b.get(); }
+    friend bool operator!=(const json& a, const SharedJson& b) { return a != b.get(); }
+
+private:
+    static const json& null_value() noexcept {
+        static const json null;
+        return null;
+    }
+
+    std::shared_ptr<const json> value_;
+};
+
+} // namespace lct
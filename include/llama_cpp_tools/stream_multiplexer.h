@@ -0,0 +1,77 @@
+#pragma once
+
+#include "llama_cpp_tools/tool_registry.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace lct {
+
+// Drives many concurrent streamed responses from one (or a few) epoll reactor
+// threads instead of one blocking thread per stream. Each stream is a
+// readable file descriptor (socket, pipe...) carrying raw response bytes; it
+// gets its own ToolRegistry::StreamSession and dispatches tool calls onto a
+// worker pool shared by all streams. The batches of one stream run one at a
+// time, in the order they were dispatched; different streams run in
+// parallel. Linux only.
+class StreamMultiplexer {
+public:
+    struct Options {
+        size_t reactor_threads = 1;
+        size_t worker_threads = 4;      // 0: execute tools on the reactor thread
+        bool concurrent = false;        // run the calls of one batch concurrently
+        size_t read_chunk_bytes = 16 * 1024;
+    };
+
+    using ResultCallback = std::function<void(const ToolRegistry::ExecutionResult&)>;
+    // Called once per stream after its last result was delivered; `error` is 0
+    // on a clean EOF and an errno value if reading failed.
+    using CloseCallback = std::function<void(int error)>;
+
+    explicit StreamMultiplexer(const ToolRegistry& reg);
+    StreamMultiplexer(const ToolRegistry& reg, Options opts);
+    ~StreamMultiplexer();
+
+    StreamMultiplexer(const StreamMultiplexer&) = delete;
+    StreamMultiplexer& operator=(const StreamMultiplexer&) = delete;
+
+    // Registers `fd` (switched to non-blocking) and takes ownership of it; the
+    // descriptor is closed at EOF or error, or at destruction (the stream then
+    // closes with ECANCELED), and also if add_stream throws. on_result is never
+    // invoked concurrently for the same stream. Returns the stream id.
+    std::uint64_t add_stream(int fd, ResultCallback on_result, CloseCallback on_close = nullptr);
+
+    // Streams added and not yet closed (including results still being delivered).
+    size_t active_streams() const;
+
+    // Blocks until every added stream has closed.
+    void wait_idle();
+
+private:
+    struct Stream;
+    struct Reactor;
+    class WorkerPool;
+
+    void run_reactor(Reactor& r);
+    void on_readable(Reactor& r, const std::shared_ptr<Stream>& s);
+    void run_next(Stream* s);
+    void release(const std::shared_ptr<Stream>& s);
+
+    const ToolRegistry& reg_;
+    Options opts_;
+    std::unique_ptr<WorkerPool> pool_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable idle_cv_;
+    std::unordered_map<std::uint64_t, std::shared_ptr<Stream>> streams_;
+    std::uint64_t next_id_ = 1;
+};
+
+} // namespace lct
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lct {
+using json = nlohmann::json;
+
+// Local BM25 retrieval index over tool schemas, for picking the handful of
+// tools worth sending with a request out of a large registry. Documents are
+// built from the tool name, description and parameter names/descriptions
+// (name tokens weigh most). Text is lowercased, split on non-alphanumerics
+// and camelCase, and indexed both as words and as character trigrams, so
+// partial words and light misspellings still match. Adding a tool only
+// appends postings; nothing is rebuilt.
+class ToolIndex {
+public:
+    struct Hit {
+        size_t doc;          // insertion order
+        std::string name;
+        float score;
+    };
+
+    // Indexes `schema` ({name, description, parameters}) under `name`.
+    void add(const std::string& name, const json& schema);
+
+    // Best k matches for `text`, highest score first; ties keep insertion
+    // order. Documents sharing no term with the query are not returned.
+    std::vector<Hit> query(const std::string& text, size_t k) const;
+
+    size_t size() const { return names_.size(); }
+
+private:
+    using TermId = std::uint32_t;
+
+    struct Posting {
+        std::uint32_t doc;
+        float tf;            // field-weighted term frequency
+    };
+
+    void add_terms(const std::string& text, float weight, std::unordered_map<TermId, float>& tf);
+    TermId intern(const std::string& term);
+
+    std::unordered_map<std::string, TermId> terms_;
+    std::vector<std::vector<Posting>> postings_;   // by TermId, docs ascending
+    std::vector<std::string> names_;
+    std::vector<float> doc_len_;
+    double total_len_ = 0;
+};
+
+} // namespace lct
@@ -1,29 +1,183 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 #include <nlohmann/json.hpp>
 
+#include "llama_cpp_tools/arena.h"
+#include "llama_cpp_tools/metrics.h"
+#include "llama_cpp_tools/result_body.h"
+#include "llama_cpp_tools/result_budget.h"
+#include "llama_cpp_tools/result_encoder.h"
+#include "llama_cpp_tools/schema_optimizer.h"
+#include "llama_cpp_tools/shared_json.h"
+#include "llama_cpp_tools/tool_index.h"
+#include "llama_cpp_tools/tracing.h"
+
 namespace lct {
 using json = nlohmann::json;
 using ToolHandler = std::function<json(const json&)>;
 
+// Where a streaming tool writes its output as it is produced. Write from
+// the thread running the handler.
+class ResultSink {
+public:
+    virtual ~ResultSink() = default;
+    virtual void write(json chunk) = 0;
+};
+
+// A handler that emits partial output (search hits, log lines...) through
+// `out` while it runs. Its return value is the call's final result.
+using StreamingToolHandler = std::function<json(const json& args, ResultSink& out)>;
+
+// Optional setup hook (open a connection, page in an index, take a lock...).
+// The streaming path fires it asynchronously as soon as a call's
+// function.name is complete, before the arguments have finished streaming.
+using ToolPrewarm = std::function<void()>;
+
+// Runs a unit of work somewhere else (a thread pool, an event loop...).
+using TaskExecutor = std::function<void(std::function<void()>)>;
+
+// What a pipeline stage does when its output queue is full.
+enum class BackpressurePolicy {
+    block,        // wait for the next stage to make room
+    drop_oldest,  // evict the oldest queued item and count it as dropped
+    fail          // abort the whole pipeline with std::runtime_error
+};
+
+struct PipelineOptions {
+    size_t call_queue_capacity = 256;     // parse -> execute
+    size_t result_queue_capacity = 256;   // execute -> deliver
+    size_t executor_threads = 1;          // >1 delivers results in completion order
+    BackpressurePolicy policy = BackpressurePolicy::block;
+};
+
+// Counters for one pipeline stage. "Output queue" is calls for the parse
+// stage and results for the execute stage; the deliver stage has none.
+struct PipelineStageStats {
+    std::uint64_t items = 0;              // items the stage emitted
+    std::uint64_t dropped = 0;            // items evicted from its output queue
+    std::uint64_t queue_high_water = 0;   // peak depth of its output queue
+    std::uint64_t stall_us = 0;           // time blocked on a full output queue
+    std::uint64_t idle_us = 0;            // time waiting for input
+};
+
+struct PipelineStats {
+    PipelineStageStats parse;
+    PipelineStageStats execute;
+    PipelineStageStats deliver;
+};
+
+// One tool call found in a model response.
+struct ToolCall {
+    std::string id;     // tool_calls[].id; empty for legacy function_call responses
+    std::string name;
+    SharedJson arguments;   // decoded once; {} if the model sent unparseable arguments
+    std::chrono::steady_clock::time_point ready{};   // when the call became runnable
+    std::uint64_t decode_ns = 0;                     // time spent decoding `arguments`
+};
+
+// Order of the tools block. by_name is the historical std::map order; stable
+// puts pinned tools first (in pin order) and every other tool in
+// registration order, so a newly registered tool lands at the end and the
+// bytes before it -- and the server's prompt-prefix KV cache -- survive.
+enum class ToolOrder { by_name, stable };
+
+// How much of the previous tools payload a new one shares byte-for-byte.
+struct PrefixReport {
+    size_t previous_bytes = 0;
+    size_t current_bytes = 0;
+    size_t common_prefix_bytes = 0;
+    double reuse_ratio = 0.0;     // common_prefix_bytes / current_bytes
+};
+
 struct ToolSpec {
     std::string name;
     std::string description;
     json parameters;
     ToolHandler handler;
+    ToolPrewarm prewarm;  // optional
+    StreamingToolHandler streaming_handler;   // used instead of `handler` if set
 };
 
+// Copyable and movable. A copy shares the handlers, the tracer and the
+// result cursor store, and takes a snapshot of the metrics and stats.
+// Don't copy while calls are in flight.
 class ToolRegistry {
 public:
     ToolRegistry() = default;
 
     void register_tool(const std::string& name, ToolHandler handler, const json& schema) {
-        tools_.emplace(name, std::move(handler));
-        schemas_.emplace(name, schema);
+        if (!tools_.emplace(name, std::move(handler)).second) return;  // first registration wins
+        json emitted = schema;
+        if (schema_opts_) {
+            SchemaOptimizationReport report;
+            emitted = optimize_schema(schema, *schema_opts_, &report);
+            schema_reports_.emplace(name, report);
+        }
+        schema_bytes_.emplace(name, emitted.dump());
+        schemas_.emplace(name, std::move(emitted));
+        order_.push_back(name);
+        index_.add(name, schema);  // retrieval sees the full, untruncated text
+        metrics_->add(name);
+    }
+
+    // Register a tool whose handler emits chunks while it runs. Callers that
+    // take partial updates (the streaming paths and
+    // process_remote_response_and_execute_as_completed) get each chunk as an
+    // ExecutionResult with `partial` set, in order, followed by the call's
+    // final result; nothing is buffered, so the handler's output can be
+    // unbounded. Everywhere else (invoke(), the vector-returning batch calls,
+    // a WorkerPool route) the chunks are collected: the result is the
+    // handler's return value, or the array of chunks if it returned null.
+    void register_streaming_tool(const std::string& name, StreamingToolHandler handler, const json& schema);
+
+    // Cap what one tool result can add to the next prompt, for every tool or
+    // for one (both apply, limit by limit). A result over budget is cut
+    // there: ExecutionResult::result becomes {"content": <first page of its
+    // text>, "next_cursor": id}, the whole result is kept in
+    // result_cursors(), and a `next_page` tool taking {"cursor": id} is
+    // registered to serve the rest one budget-sized page at a time, without
+    // running the tool again. Only paths producing an ExecutionResult cut;
+    // invoke() and result bodies don't. Set budgets before any call is in
+    // flight. Throws std::runtime_error if a tool named next_page is already
+    // registered; the name is reserved from the first budget on.
+    void set_result_budget(const ResultBudget& budget);
+    void set_result_budget(const std::string& tool, const ResultBudget& budget);
+
+    // Re-encode results with encode_result() before they are delivered (and
+    // before any budget is applied), for every tool or, overriding that, for
+    // one. Each ExecutionResult reports the tokens it saved. Only paths
+    // producing an ExecutionResult encode; the dag path encodes after
+    // dependents have read the original. Set before any call is in flight.
+    void set_result_encoding(const ResultEncodeOptions& opts) { result_encoding_ = opts; }
+    void set_result_encoding(const std::string& tool, const ResultEncodeOptions& opts) {
+        tool_encodings_[tool] = opts;
+    }
+
+    // Null until a budget is set.
+    std::shared_ptr<ResultCursorStore> result_cursors() const { return cursors_; }
+
+    // Run optimize_schema() over every schema registered from now on; the
+    // optimized form is what tools_for_openai*() and tools_for_query() emit.
+    void set_schema_optimization(const SchemaOptimizeOptions& opts) { schema_opts_ = opts; }
+
+    // Savings for a tool registered while optimization was on; throws
+    // std::runtime_error otherwise.
+    const SchemaOptimizationReport& schema_report(const std::string& name) const {
+        auto it = schema_reports_.find(name);
+        if (it == schema_reports_.end()) throw std::runtime_error("no schema report: " + name);
+        return it->second;
     }
 
     json schemas() const {
@@ -34,11 +188,9 @@ public:
         return arr;
     }
 
-    json invoke(const std::string& name, const json& args) const {
-        auto it = tools_.find(name);
-        if (it == tools_.end()) throw std::runtime_error("Tool not found: " + name);
-        return it->second(args);
-    }
+    // Every handler run, here or on any execution path below, is counted in
+    // the tool's metrics.
+    json invoke(const std::string& name, const json& args) const;
 
     json invoke_concurrent(const std::string& name, const json& args) const;
 
@@ -46,36 +198,279 @@ public:
 
     std::string tools_for_openai_string() const { return tools_for_openai().dump(); }
 
+    // Byte-stable variants. Each schema is serialized once at registration
+    // (nlohmann sorts object keys and prints numbers deterministically) and
+    // the payload is the cached bytes in ToolOrder. The string form can also
+    // report the longest common prefix with the previous payload it returned,
+    // to confirm prompt-cache reuse across requests.
+    json tools_for_openai(ToolOrder order) const;
+    std::string tools_for_openai_string(ToolOrder order, PrefixReport* report = nullptr) const;
+
+    // Tools that lead the stable order, in this order (unknown names are
+    // skipped). Changing the pin list is a one-off cache invalidation.
+    void pin_tools(std::vector<std::string> names) { pinned_ = std::move(names); }
+
+    // The k schemas most relevant to `user_text`, best first (local BM25 over
+    // tool names, descriptions and parameter names; see ToolIndex). Sending
+    // these instead of every registered tool keeps large registries from
+    // flooding the prompt.
+    json tools_for_query(const std::string& user_text, size_t k) const;
+
     json handle_tool_call_response(const json& api_response) const;
 
     void register_tool_spec(const ToolSpec& spec) {
         json schema = { {"name", spec.name}, {"description", spec.description}, {"parameters", spec.parameters} };
-        register_tool(spec.name, spec.handler, schema);
+        if (spec.streaming_handler) register_streaming_tool(spec.name, spec.streaming_handler, schema);
+        else register_tool(spec.name, spec.handler, schema);
+        if (spec.prewarm) register_prewarm(spec.name, spec.prewarm);
+    }
+
+    void register_prewarm(const std::string& name, ToolPrewarm prewarm) {
+        prewarms_.emplace(name, std::move(prewarm));
     }
 
+    // How much setup latency the prewarm hook of a tool hid behind generation.
+    // A hook fired at t0 that finished at t1 for a call dispatched at td hides
+    // min(t1, td) - t0; anything past td is time the call had to wait.
+    struct PrewarmStats {
+        std::uint64_t fired = 0;        // hooks started
+        std::uint64_t unused = 0;       // hooks whose call was never dispatched
+        std::uint64_t prewarm_us = 0;   // total time spent inside the hook
+        std::uint64_t hidden_us = 0;    // overlapped with generation
+        std::uint64_t waited_us = 0;    // exposed on the dispatch path
+    };
+
+    PrewarmStats prewarm_stats(const std::string& name) const;
+
+    // Calls, errors and queue/exec/serialize latency histograms for one tool
+    // (all zero for unknown or never-called tools).
+    ToolMetrics tool_metrics(const std::string& name) const { return metrics_->snapshot(name); }
+
+    // Streaming sessions summed so far (each is folded in when it ends).
+    StreamTotals stream_stats() const;
+
+    // Prometheus text exposition of every called tool's metrics followed by
+    // the streaming totals.
+    std::string metrics_prometheus() const;
+
+    // Report span boundaries (chunks, extracted values, dispatch, handler
+    // start/end, delivery) to `tracer`; nullptr turns tracing off. Install it
+    // before any call is in flight.
+    void set_tracer(std::shared_ptr<Tracer> tracer) { tracer_ = std::move(tracer); }
+
+    // Send calls to `name` through `route` instead of its handler (e.g. to a
+    // WorkerPool running the handler in another process). Metrics, tracing
+    // and every execution path stay the same. The registered handler is
+    // still what invoke_local() runs. Route before any call is in flight.
+    void route_tool(const std::string& name, ToolHandler route);
+
+    // Run the tool's registered handler directly, bypassing any route and
+    // all bookkeeping.
+    json invoke_local(const std::string& name, const json& args) const;
+
     // Result for executing a single tool call
     struct ExecutionResult {
+        std::string call_id;    // tool_calls[].id of the call (empty if the response had none)
         std::string tool_name;
-        json arguments;
-        json result;        // valid if error.empty()
+        SharedJson arguments;   // the call's own arguments, shared, not copied
+        SharedJson result;      // valid if error.empty()
+        std::shared_ptr<const ResultBody> body;   // content attached with set_result_body(), if any
         std::string error;  // non-empty if an error occurred
+        std::uint64_t queue_ns = 0;       // discovery (or inputs ready) -> handler start
+        std::uint64_t exec_ns = 0;        // inside the handler
+        std::uint64_t serialize_ns = 0;   // decoding the arguments
+        // Streaming tools: true for a chunk of output (in `result`) with more
+        // to come. The call always ends with one result where it is false.
+        bool partial = false;
+        std::uint64_t sequence = 0;       // chunk number; on the final result, chunks emitted
+        std::string cursor;     // set if `result` was cut at its budget; next_page serves the rest
+        size_t tokens_saved = 0;   // by set_result_encoding(), in estimate_tokens() units
     };
 
+    // All tool calls in api_response (choices[].message / delta, tool_calls or
+    // the legacy function_call), in discovery order.
+    static std::vector<ToolCall> find_tool_calls(const json& api_response);
+
     // Find all tool calls in api_response, invoke them (sync or concurrently),
     // and return the list of results in order discovered.
     std::vector<ExecutionResult> process_remote_response_and_execute(const json& api_response, bool concurrent=false) const;
 
+    // Execute calls already found (by find_tool_calls(), say); results keep
+    // the calls' order and ids.
+    std::vector<ExecutionResult> execute_calls(const std::vector<ToolCall>& calls, bool concurrent = false) const;
+
+    // Same, straight from the response body: the response DOM is parsed into
+    // `arena` and the arena is reset once the calls have been extracted, so
+    // the whole document costs a few bump allocations and an O(1) release
+    // instead of one heap allocation per node. Arguments and results stay in
+    // lct::json since they outlive the arena. Throws json::parse_error on a
+    // malformed body.
+    std::vector<ExecutionResult> process_remote_response_and_execute(std::string_view response_body,
+                                                                     Arena& arena,
+                                                                     bool concurrent = false) const;
+
+    // Concurrent execution with completion-order delivery: `on_result` gets
+    // each result, tagged with its discovery index, as soon as that call
+    // finishes instead of waiting behind slower calls discovered earlier.
+    // Callbacks run on the calling thread, one at a time; returns once every
+    // call has been delivered. Streaming tools' chunks are delivered the
+    // same way, as partial results ahead of the call's final one; a tool
+    // writing chunks faster than on_result takes them blocks in write() once
+    // 64 results are waiting.
+    void process_remote_response_and_execute_as_completed(
+        const json& api_response,
+        std::function<void(size_t index, const ExecutionResult&)> on_result) const;
+
+    // Dependency graph of one dag-mode batch.
+    struct DagStats {
+        size_t calls = 0;
+        size_t edges = 0;              // distinct call -> call dependencies
+        size_t depth = 0;              // longest dependency chain, in calls
+        size_t round_trips_saved = 0;  // depth - 1: model turns a hop-per-turn loop would spend
+        size_t cycle_errors = 0;       // calls rejected because they sit on or behind a cycle
+    };
+
+    // Dependency-aware execution. Any argument value of the form
+    //   {"$ref": "<call id>.result[.<key or index>...]"}
+    // is replaced by that part of another call's result before the call runs.
+    // Calls without an id are addressable as call_1, call_2, ... in discovery
+    // order. Independent calls run concurrently and each dependent call starts
+    // as soon as its inputs are ready. Unknown ids, bad paths, cycles and
+    // failed dependencies are reported in the affected call's `error`.
+    // Results come back in discovery order.
+    std::vector<ExecutionResult> process_remote_response_and_execute_dag(const json& api_response,
+                                                                         DagStats* stats = nullptr) const;
+
     // Streaming helper: accepts a callback `get_chunk(string& out)` which should
     // append/return the next chunk (return false when no more chunks). The
     // handler `on_result` is called for each ExecutionResult as it becomes
-    // available. Useful for streaming responses from servers.
+    // available. Useful for streaming responses from servers. Chunks from
+    // streaming tools arrive here too, as partial results ahead of the
+    // call's final one. `stats`, if given, receives what this stream saw.
     void process_streaming_response_and_execute(std::function<bool(std::string&)> get_chunk,
                                                std::function<void(const ExecutionResult&)> on_result,
-                                               bool concurrent=false) const;
+                                               bool concurrent=false,
+                                               StreamStats* stats = nullptr) const;
+
+    // Same contract as process_streaming_response_and_execute, but parsing,
+    // tool execution and on_result delivery run as three decoupled stages
+    // joined by bounded lock-free queues: a slow consumer or a slow tool no
+    // longer stalls parsing until its queue fills up, and then `policy`
+    // decides. on_result runs on a dedicated delivery thread.
+    PipelineStats process_streaming_response_pipelined(std::function<bool(std::string&)> get_chunk,
+                                                       std::function<void(const ExecutionResult&)> on_result,
+                                                       const PipelineOptions& opts = PipelineOptions()) const;
+
+    // Incremental parser state for one streamed response. feed() consumes the
+    // next chunk and dispatches every complete JSON value it closes; finish()
+    // flushes the tail. process_streaming_response_and_execute is a loop
+    // around one session; StreamMultiplexer keeps one per stream.
+    //
+    // With an executor, each dispatched batch (and its on_result calls) runs
+    // as a task on that executor instead of inline in feed(), and so does
+    // each prewarm hook. Without one, hooks share a small process-wide pool.
+    class StreamSession {
+    public:
+        StreamSession(const ToolRegistry& reg,
+                      std::function<void(const ExecutionResult&)> on_result,
+                      bool concurrent = false,
+                      TaskExecutor executor = nullptr);
+        StreamSession(StreamSession&&) noexcept;
+        StreamSession& operator=(StreamSession&&) noexcept;
+        ~StreamSession();  // waits for any prewarm hooks still in flight
+
+        void feed(const char* data, size_t size);
+        void feed(const std::string& chunk) { feed(chunk.data(), chunk.size()); }
+        void finish();   // dispatches the tail, then drops and counts what is left
+
+        // Counters so far; read from the thread that feeds the session.
+        const StreamStats& stats() const;
+
+        // Parse each streamed value into `arena` and reset it after the value
+        // has been dispatched. The arena must outlive the session and is only
+        // touched by the thread that feeds it.
+        void use_arena(Arena& arena);
+
+    private:
+        friend class ToolRegistry;
+        struct State;
+
+        // Hands each discovered batch to `sink` instead of executing it.
+        using BatchSink = std::function<void(std::vector<ToolCall>&&, std::vector<std::function<void()>>&&)>;
+        StreamSession(const ToolRegistry& reg, BatchSink sink);
+
+        std::unique_ptr<State> state_;
+    };
 
 private:
+    using CallGate = std::function<void()>;  // runs on the executing thread before invoke
+    using PartialSink = std::function<void(const ExecutionResult&)>;   // gets streaming chunks
+
+    template <typename Fn> void for_each_stable(Fn&& fn) const;
+    ExecutionResult execute_call(const ToolCall& call, const SharedJson& args, const CallGate& gate,
+                                 const PartialSink& partial = {}, bool finalize = true) const;
+    // Prompt-facing shaping of a finished result: encoding, then the budget.
+    void finalize_result(ExecutionResult& r) const;
+    void apply_result_encoding(ExecutionResult& r) const;
+    void apply_result_budget(ExecutionResult& r) const;
+    void enable_cursors();     // creates the cursor store and registers next_page
+    std::vector<ExecutionResult> execute_calls(const std::vector<ToolCall>& calls, bool concurrent,
+                                               const std::vector<CallGate>& gates,
+                                               const PartialSink& partial = {}) const;
+    void record_prewarm(const std::string& name, const PrewarmStats& delta) const;
+    void record_stream(const StreamStats& stats) const;
+    json invoke_measured(const std::string& name, const json& args, std::string_view call_id,
+                         std::uint64_t queue_ns, std::uint64_t serialize_ns, std::uint64_t* exec_ns) const;
+    void trace(TracePoint point, std::string_view tool = {}, std::string_view call_id = {},
+               std::uint64_t value = 0) const {
+        if (tracer_) tracer_->record(point, tool, call_id, value);
+    }
+
     std::map<std::string, ToolHandler> tools_;
+    std::map<std::string, ToolHandler> local_handlers_;   // original handlers of routed tools
     std::map<std::string, json> schemas_;
+    std::map<std::string, std::string> schema_bytes_;
+    std::vector<std::string> order_;       // registration order
+    std::vector<std::string> pinned_;
+    std::map<std::string, ToolPrewarm> prewarms_;
+    ToolIndex index_;
+    std::optional<SchemaOptimizeOptions> schema_opts_;
+    std::map<std::string, SchemaOptimizationReport> schema_reports_;
+    std::shared_ptr<Tracer> tracer_;
+    ResultBudget result_budget_;
+    std::map<std::string, ResultBudget> tool_budgets_;
+    std::shared_ptr<ResultCursorStore> cursors_;
+    std::optional<ResultEncodeOptions> result_encoding_;
+    std::map<std::string, ResultEncodeOptions> tool_encodings_;
+
+    // The handle and stats below keep ToolRegistry copyable and movable: a
+    // copy gets its own metrics table and stats, cloned from the original.
+    struct MetricsHandle {
+        MetricsHandle() : table(std::make_unique<ToolMetricsTable>()) {}
+        MetricsHandle(const MetricsHandle& other) : table(std::make_unique<ToolMetricsTable>(*other.table)) {}
+        MetricsHandle& operator=(const MetricsHandle& other) {
+            if (this != &other) table = std::make_unique<ToolMetricsTable>(*other.table);
+            return *this;
+        }
+        MetricsHandle(MetricsHandle&&) noexcept = default;
+        MetricsHandle& operator=(MetricsHandle&&) noexcept = default;
+        ToolMetricsTable* operator->() const { return table.get(); }
+
+        std::unique_ptr<ToolMetricsTable> table;
+    };
+    struct Stats {
+        Stats() = default;
+        Stats(const Stats& other);
+        Stats& operator=(const Stats& other);
+
+        mutable std::mutex mutex;
+        std::map<std::string, PrewarmStats> prewarm;
+        std::string last_stable_payload;
+        StreamTotals stream_totals;
+    };
+
+    MetricsHandle metrics_;
+    mutable Stats stats_;
 };
 
 #define LCT_REGISTER_TOOL(REG, FUNC, SCHEMA) \
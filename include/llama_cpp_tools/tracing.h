@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace lct {
+
+// Span boundaries the registry reports to a Tracer.
+enum class TracePoint : std::uint8_t {
+    chunk_received,     // value: chunk bytes
+    value_extracted,    // value: bytes of the complete JSON value
+    call_dispatched,    // tool, call_id
+    handler_begin,      // tool, call_id
+    handler_end,        // tool, call_id; value: 1 if the handler threw
+    result_delivered    // tool, call_id
+};
+
+const char* trace_point_name(TracePoint point);
+
+// Receives span boundaries on the thread where they happen, so it must be
+// thread-safe and cheap. With no tracer installed the registry pays one
+// null-pointer check per boundary.
+class Tracer {
+public:
+    virtual ~Tracer() = default;
+    virtual void record(TracePoint point, std::string_view tool, std::string_view call_id,
+                        std::uint64_t value) = 0;
+};
+
+// Writes Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Each thread appends to its own single-producer ring, so recording never
+// takes a lock; a background thread drains the rings into the file. When a
+// ring is full the event is dropped and counted rather than blocking. Rings
+// of exited threads are reused, so "tid" in the trace names a ring (one
+// thread at a time), and memory is bounded by the threads alive at once.
+class ChromeTraceExporter : public Tracer {
+public:
+    struct Options {
+        size_t ring_events = 4096;                                     // per live thread
+        std::chrono::milliseconds flush_interval{ 20 };
+    };
+
+    // Throws std::system_error if the file cannot be created.
+    explicit ChromeTraceExporter(const std::string& path);
+    ChromeTraceExporter(const std::string& path, Options opts);
+    ~ChromeTraceExporter() override;   // drains and closes the JSON array
+
+    ChromeTraceExporter(const ChromeTraceExporter&) = delete;
+    ChromeTraceExporter& operator=(const ChromeTraceExporter&) = delete;
+
+    void record(TracePoint point, std::string_view tool, std::string_view call_id,
+                std::uint64_t value) override;
+
+    // Writes everything recorded so far to the file.
+    void flush();
+
+    std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Ring;
+
+    Ring& ring_for_this_thread();
+    void drain_locked();
+    void flusher();
+
+    const std::uint64_t id_;
+    const Options opts_;
+    const std::chrono::steady_clock::time_point epoch_;
+    std::FILE* file_ = nullptr;
+    bool first_event_ = true;
+
+    std::mutex mutex_;                  // rings_ list, file writes
+    std::vector<std::shared_ptr<Ring>> rings_;
+    std::atomic<std::uint64_t> dropped_{ 0 };
+
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread flusher_;
+};
+
+} // namespace lct
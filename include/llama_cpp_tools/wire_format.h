@@ -0,0 +1,39 @@
+#pragma once
+
+#include <nlohmann/json.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace lct {
+using json = nlohmann::json;
+
+// How a json value travels between components that don't share a DOM
+// (WorkerPool slots, caches, logs). The binary formats are nlohmann's
+// MessagePack and CBOR codecs: no escaping on the way out, no text
+// scanning or number parsing on the way in, and strings are copied as
+// they are. JSON text stays available where a human reads the bytes.
+enum class WireFormat : std::uint8_t { json = 0, msgpack = 1, cbor = 2 };
+
+const char* wire_format_name(WireFormat format);              // "json", "msgpack", "cbor"
+std::optional<WireFormat> parse_wire_format(std::string_view name);
+
+// Appends the encoding of `value` to `out`.
+void wire_encode(const json& value, WireFormat format, std::string& out);
+std::string wire_encode(const json& value, WireFormat format);
+
+// Encodes straight into `out`. Returns the bytes written, or
+// std::string::npos if the encoding needs more than `capacity`; the binary
+// formats stop as soon as they run out of room, JSON text is rendered first.
+size_t wire_encode_to(const json& value, WireFormat format, char* out, size_t capacity);
+
+// Throws json::parse_error on malformed input.
+json wire_decode(const char* data, size_t size, WireFormat format);
+inline json wire_decode(std::string_view bytes, WireFormat format) {
+    return wire_decode(bytes.data(), bytes.size(), format);
+}
+
+} // namespace lct
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "llama_cpp_tools/tool_registry.h"
+#include "llama_cpp_tools/wire_format.h"
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace lct {
+
+// Runs tool handlers in pre-forked worker processes, so a handler that
+// crashes, leaks or hangs takes down one worker instead of the host.
+// Construction forks a zygote from the calling process. The zygote forks
+// the workers and re-forks any worker that dies, so every worker starts
+// from the registry and warm state as they were when the pool was built
+// (shared copy-on-write). Arguments and results are encoded (MessagePack by
+// default, see Options::wire) straight into a per-worker slot in one
+// shared-memory mapping, with futex wakeups. No pipe or socket is on the
+// call path. Linux only.
+//
+// Build the pool early, before the host starts other threads: fork() only
+// copies the calling thread, and that thread must outlive the pool (the
+// zygote is killed when it exits).
+class WorkerPool {
+public:
+    struct Options {
+        size_t workers = 2;
+        size_t slot_bytes = 1 << 20;        // largest request or response, in bytes
+        std::chrono::milliseconds call_timeout{0};   // 0: none; on expiry the worker is killed
+        unsigned spin = 2000;               // polls before sleeping on the futex; 0 on one CPU
+        // Encoding of arguments and results in the slots. Each request names
+        // its format and the worker answers in kind; json is readable in a
+        // core dump, the binary formats skip text escaping and parsing.
+        WireFormat wire = WireFormat::msgpack;
+    };
+
+    struct Stats {
+        std::uint64_t calls = 0;
+        std::uint64_t crashes = 0;      // workers that died, whether busy or not
+        std::uint64_t timeouts = 0;
+        std::uint64_t restarts = 0;     // replacement workers forked
+    };
+
+    explicit WorkerPool(const ToolRegistry& reg);
+    WorkerPool(const ToolRegistry& reg, Options opts);
+    ~WorkerPool();   // kills the zygote and, with it, the workers
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Runs `tool` in a free worker (blocking until one is free). A handler
+    // exception comes back as a std::runtime_error with its message. A
+    // crashed or timed-out worker, a payload over slot_bytes, or a handler
+    // that set a result body (set_result_body) also throws
+    // std::runtime_error.
+    json call(const std::string& tool, const json& args);
+
+    // Routes `tools` of `reg` to this pool (ToolRegistry::route_tool). The
+    // registry keeps the pool alive.
+    static void route(ToolRegistry& reg, const std::shared_ptr<WorkerPool>& pool,
+                      const std::vector<std::string>& tools);
+
+    Stats stats() const;
+    std::vector<pid_t> worker_pids() const;
+    pid_t zygote_pid() const { return zygote_; }
+
+private:
+    struct Shared;
+    struct Channel;
+
+    Channel& channel(size_t i) const;
+    size_t acquire();
+    void release(size_t i);
+
+    Options opts_;
+    size_t channel_bytes_ = 0;
+    size_t mapping_bytes_ = 0;
+    Shared* shared_ = nullptr;
+    pid_t zygote_ = -1;
+
+    std::mutex mutex_;
+    std::condition_variable free_cv_;
+    std::vector<size_t> free_;
+    std::atomic<std::uint64_t> calls_{0};
+    std::atomic<std::uint64_t> timeouts_{0};
+};
+
+} // namespace lct
@@ -0,0 +1,170 @@
+#include "llama_cpp_tools/agent_loop.h"
+
+#include <future>
+#include <thread>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    inline std::uint64_t us_since(clock::time_point t0) {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - t0).count());
+    }
+
+    // An assistant message's tool_calls array for `calls`.
+    json tool_calls_json(const std::vector<ToolCall>& calls) {
+        json tcs = json::array();
+        for (const auto& c : calls) {
+            tcs.push_back({ {"id", c.id}, {"type", "function"},
+                            {"function", { {"name", c.name}, {"arguments", c.arguments.dump()} }} });
+        }
+        return tcs;
+    }
+
+    inline json tool_message(const std::string& id, const ToolRegistry::ExecutionResult& r) {
+        return json{ {"role", "tool"}, {"tool_call_id", id},
+                     {"content", r.error.empty() ? r.result.dump() : json{{"error", r.error}}.dump()} };
+    }
+} // namespace
+
+
+// ---------- MockChatTransport ----------
+
+MockChatTransport::MockChatTransport(Responder responder, std::chrono::microseconds latency)
+    : responder_(std::move(responder)), latency_(latency)
+{
+}
+
+std::string MockChatTransport::send(const std::string& request_body) {
+    json request = json::parse(request_body);
+    size_t turn;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        turn = requests_.size();
+        requests_.push_back(request);
+    }
+    if (latency_.count() > 0) std::this_thread::sleep_for(latency_);
+    return responder_(request, turn).dump();
+}
+
+std::vector<json> MockChatTransport::requests() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+}
+
+json MockChatTransport::tool_call_response(const std::vector<ToolCall>& calls) {
+    const json tcs = tool_calls_json(calls);
+    return { {"choices", json::array({ { {"index", 0}, {"finish_reason", "tool_calls"},
+             {"message", { {"role", "assistant"}, {"content", nullptr}, {"tool_calls", tcs} }} } })} };
+}
+
+json MockChatTransport::text_response(const std::string& content) {
+    return { {"choices", json::array({ { {"index", 0}, {"finish_reason", "stop"},
+             {"message", { {"role", "assistant"}, {"content", content} }} } })} };
+}
+
+
+// ---------- AgentLoop ----------
+
+AgentLoop::AgentLoop(const ToolRegistry& reg, ChatTransport& transport)
+    : AgentLoop(reg, transport, AgentLoopOptions())
+{
+}
+
+AgentLoop::AgentLoop(const ToolRegistry& reg, ChatTransport& transport, AgentLoopOptions opts)
+    : reg_(reg), transport_(transport), opts_(std::move(opts))
+{
+}
+
+AgentRunResult AgentLoop::run(json messages) {
+    AgentRunResult out;
+    out.messages = messages.is_array() ? std::move(messages) : json::array({ std::move(messages) });
+
+    json head = opts_.request_extra.is_object() ? opts_.request_extra : json::object();
+    if (!opts_.model.empty()) head["model"] = opts_.model;
+    head["tools"] = reg_.tools_for_openai(opts_.tool_order);
+
+    AgentTurnStats stats;
+    auto t0 = clock::now();
+    conv_.reset(head);
+    for (const auto& m : out.messages) conv_.append(m);
+    stats.serialize_us = us_since(t0);
+
+    for (size_t turn = 0; turn < opts_.max_turns; ++turn) {
+        stats.request_bytes = conv_.body_size();
+        t0 = clock::now();
+        const std::string response_body = transport_.send_body(conv_);
+        stats.model_us = us_since(t0);
+
+        t0 = clock::now();
+        json response = json::parse(response_body);
+        std::vector<ToolCall> calls = ToolRegistry::find_tool_calls(response);
+        json assistant = json{ {"role", "assistant"}, {"content", nullptr} };
+        if (response.contains("choices") && !response["choices"].empty() &&
+            response["choices"][0].contains("message")) {
+            assistant = response["choices"][0]["message"];
+        }
+        stats.serialize_us += us_since(t0);
+
+        out.final_message = assistant;
+        if (calls.empty()) {
+            out.messages.push_back(std::move(assistant));
+            out.turns.push_back(stats);
+            out.finished = true;
+            return out;
+        }
+
+        // Every call needs an id for its role:"tool" reply; fill in any the
+        // server left out, in the assistant message as well. If that message
+        // doesn't list exactly these calls (a legacy function_call, calls in
+        // several choices), it is given tool_calls built from them.
+        for (size_t i = 0; i < calls.size(); ++i) {
+            if (calls[i].id.empty()) calls[i].id = "call_" + std::to_string(turn) + "_" + std::to_string(i);
+        }
+        if (assistant.contains("tool_calls") && assistant["tool_calls"].is_array() &&
+            assistant["tool_calls"].size() == calls.size()) {
+            for (size_t i = 0; i < calls.size(); ++i) assistant["tool_calls"][i]["id"] = calls[i].id;
+        } else {
+            assistant.erase("function_call");
+            assistant["tool_calls"] = tool_calls_json(calls);
+        }
+        stats.tool_calls = calls.size();
+
+        // Run the tools while this thread appends the assistant message.
+        const auto tools_t0 = clock::now();
+        auto pending = std::async(std::launch::async, [&] {
+            return reg_.execute_calls(calls, opts_.concurrent_tools);
+        });
+
+        t0 = clock::now();
+        conv_.append(assistant);
+        out.messages.push_back(std::move(assistant));
+        stats.serialize_us += us_since(t0);
+
+        auto results = pending.get();
+        stats.tools_us = us_since(tools_t0);
+
+        t0 = clock::now();
+        for (const auto& r : results) {
+            if (r.error.empty() && r.body) {
+                conv_.append_tool_result(r.call_id, r.body);
+                out.bodies.emplace(out.messages.size(), r.body);
+                out.messages.push_back(json{ {"role", "tool"}, {"tool_call_id", r.call_id}, {"content", nullptr} });
+                continue;
+            }
+            json msg = tool_message(r.call_id, r);
+            conv_.append(msg);
+            out.messages.push_back(std::move(msg));
+        }
+        stats.serialize_us += us_since(t0);
+
+        out.turns.push_back(stats);
+        stats = AgentTurnStats();
+    }
+    return out;
+}
+
+} // namespace lct
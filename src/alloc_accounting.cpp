@@ -0,0 +1,44 @@
+#include "llama_cpp_tools/alloc_accounting.h"
+
+#include <atomic>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    // Constant-initialized, so they are usable from operator new calls made
+    // during static initialization of other translation units.
+    std::atomic<std::uint64_t> g_allocations{ 0 };
+    std::atomic<std::uint64_t> g_deallocations{ 0 };
+    std::atomic<std::uint64_t> g_bytes{ 0 };
+    std::atomic<bool> g_installed{ false };
+} // namespace
+
+
+// ---------- implementations ----------
+
+bool allocation_hook_installed() {
+    return g_installed.load(std::memory_order_relaxed);
+}
+
+AllocationCounts allocation_counts() {
+    return { g_allocations.load(std::memory_order_relaxed), g_deallocations.load(std::memory_order_relaxed),
+             g_bytes.load(std::memory_order_relaxed) };
+}
+
+namespace detail {
+    void note_allocation(std::size_t bytes) noexcept {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        g_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void note_deallocation() noexcept {
+        g_deallocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void mark_allocation_hook_installed() noexcept {
+        g_installed.store(true, std::memory_order_relaxed);
+    }
+} // namespace detail
+
+} // namespace lct
@@ -0,0 +1,54 @@
+// Replacement global operator new/delete that count every allocation into
+// lct::allocation_counts(). Built as the lct_alloc_hook object library and
+// linked only into test and benchmark executables; never into the library.
+
+#include "llama_cpp_tools/alloc_accounting.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    void* counted_alloc(std::size_t size) {
+        lct::detail::note_allocation(size);
+        if (void* p = std::malloc(size ? size : 1)) return p;
+        throw std::bad_alloc();
+    }
+
+    void* counted_aligned_alloc(std::size_t size, std::align_val_t align) {
+        lct::detail::note_allocation(size);
+        const std::size_t a = static_cast<std::size_t>(align);
+        const std::size_t rounded = ((size ? size : 1) + a - 1) / a * a;   // aligned_alloc wants a multiple
+        if (void* p = std::aligned_alloc(a, rounded)) return p;
+        throw std::bad_alloc();
+    }
+
+    void counted_free(void* p) noexcept {
+        if (!p) return;
+        lct::detail::note_deallocation();
+        std::free(p);
+    }
+
+    [[maybe_unused]] const bool installed = (lct::detail::mark_allocation_hook_installed(), true);
+} // namespace
+
+void* operator new(std::size_t size) { return counted_alloc(size); }
+void* operator new[](std::size_t size) { return counted_alloc(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try { return counted_alloc(size); } catch (...) { return nullptr; }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try { return counted_alloc(size); } catch (...) { return nullptr; }
+}
+void* operator new(std::size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+void* operator new[](std::size_t size, std::align_val_t align) { return counted_aligned_alloc(size, align); }
+
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, std::size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { counted_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { counted_free(p); }
@@ -0,0 +1,124 @@
+#include "llama_cpp_tools/arena.h"
+
+#include <algorithm>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    thread_local Arena* t_current = nullptr;
+
+    constexpr size_t tag_bytes = 16;              // keeps the payload 16-byte aligned
+    constexpr size_t huge_page = size_t(2) << 20;
+
+    // Tag values: which allocator owns the block.
+    constexpr std::uintptr_t heap_tag = 0;
+    constexpr std::uintptr_t arena_tag = 1;
+} // namespace
+
+
+// ---------- implementations ----------
+
+Arena::Chunk Arena::new_chunk(size_t min_bytes) {
+    size_t size = std::max(opts_.chunk_bytes, min_bytes);
+#if defined(__linux__)
+    if (opts_.huge_pages) {
+        size = (size + huge_page - 1) / huge_page * huge_page;
+#if defined(MAP_HUGETLB)
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            huge_active_ = true;
+            return { static_cast<char*>(p), size, true };
+        }
+#endif
+        // No reserved huge pages: ask for transparent ones instead.
+        void* q = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (q == MAP_FAILED) throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+        if (::madvise(q, size, MADV_HUGEPAGE) == 0) huge_active_ = true;
+#endif
+        return { static_cast<char*>(q), size, true };
+    }
+#endif
+    return { static_cast<char*>(::operator new(size)), size, false };
+}
+
+void Arena::enter(size_t index) {
+    current_ = index;
+    cursor_ = chunks_[index].base;
+    limit_ = cursor_ + chunks_[index].size;
+}
+
+void* Arena::allocate_slow(size_t bytes, size_t align) {
+    // Move on to the next chunk kept from before the last reset if it fits,
+    // otherwise slot a fresh one in after the current chunk.
+    const size_t need = bytes + align;
+    size_t next = chunks_.empty() ? 0 : current_ + 1;
+    if (next >= chunks_.size() || chunks_[next].size < need) {
+        const Chunk c = new_chunk(need);
+        reserved_ += c.size;
+        chunks_.insert(chunks_.begin() + static_cast<std::ptrdiff_t>(next), c);
+    }
+    enter(next);
+    return allocate(bytes, align);
+}
+
+void Arena::reset() {
+    used_ = 0;
+    if (!chunks_.empty()) enter(0);
+}
+
+void Arena::release() {
+    for (const Chunk& c : chunks_) {
+#if defined(__linux__)
+        if (c.mapped) { ::munmap(c.base, c.size); continue; }
+#endif
+        ::operator delete(c.base);
+    }
+    chunks_.clear();
+    current_ = 0;
+    cursor_ = limit_ = nullptr;
+    used_ = reserved_ = 0;
+    huge_active_ = false;
+}
+
+Arena* current_arena() {
+    return t_current;
+}
+
+ArenaScope::ArenaScope(Arena& arena) : previous_(t_current) {
+    t_current = &arena;
+}
+
+ArenaScope::~ArenaScope() {
+    t_current = previous_;
+}
+
+namespace detail {
+    void* arena_allocate(size_t bytes) {
+        char* block;
+        std::uintptr_t tag;
+        if (Arena* a = t_current) {
+            block = static_cast<char*>(a->allocate(bytes + tag_bytes, tag_bytes));
+            tag = arena_tag;
+        } else {
+            block = static_cast<char*>(::operator new(bytes + tag_bytes));
+            tag = heap_tag;
+        }
+        *reinterpret_cast<std::uintptr_t*>(block) = tag;
+        return block + tag_bytes;
+    }
+
+    void arena_deallocate(void* p) noexcept {
+        if (!p) return;
+        char* block = static_cast<char*>(p) - tag_bytes;
+        if (*reinterpret_cast<std::uintptr_t*>(block) == heap_tag) ::operator delete(block);
+    }
+} // namespace detail
+
+} // namespace lct
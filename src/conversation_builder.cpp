@@ -0,0 +1,224 @@
+#include "llama_cpp_tools/conversation_builder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <system_error>
+
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace lct {
+
+namespace {
+    const char closing[] = "]}";
+    const char body_tail[] = "\"}";
+
+#ifdef IOV_MAX
+    constexpr size_t max_iov = IOV_MAX;
+#else
+    constexpr size_t max_iov = 1024;
+#endif
+
+    // Runs of a file-backed body at least this long go out with write_file();
+    // shorter ones (between escapes, say) are cheaper as writev segments.
+    constexpr size_t sendfile_min_bytes = 64 * 1024;
+
+    // Walks a body as JSON string content: runs of its own bytes, `run(a, z)`
+    // for [a, z), with the escape sequences between them passed to `escape`.
+    template <typename Run, typename Escape>
+    void for_each_body_piece(const ResultBody& b, Run&& run, Escape&& escape) {
+        size_t from = 0;
+        for (size_t at : b.escapes()) {
+            if (at > from) run(from, at);
+            escape(ResultBody::escape_for(static_cast<unsigned char>(b.data()[at])));
+            from = at + 1;
+        }
+        if (b.size() > from) run(from, b.size());
+    }
+
+    // Hands segments to a sink max_iov at a time, so emitting a body with
+    // many escapes needs no segment list of its own size.
+    class SegmentWriter {
+    public:
+        explicit SegmentWriter(BodySink& sink) : sink_(sink) { batch_.reserve(max_iov); }
+
+        void add(const void* p, size_t n) {
+            if (n == 0) return;
+            batch_.push_back({ const_cast<void*>(p), n });
+            if (batch_.size() == max_iov) flush();
+        }
+        void file(int fd, off_t offset, size_t length, const void* mapped) {
+            flush();
+            sink_.write_file(fd, offset, length, mapped);
+        }
+        void flush() {
+            if (batch_.empty()) return;
+            sink_.write(batch_.data(), batch_.size());
+            batch_.clear();
+        }
+
+    private:
+        BodySink& sink_;
+        std::vector<iovec> batch_;
+    };
+} // namespace
+
+
+// ---------- sinks ----------
+
+void FdBodySink::write(const iovec* iov, size_t count) {
+    // writev() may stop anywhere, mid-segment included; keep a private copy
+    // of the current batch so it can be advanced in place.
+    std::vector<iovec>& batch = batch_;
+    while (count > 0) {
+        const size_t n = std::min(count, max_iov);
+        batch.assign(iov, iov + n);
+        size_t first = 0;
+        while (first < n) {
+            ssize_t w = ::writev(fd_, batch.data() + first, static_cast<int>(n - first));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                throw std::system_error(errno, std::generic_category(), "writev");
+            }
+            size_t left = static_cast<size_t>(w);
+            while (first < n && left >= batch[first].iov_len) left -= batch[first++].iov_len;
+            if (first < n) {
+                batch[first].iov_base = static_cast<char*>(batch[first].iov_base) + left;
+                batch[first].iov_len -= left;
+            }
+        }
+        iov += n;
+        count -= n;
+    }
+}
+
+void BodySink::write_file(int, off_t, size_t length, const void* mapped) {
+    const iovec v{ const_cast<void*>(mapped), length };
+    write(&v, 1);
+}
+
+void FdBodySink::write_file(int fd, off_t offset, size_t length, const void* mapped) {
+#ifdef __linux__
+    // The kernel copies page cache to the socket; nothing passes through us.
+    off_t pos = offset;
+    size_t left = length;
+    while (left > 0) {
+        const ssize_t w = ::sendfile(fd_, fd, &pos, left);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EINVAL || errno == ENOSYS) && left == length) {
+                BodySink::write_file(fd, offset, length, mapped);   // descriptor pair sendfile can't do
+                return;
+            }
+            throw std::system_error(errno, std::generic_category(), "sendfile");
+        }
+        if (w == 0) throw std::system_error(EIO, std::generic_category(), "sendfile: short file");
+        left -= static_cast<size_t>(w);
+    }
+#else
+    BodySink::write_file(fd, offset, length, mapped);
+#endif
+}
+
+void StringBodySink::write(const iovec* iov, size_t count) {
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) total += iov[i].iov_len;
+    out_.reserve(out_.size() + total);
+    for (size_t i = 0; i < count; ++i) out_.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+}
+
+
+// ---------- ConversationBuilder ----------
+
+void ConversationBuilder::set_head(const json& head) {
+    const json h = head.is_object() ? head : json::object();
+    head_ = h.dump();
+    bytes_serialized_ += head_.size();
+    head_.pop_back();  // drop '}'
+    head_.append(h.empty() ? "\"messages\":[" : ",\"messages\":[");
+}
+
+void ConversationBuilder::append(const json& message) {
+    Message m;
+    if (!messages_.empty()) m.text.push_back(',');
+    m.text.append(message.dump());
+    bytes_serialized_ += m.text.size();
+    messages_bytes_ += m.text.size();
+    messages_.push_back(std::move(m));
+}
+
+void ConversationBuilder::append_tool_result(const std::string& tool_call_id,
+                                             std::shared_ptr<const ResultBody> body) {
+    Message m;
+    if (!messages_.empty()) m.text.push_back(',');
+    m.text.append(R"({"role":"tool","tool_call_id":)");
+    m.text.append(json(tool_call_id).dump());
+    m.text.append(R"(,"content":")");
+    if (body) {
+        m.body = std::move(body);
+        m.tail = body_tail;
+    } else {
+        m.text.append(body_tail);
+    }
+    const size_t tail = m.tail ? sizeof(body_tail) - 1 : 0;
+    bytes_serialized_ += m.text.size() + tail;
+    messages_bytes_ += m.text.size() + tail + (m.body ? m.body->escaped_size() : 0);
+    messages_.push_back(std::move(m));
+}
+
+void ConversationBuilder::reset(const json& head) {
+    messages_.clear();
+    messages_bytes_ = 0;
+    set_head(head);
+}
+
+std::vector<iovec> ConversationBuilder::segments() const {
+    std::vector<iovec> iov;
+    iov.reserve(messages_.size() + 2);
+    iov.push_back({ const_cast<char*>(head_.data()), head_.size() });
+    for (const auto& m : messages_) {
+        iov.push_back({ const_cast<char*>(m.text.data()), m.text.size() });
+        if (!m.tail) continue;
+        const ResultBody& b = *m.body;
+        for_each_body_piece(b,
+            [&](size_t a, size_t z) { iov.push_back({ const_cast<char*>(b.data() + a), z - a }); },
+            [&](std::string_view e) { iov.push_back({ const_cast<char*>(e.data()), e.size() }); });
+        iov.push_back({ const_cast<char*>(m.tail), sizeof(body_tail) - 1 });
+    }
+    iov.push_back({ const_cast<char*>(closing), 2 });
+    return iov;
+}
+
+void ConversationBuilder::write_to(BodySink& sink) const {
+    SegmentWriter out(sink);
+    out.add(head_.data(), head_.size());
+    for (const auto& m : messages_) {
+        out.add(m.text.data(), m.text.size());
+        if (!m.tail) continue;
+        const ResultBody& b = *m.body;
+        for_each_body_piece(b,
+            [&](size_t a, size_t z) {
+                if (b.fd() >= 0 && z - a >= sendfile_min_bytes) {
+                    out.file(b.fd(), b.offset() + static_cast<off_t>(a), z - a, b.data() + a);
+                } else {
+                    out.add(b.data() + a, z - a);
+                }
+            },
+            [&](std::string_view e) { out.add(e.data(), e.size()); });
+        out.add(m.tail, sizeof(body_tail) - 1);
+    }
+    out.add(closing, 2);
+    out.flush();
+}
+
+std::string ConversationBuilder::str() const {
+    std::string out;
+    StringBodySink sink(out);
+    write_to(sink);
+    return out;
+}
+
+} // namespace lct
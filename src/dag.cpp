@@ -0,0 +1,258 @@
+#include "llama_cpp_tools/tool_registry.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    // A parsed {"$ref": "<id>.result.a.0.b"}: target id and path below result.
+    struct Ref {
+        std::string id;
+        std::vector<std::string> path;
+    };
+
+    inline bool is_ref(const json& v) {
+        return v.is_object() && v.size() == 1 && v.contains("$ref") && v["$ref"].is_string();
+    }
+
+    // Split at the first ".result" segment so ids may themselves contain dots.
+    inline bool parse_ref(const std::string& s, Ref& out) {
+        static const std::string marker = ".result";
+        for (size_t pos = s.find(marker); pos != std::string::npos; pos = s.find(marker, pos + 1)) {
+            const size_t end = pos + marker.size();
+            if (pos == 0 || (end != s.size() && s[end] != '.')) continue;
+            out.id = s.substr(0, pos);
+            out.path.clear();
+            size_t start = end;
+            while (start < s.size()) {
+                const size_t next = s.find('.', start + 1);
+                out.path.push_back(s.substr(start + 1, next == std::string::npos ? std::string::npos : next - start - 1));
+                start = next == std::string::npos ? s.size() : next;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    inline void collect_refs(const json& v, std::vector<std::string>& out) {
+        if (is_ref(v)) {
+            out.push_back(v["$ref"].get<std::string>());
+        } else if (v.is_structured()) {
+            for (const auto& child : v) collect_refs(child, out);
+        }
+    }
+
+    inline const json* walk(const json& root, const std::vector<std::string>& path) {
+        const json* cur = &root;
+        for (const auto& seg : path) {
+            if (cur->is_object()) {
+                auto it = cur->find(seg);
+                if (it == cur->end()) return nullptr;
+                cur = &*it;
+            } else if (cur->is_array() && !seg.empty() &&
+                       std::all_of(seg.begin(), seg.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+                const size_t idx = std::stoul(seg);
+                if (idx >= cur->size()) return nullptr;
+                cur = &(*cur)[idx];
+            } else {
+                return nullptr;
+            }
+        }
+        return cur;
+    }
+
+    // Copy of `v` with every $ref replaced through `lookup`, which throws
+    // std::runtime_error when a reference can't be resolved.
+    template <typename Lookup>
+    json substitute(const json& v, const Lookup& lookup) {
+        if (is_ref(v)) return lookup(v["$ref"].get<std::string>());
+        if (v.is_object()) {
+            json out = json::object();
+            for (auto it = v.begin(); it != v.end(); ++it) out[it.key()] = substitute(it.value(), lookup);
+            return out;
+        }
+        if (v.is_array()) {
+            json out = json::array();
+            for (const auto& child : v) out.push_back(substitute(child, lookup));
+            return out;
+        }
+        return v;
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+std::vector<ToolRegistry::ExecutionResult>
+ToolRegistry::process_remote_response_and_execute_dag(const json& api_response, DagStats* stats) const
+{
+    std::vector<ToolCall> calls = find_tool_calls(api_response);
+    const size_t n = calls.size();
+
+    std::vector<std::string> ids(n);
+    std::map<std::string, size_t> by_id;
+    for (size_t i = 0; i < n; ++i) {
+        ids[i] = calls[i].id.empty() ? "call_" + std::to_string(i + 1) : calls[i].id;
+        by_id.emplace(ids[i], i);  // first wins on duplicate ids
+    }
+
+    struct Node {
+        std::vector<size_t> deps;
+        std::vector<size_t> dependents;
+        size_t waiting = 0;
+        std::string error;        // set before execution: bad ref, cycle...
+        std::string failed_dep;   // first dependency that finished with an error
+    };
+    std::vector<Node> nodes(n);
+
+    // 1) Build the graph.
+    size_t edges = 0;
+    for (size_t i = 0; i < n; ++i) {
+        std::vector<std::string> refs;
+        collect_refs(calls[i].arguments, refs);
+        for (const auto& s : refs) {
+            Ref ref;
+            if (!parse_ref(s, ref)) { nodes[i].error = "malformed $ref: " + s; break; }
+            auto it = by_id.find(ref.id);
+            if (it == by_id.end()) { nodes[i].error = "unresolved $ref: " + s; break; }
+            auto& deps = nodes[i].deps;
+            if (std::find(deps.begin(), deps.end(), it->second) == deps.end()) {
+                deps.push_back(it->second);
+                nodes[it->second].dependents.push_back(i);
+                ++edges;
+            }
+        }
+    }
+
+    // 2) Kahn's algorithm: whatever can't be ordered sits on or behind a cycle.
+    std::vector<size_t> indegree(n), order;
+    order.reserve(n);
+    for (size_t i = 0; i < n; ++i) indegree[i] = nodes[i].deps.size();
+    for (size_t i = 0; i < n; ++i) if (indegree[i] == 0) order.push_back(i);
+    for (size_t k = 0; k < order.size(); ++k) {
+        for (size_t d : nodes[order[k]].dependents) {
+            if (--indegree[d] == 0) order.push_back(d);
+        }
+    }
+    std::vector<bool> ordered(n, false);
+    for (size_t i : order) ordered[i] = true;
+
+    size_t cycle_errors = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (ordered[i] || !nodes[i].error.empty()) continue;   // keep a bad-$ref error
+        ++cycle_errors;
+        // Follow unordered dependencies until a node repeats to name the cycle.
+        std::vector<size_t> path{ i };
+        std::vector<bool> on_path(n, false);
+        on_path[i] = true;
+        size_t cur = i;
+        while (true) {
+            size_t next = n;
+            for (size_t d : nodes[cur].deps) if (!ordered[d]) { next = d; break; }
+            if (next == n) break;  // unreachable: unordered nodes always have an unordered dep
+            if (on_path[next]) {
+                std::string msg = "dependency cycle: ";
+                auto start = std::find(path.begin(), path.end(), next);
+                for (auto it = start; it != path.end(); ++it) msg += ids[*it] + " -> ";
+                nodes[i].error = msg + ids[next];
+                break;
+            }
+            on_path[next] = true;
+            path.push_back(next);
+            cur = next;
+        }
+        if (nodes[i].error.empty()) nodes[i].error = "dependency cycle";
+    }
+
+    if (stats) {
+        std::vector<size_t> level(n, 1);
+        size_t depth = 0;
+        for (size_t i : order) {
+            for (size_t d : nodes[i].deps) level[i] = std::max(level[i], level[d] + 1);
+            depth = std::max(depth, level[i]);
+        }
+        stats->calls = n;
+        stats->edges = edges;
+        stats->depth = depth;
+        stats->round_trips_saved = depth > 0 ? depth - 1 : 0;
+        stats->cycle_errors = cycle_errors;
+    }
+
+    // 3) Execute: ready nodes run concurrently; completions unlock dependents.
+    std::vector<ExecutionResult> results(n);
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<size_t> finished;
+    std::vector<std::future<void>> futs;
+    futs.reserve(n);
+
+    auto finish_now = [&](size_t i, std::string error) {
+        results[i].call_id = calls[i].id;
+        results[i].tool_name = calls[i].name;
+        results[i].arguments = calls[i].arguments;
+        results[i].error = std::move(error);
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(i);
+    };
+
+    auto launch = [&](size_t i) {
+        // Calls without refs run on their own (shared) arguments.
+        SharedJson args = calls[i].arguments;
+        if (!nodes[i].deps.empty()) {
+            try {
+                args = substitute(*calls[i].arguments, [&](const std::string& s) -> json {
+                    Ref ref;
+                    parse_ref(s, ref);
+                    const json* v = walk(*results[by_id.at(ref.id)].result, ref.path);
+                    if (!v) throw std::runtime_error("$ref path not found: " + s);
+                    return *v;
+                });
+            } catch (const std::exception& e) {
+                finish_now(i, e.what());
+                return;
+            }
+        }
+        calls[i].ready = std::chrono::steady_clock::now();   // queue wait starts once the inputs exist
+        futs.emplace_back(std::async(std::launch::async, [&, i, args = std::move(args)]() {
+            // Results are encoded and budgeted once every dependent has read the original.
+            ExecutionResult r = execute_call(calls[i], args, nullptr, {}, false);
+            std::lock_guard<std::mutex> lock(mutex);
+            results[i] = std::move(r);
+            finished.push_back(i);
+            cv.notify_one();
+        }));
+    };
+
+    for (size_t i = 0; i < n; ++i) {
+        nodes[i].waiting = nodes[i].deps.size();
+        if (!nodes[i].error.empty()) finish_now(i, nodes[i].error);
+        else if (nodes[i].waiting == 0) launch(i);
+    }
+
+    for (size_t done = 0; done < n; ++done) {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return !finished.empty(); });
+            i = finished.front();
+            finished.pop_front();
+        }
+        const bool failed = !results[i].error.empty();
+        for (size_t d : nodes[i].dependents) {
+            if (!nodes[d].error.empty()) continue;  // already reported (cycle)
+            if (failed && nodes[d].failed_dep.empty()) nodes[d].failed_dep = ids[i];
+            if (--nodes[d].waiting > 0) continue;
+            if (!nodes[d].failed_dep.empty()) finish_now(d, "dependency failed: " + nodes[d].failed_dep);
+            else launch(d);
+        }
+    }
+    for (auto& r : results) finalize_result(r);
+    return results;
+}
+
+} // namespace lct
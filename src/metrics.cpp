@@ -0,0 +1,375 @@
+#include "llama_cpp_tools/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <queue>
+#include <sstream>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    constexpr unsigned linear_limit = 32;   // values below this get one bucket each
+    constexpr unsigned sub_bits = 4;        // 16 sub-buckets per power of two
+
+    inline unsigned msb(std::uint64_t v) {
+        unsigned n = 0;
+        while (v >>= 1) ++n;
+        return n;
+    }
+
+    // Hands every live thread a distinct shard index, lowest free first, so
+    // indices stay below the peak number of threads that ever recorded.
+    class ShardIndices {
+    public:
+        size_t acquire() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_.empty()) return next_++;
+            const size_t i = free_.top();
+            free_.pop();
+            return i;
+        }
+        void release(size_t i) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push(i);
+        }
+
+    private:
+        std::mutex mutex_;
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> free_;
+        size_t next_ = 0;
+    };
+
+    // Never destroyed: threads may still exit after static destruction.
+    ShardIndices& shard_indices() {
+        static ShardIndices* indices = new ShardIndices;
+        return *indices;
+    }
+
+    struct ThreadShard {
+        size_t index = shard_indices().acquire();
+        ~ThreadShard() { shard_indices().release(index); }
+    };
+
+    size_t this_thread_shard() {
+        thread_local ThreadShard shard;
+        return shard.index;
+    }
+
+    void bump_max(std::atomic<std::uint64_t>& m, std::uint64_t v) {
+        std::uint64_t cur = m.load(std::memory_order_relaxed);
+        while (v > cur && !m.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+    }
+
+    // Export buckets for the Prometheus rendering, in seconds and in ns.
+    const double export_bounds[LatencyHistogram::export_bucket_count] = {
+        1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 0.1, 0.5, 1.0, 5.0, 10.0, 60.0 };
+    const std::uint64_t export_bounds_ns[LatencyHistogram::export_bucket_count] = {
+        1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000,
+        100000000, 500000000, 1000000000, 5000000000, 10000000000, 60000000000 };
+
+    std::string escape_label(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (c == '\\') out += "\\\\";
+            else if (c == '"') out += "\\\"";
+            else if (c == '\n') out += "\\n";
+            else out.push_back(c);
+        }
+        return out;
+    }
+
+    std::string format_double(double v) {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.9g", v);
+        return buf;
+    }
+
+    // `labels` is empty or `name="value",` (with the trailing comma).
+    void render_histogram_series(std::ostringstream& out, const char* metric, const std::string& labels,
+                                 const LatencyHistogram& h) {
+        const std::string plain = labels.empty() ? "" : "{" + labels.substr(0, labels.size() - 1) + "}";
+        std::uint64_t cumulative = 0;
+        for (size_t i = 0; i < LatencyHistogram::export_bucket_count; ++i) {
+            cumulative += h.export_bucket(i);
+            out << metric << "_bucket{" << labels << "le=\"" << format_double(export_bounds[i]) << "\"} " << cumulative << '\n';
+        }
+        cumulative += h.export_bucket(LatencyHistogram::export_bucket_count);
+        out << metric << "_bucket{" << labels << "le=\"+Inf\"} " << cumulative << '\n';
+        out << metric << "_sum" << plain << ' ' << format_double(static_cast<double>(h.sum_ns()) / 1e9) << '\n';
+        out << metric << "_count" << plain << ' ' << cumulative << '\n';
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+size_t LatencyHistogram::bucket_for(std::uint64_t ns) {
+    if (ns < linear_limit) return static_cast<size_t>(ns);
+    const unsigned m = msb(ns);                      // >= 5
+    const unsigned shift = m - sub_bits;
+    const size_t top = static_cast<size_t>(ns >> shift) - (size_t(1) << sub_bits);   // 0..15
+    const size_t idx = linear_limit + (m - 5) * (size_t(1) << sub_bits) + top;
+    return std::min(idx, bucket_count - 1);
+}
+
+std::uint64_t LatencyHistogram::bucket_upper(size_t bucket) {
+    if (bucket < linear_limit) return bucket;
+    const size_t rel = bucket - linear_limit;
+    const unsigned m = static_cast<unsigned>(rel >> sub_bits) + 5;
+    const std::uint64_t top = (rel & ((size_t(1) << sub_bits) - 1)) + (std::uint64_t(1) << sub_bits);
+    return ((top + 1) << (m - sub_bits)) - 1;
+}
+
+double LatencyHistogram::export_bound(size_t i) {
+    return export_bounds[i];
+}
+
+size_t LatencyHistogram::export_bucket_for(std::uint64_t ns) {
+    return static_cast<size_t>(std::lower_bound(std::begin(export_bounds_ns), std::end(export_bounds_ns), ns) -
+                               std::begin(export_bounds_ns));
+}
+
+void LatencyHistogram::record(std::uint64_t ns) {
+    if (buckets_.empty()) buckets_.assign(bucket_count, 0);
+    ++buckets_[bucket_for(ns)];
+    ++export_[export_bucket_for(ns)];
+    ++count_;
+    sum_ns_ += ns;
+    max_ns_ = std::max(max_ns_, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    if (other.count_ == 0) return;
+    if (buckets_.empty()) buckets_.assign(bucket_count, 0);
+    for (size_t i = 0; i < bucket_count; ++i) buckets_[i] += other.buckets_[i];
+    for (size_t i = 0; i <= export_bucket_count; ++i) export_[i] += other.export_[i];
+    count_ += other.count_;
+    sum_ns_ += other.sum_ns_;
+    max_ns_ = std::max(max_ns_, other.max_ns_);
+}
+
+std::uint64_t LatencyHistogram::percentile(double q) const {
+    if (count_ == 0) return 0;
+    q = std::min(std::max(q, 0.0), 1.0);
+    const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(count_))));
+    std::uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank) return std::min(bucket_upper(i), max_ns_);
+    }
+    return max_ns_;
+}
+
+void StreamTotals::add(const StreamStats& s) {
+    ++streams;
+    sum.bytes += s.bytes;
+    sum.chunks += s.chunks;
+    sum.values += s.values;
+    sum.calls += s.calls;
+    sum.dropped_bytes += s.dropped_bytes;
+    sum.syntax_errors += s.syntax_errors;
+    sum.truncated += s.truncated;
+    sum.dispatch_errors += s.dispatch_errors;
+    sum.peak_buffer_bytes = std::max(sum.peak_buffer_bytes, s.peak_buffer_bytes);
+    if (s.calls) time_to_first_call.record(s.first_call_ns);
+}
+
+std::string render_prometheus(const StreamTotals& t) {
+    std::ostringstream out;
+    auto counter = [&](const char* metric, const char* help, std::uint64_t v) {
+        out << "# HELP " << metric << ' ' << help << "\n# TYPE " << metric << " counter\n" << metric << ' ' << v << '\n';
+    };
+    counter("lct_stream_sessions_total", "Finished streaming sessions.", t.streams);
+    counter("lct_stream_bytes_total", "Bytes fed to streaming sessions.", t.sum.bytes);
+    counter("lct_stream_chunks_total", "Chunks fed to streaming sessions.", t.sum.chunks);
+    counter("lct_stream_values_total", "Complete JSON values extracted from streams.", t.sum.values);
+    counter("lct_stream_calls_total", "Tool calls dispatched from streams.", t.sum.calls);
+    counter("lct_stream_dropped_bytes_total", "Stream bytes outside any JSON value.", t.sum.dropped_bytes);
+    out << "# HELP lct_stream_parse_failures_total Stream values that could not be dispatched.\n"
+           "# TYPE lct_stream_parse_failures_total counter\n"
+        << "lct_stream_parse_failures_total{category=\"syntax\"} " << t.sum.syntax_errors << '\n'
+        << "lct_stream_parse_failures_total{category=\"truncated\"} " << t.sum.truncated << '\n'
+        << "lct_stream_parse_failures_total{category=\"dispatch\"} " << t.sum.dispatch_errors << '\n';
+    out << "# HELP lct_stream_peak_buffer_bytes Largest reassembly buffer of any stream.\n"
+           "# TYPE lct_stream_peak_buffer_bytes gauge\n"
+        << "lct_stream_peak_buffer_bytes " << t.sum.peak_buffer_bytes << '\n';
+    out << "# HELP lct_stream_time_to_first_call_seconds First byte to first dispatched tool call.\n"
+           "# TYPE lct_stream_time_to_first_call_seconds histogram\n";
+    render_histogram_series(out, "lct_stream_time_to_first_call_seconds", "", t.time_to_first_call);
+    return out.str();
+}
+
+ToolMetricsTable::Histogram::~Histogram() {
+    for (auto& b : blocks) delete[] b.load(std::memory_order_relaxed);
+}
+
+ToolMetricsTable::Slot::~Slot() {
+    for (auto& c : shards) delete c.load(std::memory_order_relaxed);
+    delete next.load(std::memory_order_relaxed);
+}
+
+std::atomic<ToolMetricsTable::Cells*>& ToolMetricsTable::Slot::shard(size_t index) {
+    Slot* block = this;
+    for (; index >= shard_count; index -= shard_count) {
+        Slot* following = block->next.load(std::memory_order_acquire);
+        if (!following) {
+            auto fresh = std::make_unique<Slot>();
+            if (block->next.compare_exchange_strong(following, fresh.get(), std::memory_order_acq_rel)) {
+                following = fresh.release();
+            }
+        }
+        block = following;
+    }
+    return block->shards[index];
+}
+
+ToolMetricsTable::ToolMetricsTable(const ToolMetricsTable& other) {
+    for (const auto& [name, slot] : other.slots_) {
+        auto copy_slot = std::make_unique<Slot>();
+        size_t base = 0;
+        for (const Slot* block = slot.get(); block; block = block->next.load(std::memory_order_acquire)) {
+            for (size_t i = 0; i < shard_count; ++i) {
+                const Cells* from = block->shards[i].load(std::memory_order_acquire);
+                if (!from) continue;
+                auto cells = std::make_unique<Cells>();
+                cells->calls.store(from->calls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                cells->errors.store(from->errors.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                copy(from->queue, cells->queue);
+                copy(from->exec, cells->exec);
+                copy(from->serialize, cells->serialize);
+                copy_slot->shard(base + i).store(cells.release(), std::memory_order_relaxed);
+            }
+            base += shard_count;
+        }
+        slots_.emplace(name, std::move(copy_slot));
+    }
+}
+
+ToolMetricsTable::~ToolMetricsTable() = default;
+
+void ToolMetricsTable::add(const std::string& name) {
+    slots_.emplace(name, std::make_unique<Slot>());
+}
+
+void ToolMetricsTable::record(const std::string& name, std::uint64_t queue_ns, std::uint64_t exec_ns,
+                              std::uint64_t serialize_ns, bool error) {
+    auto it = slots_.find(name);
+    if (it == slots_.end()) return;
+    auto& shard = it->second->shard(this_thread_shard());
+    Cells* cells = shard.load(std::memory_order_acquire);
+    if (!cells) {
+        auto fresh = std::make_unique<Cells>();
+        if (shard.compare_exchange_strong(cells, fresh.get(), std::memory_order_acq_rel)) cells = fresh.release();
+    }
+
+    auto add = [](Histogram& h, std::uint64_t ns) {
+        const size_t bucket = LatencyHistogram::bucket_for(ns);
+        auto& slot = h.blocks[bucket / Histogram::block_size];
+        std::atomic<std::uint64_t>* block = slot.load(std::memory_order_acquire);
+        if (!block) {
+            std::unique_ptr<std::atomic<std::uint64_t>[]> fresh(new std::atomic<std::uint64_t>[Histogram::block_size]{});
+            if (slot.compare_exchange_strong(block, fresh.get(), std::memory_order_acq_rel)) block = fresh.release();
+        }
+        block[bucket % Histogram::block_size].fetch_add(1, std::memory_order_relaxed);
+        h.exported[LatencyHistogram::export_bucket_for(ns)].fetch_add(1, std::memory_order_relaxed);
+        h.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+        bump_max(h.max_ns, ns);
+        h.count.fetch_add(1, std::memory_order_relaxed);
+    };
+    cells->calls.fetch_add(1, std::memory_order_relaxed);
+    if (error) cells->errors.fetch_add(1, std::memory_order_relaxed);
+    add(cells->queue, queue_ns);
+    add(cells->exec, exec_ns);
+    add(cells->serialize, serialize_ns);
+}
+
+void ToolMetricsTable::fold(const Histogram& from, LatencyHistogram& into) {
+    const std::uint64_t count = from.count.load(std::memory_order_relaxed);
+    if (count == 0) return;
+    if (into.buckets_.empty()) into.buckets_.assign(LatencyHistogram::bucket_count, 0);
+    // Sum the buckets rather than trusting `count`, so a snapshot taken
+    // mid-record stays self-consistent.
+    std::uint64_t total = 0;
+    for (size_t k = 0; k < Histogram::block_count; ++k) {
+        const std::atomic<std::uint64_t>* block = from.blocks[k].load(std::memory_order_acquire);
+        if (!block) continue;
+        for (size_t j = 0; j < Histogram::block_size; ++j) {
+            const std::uint64_t b = block[j].load(std::memory_order_relaxed);
+            into.buckets_[k * Histogram::block_size + j] += b;
+            total += b;
+        }
+    }
+    for (size_t i = 0; i <= LatencyHistogram::export_bucket_count; ++i) {
+        into.export_[i] += from.exported[i].load(std::memory_order_relaxed);
+    }
+    into.count_ += total;
+    into.sum_ns_ += from.sum_ns.load(std::memory_order_relaxed);
+    into.max_ns_ = std::max(into.max_ns_, from.max_ns.load(std::memory_order_relaxed));
+}
+
+void ToolMetricsTable::copy(const Histogram& from, Histogram& into) {
+    auto copy_cell = [](const std::atomic<std::uint64_t>& a, std::atomic<std::uint64_t>& b) {
+        b.store(a.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    };
+    copy_cell(from.count, into.count);
+    copy_cell(from.sum_ns, into.sum_ns);
+    copy_cell(from.max_ns, into.max_ns);
+    for (size_t i = 0; i <= LatencyHistogram::export_bucket_count; ++i) copy_cell(from.exported[i], into.exported[i]);
+    for (size_t k = 0; k < Histogram::block_count; ++k) {
+        const std::atomic<std::uint64_t>* block = from.blocks[k].load(std::memory_order_acquire);
+        if (!block) continue;
+        auto* fresh = new std::atomic<std::uint64_t>[Histogram::block_size]{};
+        for (size_t j = 0; j < Histogram::block_size; ++j) copy_cell(block[j], fresh[j]);
+        into.blocks[k].store(fresh, std::memory_order_relaxed);
+    }
+}
+
+ToolMetrics ToolMetricsTable::snapshot(const std::string& name) const {
+    ToolMetrics m;
+    auto it = slots_.find(name);
+    if (it == slots_.end()) return m;
+    for (const Slot* block = it->second.get(); block; block = block->next.load(std::memory_order_acquire)) {
+        for (const auto& shard : block->shards) {
+            const Cells* c = shard.load(std::memory_order_acquire);
+            if (!c) continue;
+            m.calls += c->calls.load(std::memory_order_relaxed);
+            m.errors += c->errors.load(std::memory_order_relaxed);
+            fold(c->queue, m.queue);
+            fold(c->exec, m.exec);
+            fold(c->serialize, m.serialize);
+        }
+    }
+    return m;
+}
+
+std::string ToolMetricsTable::render_prometheus() const {
+    std::vector<std::pair<std::string, ToolMetrics>> tools;
+    for (const auto& [name, slot] : slots_) {
+        ToolMetrics m = snapshot(name);
+        if (m.calls) tools.emplace_back(escape_label(name), std::move(m));
+    }
+
+    std::ostringstream out;
+    auto counter = [&](const char* metric, const char* help, std::uint64_t ToolMetrics::*field) {
+        out << "# HELP " << metric << ' ' << help << "\n# TYPE " << metric << " counter\n";
+        for (const auto& [label, m] : tools) out << metric << "{tool=\"" << label << "\"} " << m.*field << '\n';
+    };
+    auto histogram = [&](const char* metric, const char* help, LatencyHistogram ToolMetrics::*field) {
+        out << "# HELP " << metric << ' ' << help << "\n# TYPE " << metric << " histogram\n";
+        for (const auto& [label, m] : tools) render_histogram_series(out, metric, "tool=\"" + label + "\",", m.*field);
+    };
+
+    counter("lct_tool_calls_total", "Tool handler invocations.", &ToolMetrics::calls);
+    counter("lct_tool_errors_total", "Tool handler invocations that threw.", &ToolMetrics::errors);
+    histogram("lct_tool_queue_seconds", "Time from call discovery to handler start.", &ToolMetrics::queue);
+    histogram("lct_tool_exec_seconds", "Time spent inside the tool handler.", &ToolMetrics::exec);
+    histogram("lct_tool_serialize_seconds", "Time spent decoding the call's arguments.", &ToolMetrics::serialize);
+    return out.str();
+}
+
+} // namespace lct
@@ -0,0 +1,243 @@
+#include "llama_cpp_tools/tool_registry.h"
+#include "llama_cpp_tools/bounded_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    // Wakeup channel between stages. Spins briefly (queues are usually not
+    // empty for long under load), then parks on a condition variable. The
+    // timed wait bounds any wakeup lost between the check and the park.
+    class Signal {
+    public:
+        template <typename Pred>
+        void wait(Pred pred) {
+            for (int i = 0; i < 64; ++i) {
+                if (pred()) return;
+                std::this_thread::yield();
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            waiters_.fetch_add(1);
+            while (!pred()) cv_.wait_for(lock, std::chrono::milliseconds(1));
+            waiters_.fetch_sub(1);
+        }
+
+        void notify() {
+            if (waiters_.load() == 0) return;
+            std::lock_guard<std::mutex> lock(mutex_);
+            cv_.notify_all();
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::atomic<int> waiters_{0};
+    };
+
+    struct StageCounters {
+        std::atomic<std::uint64_t> items{0};
+        std::atomic<std::uint64_t> dropped{0};
+        std::atomic<std::uint64_t> high_water{0};
+        std::atomic<std::uint64_t> stall_ns{0};
+        std::atomic<std::uint64_t> idle_ns{0};
+
+        void add_time(std::atomic<std::uint64_t>& c, clock::time_point since) {
+            c.fetch_add(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - since).count()),
+                std::memory_order_relaxed);
+        }
+
+        void note_depth(size_t depth) {
+            std::uint64_t prev = high_water.load(std::memory_order_relaxed);
+            while (depth > prev && !high_water.compare_exchange_weak(prev, depth, std::memory_order_relaxed)) {}
+        }
+
+        PipelineStageStats snapshot() const {
+            PipelineStageStats s;
+            s.items = items.load();
+            s.dropped = dropped.load();
+            s.queue_high_water = high_water.load();
+            s.stall_us = stall_ns.load() / 1000;
+            s.idle_us = idle_ns.load() / 1000;
+            return s;
+        }
+    };
+
+    // Shared failure/abort state: the first error wins and stops every stage.
+    struct Abort {
+        std::atomic<bool> flag{false};
+        std::mutex mutex;
+        std::exception_ptr error;
+
+        void raise(std::exception_ptr e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = e;
+            flag.store(true);
+        }
+        bool raised() const { return flag.load(std::memory_order_relaxed); }
+    };
+
+    // Push `v` downstream honouring the backpressure policy. Returns false
+    // when the pipeline is aborting and the item was not enqueued.
+    template <typename T>
+    bool push(BoundedQueue<T>& q, T&& v, BackpressurePolicy policy, StageCounters& c,
+              Signal& ready, Signal& space, Abort& abort, const char* queue_name)
+    {
+        while (!q.try_push(std::move(v))) {
+            if (abort.raised()) return false;
+            if (policy == BackpressurePolicy::fail) {
+                abort.raise(std::make_exception_ptr(
+                    std::runtime_error(std::string("pipeline backpressure: ") + queue_name + " queue full")));
+                ready.notify();
+                return false;
+            }
+            if (policy == BackpressurePolicy::drop_oldest) {
+                T victim;
+                if (q.try_pop(victim)) {
+                    c.dropped.fetch_add(1, std::memory_order_relaxed);
+                    space.notify();
+                }
+                continue;
+            }
+            const auto t0 = clock::now();
+            space.wait([&] { return q.size() < q.capacity() || abort.raised(); });
+            c.add_time(c.stall_ns, t0);
+        }
+        c.items.fetch_add(1, std::memory_order_relaxed);
+        c.note_depth(q.size());
+        ready.notify();
+        return true;
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+PipelineStats ToolRegistry::process_streaming_response_pipelined(
+    std::function<bool(std::string&)> get_chunk,
+    std::function<void(const ExecutionResult&)> on_result,
+    const PipelineOptions& opts) const
+{
+    struct CallItem {
+        ToolCall call;
+        CallGate gate;
+    };
+
+    BoundedQueue<CallItem> calls(std::max<size_t>(1, opts.call_queue_capacity));
+    BoundedQueue<ExecutionResult> results(std::max<size_t>(1, opts.result_queue_capacity));
+    Signal calls_ready, calls_space, results_ready, results_space;
+    StageCounters parse_c, exec_c, deliver_c;
+    Abort abort;
+    std::atomic<bool> parse_done{false};
+    std::atomic<bool> exec_done{false};
+
+    const size_t n_exec = std::max<size_t>(1, opts.executor_threads);
+    std::atomic<size_t> live_executors{n_exec};
+
+    // Stage 3: deliver.
+    std::thread deliverer([&] {
+        ExecutionResult r;
+        while (!abort.raised()) {
+            const bool done = exec_done.load(std::memory_order_acquire);
+            if (results.try_pop(r)) {
+                results_space.notify();
+                if (!r.partial) trace(TracePoint::result_delivered, r.tool_name, r.call_id);
+                try {
+                    on_result(r);
+                } catch (...) {
+                    abort.raise(std::current_exception());
+                    break;
+                }
+                deliver_c.items.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (done) break;
+            const auto t0 = clock::now();
+            results_ready.wait([&] { return !results.empty() || exec_done.load() || abort.raised(); });
+            deliver_c.add_time(deliver_c.idle_ns, t0);
+        }
+        // Unblock executors waiting for room.
+        results_space.notify();
+    });
+
+    // Stage 2: execute.
+    std::vector<std::thread> executors;
+    executors.reserve(n_exec);
+    for (size_t i = 0; i < n_exec; ++i) {
+        executors.emplace_back([&] {
+            // Chunks of a streaming tool travel the result queue too.
+            const PartialSink partial = [&](const ExecutionResult& p) {
+                push(results, ExecutionResult(p), opts.policy, exec_c,
+                     results_ready, results_space, abort, "result");
+            };
+            CallItem item;
+            while (!abort.raised()) {
+                const bool done = parse_done.load(std::memory_order_acquire);
+                if (calls.try_pop(item)) {
+                    calls_space.notify();
+                    ExecutionResult r = execute_call(item.call, item.call.arguments, item.gate, partial);
+                    if (!push(results, std::move(r), opts.policy, exec_c,
+                              results_ready, results_space, abort, "result")) break;
+                    continue;
+                }
+                if (done) break;
+                const auto t0 = clock::now();
+                calls_ready.wait([&] { return !calls.empty() || parse_done.load() || abort.raised(); });
+                exec_c.add_time(exec_c.idle_ns, t0);
+            }
+            if (live_executors.fetch_sub(1) == 1) {
+                exec_done.store(true, std::memory_order_release);
+                results_ready.notify();
+            }
+            calls_space.notify();
+        });
+    }
+
+    // Stage 1: parse, on the calling thread.
+    try {
+        StreamSession session(*this, [&](std::vector<ToolCall>&& batch, std::vector<CallGate>&& gates) {
+            for (size_t i = 0; i < batch.size(); ++i) {
+                CallItem item{ std::move(batch[i]), std::move(gates[i]) };
+                if (!push(calls, std::move(item), opts.policy, parse_c,
+                          calls_ready, calls_space, abort, "call")) return;
+            }
+        });
+
+        std::string chunk;
+        while (!abort.raised()) {
+            chunk.clear();
+            const auto t0 = clock::now();
+            const bool more = get_chunk(chunk);
+            parse_c.add_time(parse_c.idle_ns, t0);
+            if (!more) break;
+            session.feed(chunk);
+        }
+        if (!abort.raised()) session.finish();
+    } catch (...) {
+        abort.raise(std::current_exception());
+    }
+    parse_done.store(true, std::memory_order_release);
+    calls_ready.notify();
+
+    for (auto& t : executors) t.join();
+    deliverer.join();
+
+    if (abort.error) std::rethrow_exception(abort.error);
+
+    PipelineStats stats;
+    stats.parse = parse_c.snapshot();
+    stats.execute = exec_c.snapshot();
+    stats.deliver = deliver_c.snapshot();
+    return stats;
+}
+
+} // namespace lct
@@ -0,0 +1,215 @@
+#include "llama_cpp_tools/result_body.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    thread_local std::shared_ptr<const ResultBody> t_body;
+
+    // Length of the well-formed UTF-8 sequence at p, or 0 if it isn't one.
+    inline size_t utf8_length(const unsigned char* p, const unsigned char* end) {
+        const unsigned char c = p[0];
+        if (c < 0x80) return 1;
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF;   // bounds of the second byte
+        if (c >= 0xC2 && c <= 0xDF) n = 2;
+        else if (c == 0xE0) { n = 3; lo = 0xA0; }
+        else if (c >= 0xE1 && c <= 0xEC) n = 3;
+        else if (c == 0xED) { n = 3; hi = 0x9F; }    // no surrogates
+        else if (c >= 0xEE && c <= 0xEF) n = 3;
+        else if (c == 0xF0) { n = 4; lo = 0x90; }
+        else if (c >= 0xF1 && c <= 0xF3) n = 4;
+        else if (c == 0xF4) { n = 4; hi = 0x8F; }
+        else return 0;
+        if (static_cast<size_t>(end - p) < n) return 0;
+        if (p[1] < lo || p[1] > hi) return 0;
+        for (size_t i = 2; i < n; ++i) if (p[i] < 0x80 || p[i] > 0xBF) return 0;
+        return n;
+    }
+
+    inline bool needs_escape(unsigned char c) { return c < 0x20 || c == '"' || c == '\\'; }
+
+    // escape_for() for the ASCII bytes: \u00XX for control characters, or
+    // the short form where JSON has one.
+    struct EscapeTable {
+        char text[0x60][7] = {};
+        std::uint8_t length[0x60] = {};
+
+        EscapeTable() {
+            static const char hex[] = "0123456789abcdef";
+            for (unsigned c = 0; c < 0x20; ++c) {
+                const char seq[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF], 0 };
+                set(c, seq);
+            }
+            set('\b', "\\b");
+            set('\f', "\\f");
+            set('\n', "\\n");
+            set('\r', "\\r");
+            set('\t', "\\t");
+            set('"', "\\\"");
+            set('\\', "\\\\");
+        }
+        void set(unsigned c, const char* seq) {
+            length[c] = static_cast<std::uint8_t>(std::strlen(seq));
+            std::memcpy(text[c], seq, length[c]);
+        }
+    };
+
+    [[noreturn]] void fail(const std::string& what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+std::shared_ptr<const ResultBody> ResultBody::from_string(std::string text) {
+    std::shared_ptr<ResultBody> b(new ResultBody());
+    b->owned_ = std::move(text);
+    b->data_ = b->owned_.data();
+    b->size_ = b->owned_.size();
+    b->finish();
+    return b;
+}
+
+std::shared_ptr<const ResultBody> ResultBody::from_file(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) fail("ResultBody: open " + path);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        const int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "ResultBody: fstat " + path);
+    }
+    std::shared_ptr<ResultBody> b(new ResultBody());
+    b->fd_ = fd;    // owned from here on
+    b->map(fd, 0, static_cast<size_t>(st.st_size));
+    b->finish();
+    return b;
+}
+
+std::shared_ptr<const ResultBody> ResultBody::from_fd(int fd, off_t offset, size_t length) {
+    const int own = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own < 0) fail("ResultBody: dup");
+    std::shared_ptr<ResultBody> b(new ResultBody());
+    b->fd_ = own;
+    b->map(own, offset, length);
+    b->finish();
+    return b;
+}
+
+std::shared_ptr<const ResultBody> ResultBody::from_shared_memory(const std::string& name, size_t offset, size_t length) {
+    const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) fail("ResultBody: shm_open " + name);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        const int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "ResultBody: fstat " + name);
+    }
+    const size_t total = static_cast<size_t>(st.st_size);
+    if (offset > total) offset = total;
+    if (length == std::string::npos || length > total - offset) length = total - offset;
+    std::shared_ptr<ResultBody> b(new ResultBody());
+    b->fd_ = fd;    // shm descriptors work with sendfile() as input too
+    b->map(fd, static_cast<off_t>(offset), length);
+    b->finish();
+    return b;
+}
+
+ResultBody::~ResultBody() {
+    if (mapping_) ::munmap(mapping_, mapping_size_);
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void ResultBody::map(int fd, off_t offset, size_t length) {
+    offset_ = offset;
+    size_ = length;
+    if (length == 0) return;
+    // mmap offsets must be page aligned; map from the page holding `offset`.
+    const off_t page = static_cast<off_t>(::sysconf(_SC_PAGESIZE));
+    const off_t start = offset / page * page;
+    const size_t skew = static_cast<size_t>(offset - start);
+    mapping_size_ = length + skew;
+    void* p = ::mmap(nullptr, mapping_size_, PROT_READ, MAP_SHARED, fd, start);
+    if (p == MAP_FAILED) {
+        mapping_ = nullptr;
+        fail("ResultBody: mmap");
+    }
+    mapping_ = p;
+    data_ = static_cast<const char*>(p) + skew;
+}
+
+void ResultBody::finish() {
+    const auto* begin = reinterpret_cast<const unsigned char*>(data_);
+    const auto* p = begin;
+    const auto* end = p + size_;
+    escaped_size_ = size_;
+    while (p < end) {
+        if (*p < 0x80) {
+            if (needs_escape(*p)) {
+                escapes_.push_back(static_cast<size_t>(p - begin));
+                escaped_size_ += escape_for(*p).size() - 1;
+            }
+            ++p;
+            continue;
+        }
+        const size_t n = utf8_length(p, end);
+        if (n == 0) {
+            escapes_.push_back(static_cast<size_t>(p - begin));
+            escaped_size_ += escape_for(*p).size() - 1;
+            ++p;
+            continue;
+        }
+        p += n;
+    }
+    escapes_.shrink_to_fit();
+}
+
+std::string_view ResultBody::escape_for(unsigned char c) {
+    static const EscapeTable table;
+    if (c >= 0x80) return "\xEF\xBF\xBD";
+    if (c >= 0x60 || table.length[c] == 0) return {};
+    return { table.text[c], table.length[c] };
+}
+
+std::string ResultBody::escaped() const {
+    std::string out;
+    out.reserve(escaped_size_);
+    size_t from = 0;
+    for (size_t at : escapes_) {
+        out.append(data_ + from, at - from);
+        out.append(escape_for(static_cast<unsigned char>(data_[at])));
+        from = at + 1;
+    }
+    out.append(data_ + from, size_ - from);
+    return out;
+}
+
+void set_result_body(std::shared_ptr<const ResultBody> body) {
+    t_body = std::move(body);
+}
+
+namespace detail {
+    std::shared_ptr<const ResultBody> take_result_body() {
+        return std::move(t_body);
+    }
+
+    ResultBodyScope::ResultBodyScope() : outer_(std::move(t_body)) {}
+
+    ResultBodyScope::~ResultBodyScope() {
+        t_body = std::move(outer_);
+    }
+} // namespace detail
+
+} // namespace lct
@@ -0,0 +1,260 @@
+#include "llama_cpp_tools/result_budget.h"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    // estimate_tokens(), one byte at a time.
+    struct TokenCounter {
+        size_t tokens = 0;
+        size_t run = 0;
+
+        size_t total() const { return tokens + (run + 3) / 4; }
+        void add(unsigned char c) {
+            if (std::isalnum(c) || c >= 0x80) { ++run; return; }
+            if (run) { tokens += (run + 3) / 4; run = 0; }
+            if (!std::isspace(c)) ++tokens;
+        }
+    };
+
+    struct PageFull {};
+
+    // Bytes `c` takes once the page is a JSON string ({"content": ...}).
+    inline size_t escaped_size(unsigned char c) {
+        switch (c) {
+            case '"': case '\\': case '\b': case '\f': case '\n': case '\r': case '\t': return 2;
+            default: return c < 0x20 ? 6 : 1;
+        }
+    }
+
+    inline void add_escaped(TokenCounter& tc, unsigned char c) {
+        static const char hex[] = "0123456789abcdef";
+        switch (c) {
+            case '"': case '\\': tc.add('\\'); tc.add(c); return;
+            case '\b': tc.add('\\'); tc.add('b'); return;
+            case '\f': tc.add('\\'); tc.add('f'); return;
+            case '\n': tc.add('\\'); tc.add('n'); return;
+            case '\r': tc.add('\\'); tc.add('r'); return;
+            case '\t': tc.add('\\'); tc.add('t'); return;
+            default: break;
+        }
+        if (c >= 0x20) { tc.add(c); return; }
+        for (char e : { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] }) tc.add(static_cast<unsigned char>(e));
+    }
+
+    // Keeps the bytes of [offset, offset + budget) of what is written to it
+    // and throws PageFull at the first byte past the budget. The budget is
+    // charged for the text as it reaches the prompt, i.e. JSON-escaped.
+    class PageWriter {
+    public:
+        PageWriter(ResultPage& page, size_t offset, const ResultBudget& budget)
+            : page_(page), skip_(offset), budget_(budget)
+        {
+            // A page always has room for one whole UTF-8 sequence or escape.
+            if (budget_.max_bytes) budget_.max_bytes = std::max<size_t>(budget_.max_bytes, 6);
+        }
+
+        void put(const char* s, size_t n) {
+            if (skip_ >= n) { skip_ -= n; return; }
+            s += skip_;
+            n -= skip_;
+            skip_ = 0;
+            std::string& text = page_.text;
+            for (size_t i = 0; i < n; ++i) {
+                const unsigned char c = static_cast<unsigned char>(s[i]);
+                const size_t cost = escaped_size(c);
+                if (budget_.max_bytes && used_ + cost > budget_.max_bytes) full();
+                if (budget_.max_tokens) {
+                    TokenCounter next = tokens_;
+                    add_escaped(next, c);
+                    if (next.total() > budget_.max_tokens && !text.empty()) full();
+                    tokens_ = next;
+                }
+                used_ += cost;
+                text.push_back(s[i]);
+            }
+        }
+
+    private:
+        [[noreturn]] void full() {
+            page_.more = true;
+            throw PageFull{};
+        }
+
+        ResultPage& page_;
+        size_t skip_;
+        ResultBudget budget_;
+        size_t used_ = 0;
+        TokenCounter tokens_;
+    };
+
+    // Feeds what the serializer writes to a PageWriter. PageFull escapes
+    // through the stream (badbit is set to rethrow it), which is what stops
+    // serialization at the budget.
+    class PageBuf : public std::streambuf {
+    public:
+        explicit PageBuf(PageWriter& w) : w_(w) {}
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+            const char ch = traits_type::to_char_type(c);
+            w_.put(&ch, 1);
+            return c;
+        }
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            w_.put(s, static_cast<size_t>(n));
+            return n;
+        }
+
+    private:
+        PageWriter& w_;
+    };
+
+    // Drops a UTF-8 sequence left incomplete at the end of `text`.
+    inline void trim_partial_sequence(std::string& text) {
+        size_t i = text.size();
+        while (i > 0 && text.size() - i < 4 && (static_cast<unsigned char>(text[i - 1]) & 0xC0) == 0x80) --i;
+        if (i == 0) return;
+        const unsigned char lead = static_cast<unsigned char>(text[i - 1]);
+        const size_t want = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+        if (text.size() - (i - 1) < want) text.resize(i - 1);
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+ResultBudget ResultBudget::combine(const ResultBudget& a, const ResultBudget& b) {
+    auto tighter = [](size_t x, size_t y) { return x == 0 ? y : y == 0 ? x : std::min(x, y); };
+    ResultBudget out;
+    out.max_bytes = tighter(a.max_bytes, b.max_bytes);
+    out.max_tokens = tighter(a.max_tokens, b.max_tokens);
+    return out;
+}
+
+ResultPage render_result_page(const json& value, size_t offset, const ResultBudget& budget) {
+    ResultPage page;
+    PageWriter writer(page, offset, budget);
+    try {
+        if (value.is_string()) {
+            const auto& s = value.get_ref<const std::string&>();
+            writer.put(s.data(), s.size());
+        } else {
+            PageBuf buf(writer);
+            std::ostream os(&buf);
+            os.exceptions(std::ios_base::badbit);
+            os << value;
+        }
+    } catch (const PageFull&) {
+        trim_partial_sequence(page.text);
+    } catch (const json::type_error&) {
+        // Invalid UTF-8, which operator<< rejects: page the replaced dump.
+        return render_text_page(value.dump(-1, ' ', false, json::error_handler_t::replace), offset, budget);
+    }
+    page.next_offset = offset + page.text.size();
+    return page;
+}
+
+ResultPage render_text_page(std::string_view text, size_t offset, const ResultBudget& budget) {
+    ResultPage page;
+    PageWriter writer(page, offset, budget);
+    try {
+        if (offset < text.size()) writer.put(text.data(), text.size());
+    } catch (const PageFull&) {
+        trim_partial_sequence(page.text);
+    }
+    page.next_offset = offset + page.text.size();
+    return page;
+}
+
+std::string ResultCursorStore::put(Entry entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string id = "cur_" + std::to_string(++next_id_);
+    entries_.emplace(id, std::move(entry));
+    order_.push_back(id);
+    while (entries_.size() > max_cursors_) {
+        entries_.erase(order_.front());
+        order_.pop_front();
+        ++evicted_;
+    }
+    return id;
+}
+
+std::optional<ResultCursorStore::Entry> ResultCursorStore::find(const std::string& cursor) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(cursor);
+    if (it == entries_.end()) return std::nullopt;
+    return it->second;
+}
+
+void ResultCursorStore::advance(const std::string& cursor, size_t offset, bool more,
+                                std::shared_ptr<const std::string> text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(cursor);
+    if (it == entries_.end()) return;
+    advance_locked(it, offset, more, std::move(text));
+}
+
+void ResultCursorStore::advance_locked(std::map<std::string, Entry>::iterator it, size_t offset, bool more,
+                                       std::shared_ptr<const std::string> text) {
+    if (more) {
+        it->second.offset = offset;
+        if (text && !it->second.text) it->second.text = std::move(text);
+        return;
+    }
+    order_.erase(std::find(order_.begin(), order_.end(), it->first));
+    entries_.erase(it);
+}
+
+void ResultCursorStore::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    order_.clear();
+}
+
+size_t ResultCursorStore::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+std::uint64_t ResultCursorStore::evicted() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return evicted_;
+}
+
+json ResultCursorStore::next_page(const std::string& cursor) {
+    // The page is cut outside the lock, then claimed by moving the offset on
+    // only if no other call moved it meanwhile; the loser cuts again.
+    while (true) {
+        auto entry = find(cursor);
+        if (!entry) throw std::runtime_error("unknown or expired cursor: " + cursor);
+        // Pages slice one text instead of re-serializing the value from byte 0:
+        // a string's own bytes, or the compact dump made on the first next_page.
+        const json& value = *entry->value;
+        if (!value.is_string() && !entry->text) {
+            entry->text = std::make_shared<const std::string>(value.dump(-1, ' ', false, json::error_handler_t::replace));
+        }
+        const std::string_view text = value.is_string() ? std::string_view(value.get_ref<const std::string&>())
+                                                        : std::string_view(*entry->text);
+        ResultPage page = render_text_page(text, entry->offset, entry->budget);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(cursor);
+            if (it == entries_.end() || it->second.offset != entry->offset) continue;
+            advance_locked(it, page.next_offset, page.more, entry->text);
+        }
+        json out = {{"content", std::move(page.text)}};
+        if (page.more) out["next_cursor"] = cursor;
+        return out;
+    }
+}
+
+} // namespace lct
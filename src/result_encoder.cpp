@@ -0,0 +1,125 @@
+#include "llama_cpp_tools/result_encoder.h"
+#include "llama_cpp_tools/schema_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    inline bool is_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v'; }
+
+    struct Encoder {
+        const ResultEncodeOptions& opts;
+        ResultEncodeReport& rep;
+
+        json encode(const json& v) {
+            switch (v.type()) {
+                case json::value_t::object: {
+                    json out = json::object();
+                    for (auto it = v.begin(); it != v.end(); ++it) {
+                        if (opts.strip_nulls && it->is_null()) { ++rep.stripped_nulls; continue; }
+                        out[it.key()] = encode(*it);
+                    }
+                    return out;
+                }
+                case json::value_t::array: {
+                    json out = json::array();
+                    for (const auto& e : v) out.push_back(encode(e));
+                    if (opts.tabular) tabulate(out);
+                    return out;
+                }
+                case json::value_t::number_float:
+                    return round(v.get<double>());
+                case json::value_t::string:
+                    return opts.trim_strings ? trim(v.get_ref<const std::string&>()) : v;
+                default:
+                    return v;
+            }
+        }
+
+        json round(double d) {
+            if (opts.float_digits < 0 || !std::isfinite(d)) return d;
+            char buf[40];
+            std::snprintf(buf, sizeof buf, "%.*g", std::clamp(opts.float_digits, 1, 17), d);
+            const double r = std::strtod(buf, nullptr);
+            if (r != d) ++rep.rounded_floats;
+            return r;
+        }
+
+        static json trim(const std::string& s) {
+            size_t b = 0, e = s.size();
+            while (b < e && is_space(s[b])) ++b;
+            while (e > b && is_space(s[e - 1])) --e;
+            if (b == 0 && e == s.size()) return s;
+            return s.substr(b, e - b);
+        }
+
+        // Rewrites an array of objects as columns + rows if that is shorter:
+        // each row saves its keys ("key": per present cell) and pays "null,"
+        // per missing one; the header costs every key once plus the wrapper.
+        void tabulate(json& arr) {
+            if (arr.size() < std::max<size_t>(opts.min_rows, 1)) return;
+            std::vector<std::string> columns;
+            std::set<std::string> seen;
+            long long key_bytes = 0;
+            size_t present = 0;
+            for (const auto& row : arr) {
+                if (!row.is_object() || row.empty()) return;
+                for (auto it = row.begin(); it != row.end(); ++it) {
+                    key_bytes += static_cast<long long>(it.key().size()) + 3;
+                    ++present;
+                    if (seen.insert(it.key()).second) columns.push_back(it.key());
+                }
+            }
+            long long header = 22;    // {"columns":[],"rows":}
+            for (const auto& c : columns) header += static_cast<long long>(c.size()) + 3;
+            const long long missing = static_cast<long long>(arr.size() * columns.size() - present);
+            if (key_bytes - missing * 5 - header <= 0) return;
+
+            json rows = json::array();
+            for (const auto& row : arr) {
+                json cells = json::array();
+                for (const auto& c : columns) {
+                    auto it = row.find(c);
+                    cells.push_back(it == row.end() ? json() : *it);
+                }
+                rows.push_back(std::move(cells));
+            }
+            json table = json::object();
+            table["columns"] = columns;
+            table["rows"] = std::move(rows);
+            arr = std::move(table);
+            ++rep.tables;
+        }
+    };
+} // namespace
+
+
+// ---------- implementations ----------
+
+json encode_result(const json& result, const ResultEncodeOptions& opts, ResultEncodeReport* report) {
+    ResultEncodeReport local;
+    ResultEncodeReport& rep = report ? *report : local;
+    rep = ResultEncodeReport();
+
+    const std::string original = result.dump();
+    rep.original_bytes = original.size();
+    rep.original_tokens = estimate_tokens(original);
+
+    Encoder e{ opts, rep };
+    json out = e.encode(result);
+
+    const std::string encoded = out.dump();
+    rep.encoded_bytes = encoded.size();
+    rep.encoded_tokens = estimate_tokens(encoded);
+    return out;
+}
+
+} // namespace lct
@@ -0,0 +1,208 @@
+#include "llama_cpp_tools/schema_optimizer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    // Keywords whose value can hold a single sub-schema / a list / a map of them.
+    const char* const schema_keys[] = { "items", "additionalProperties", "not", "contains",
+                                        "if", "then", "else", "propertyNames" };
+    const char* const schema_list_keys[] = { "anyOf", "oneOf", "allOf", "prefixItems" };
+    const char* const schema_map_keys[] = { "properties", "patternProperties", "$defs", "definitions" };
+
+    std::string normalize(const std::string& s) {
+        std::string out;
+        for (char c : s) {
+            if (std::isalnum(static_cast<unsigned char>(c))) out.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+        return out;
+    }
+
+    bool is_noop(const std::string& key, const json& v, const std::string& prop_name) {
+        if (key == "$comment" || key == "$schema") return true;
+        if (key == "required" || key == "examples") return v.is_array() && v.empty();
+        if (key == "properties") return v.is_object() && v.empty();
+        if (key == "additionalProperties") return v.is_boolean() && v.get<bool>();
+        if (key == "default") return v.is_null();
+        if (key == "description") return v.is_string() && v.get<std::string>().empty();
+        if (key == "title") return v.is_string() && !prop_name.empty() && normalize(v.get<std::string>()) == normalize(prop_name);
+        if (key == "minItems" || key == "minLength" || key == "minProperties") return v.is_number_integer() && v.get<long long>() == 0;
+        if (key == "uniqueItems" || key == "deprecated" || key == "readOnly" || key == "writeOnly" || key == "nullable")
+            return v.is_boolean() && !v.get<bool>();
+        return false;
+    }
+
+    bool truncate_description(std::string& s, size_t max) {
+        if (max == 0 || s.size() <= max) return false;
+        size_t cut = max >= 3 ? max - 3 : 0;
+        // Back up to a word boundary, and never split a UTF-8 sequence.
+        size_t space = s.rfind(' ', cut);
+        if (space != std::string::npos && space > cut / 2) cut = space;
+        while (cut > 0 && (static_cast<unsigned char>(s[cut]) & 0xC0) == 0x80) --cut;
+        s.resize(cut);
+        while (!s.empty() && s.back() == ' ') s.pop_back();
+        s += "...";
+        return true;
+    }
+
+    // Visits every sub-schema position below `node` (not `node` itself).
+    // `hint` is a name for the position: the property key, or parent + "_item".
+    template <typename Fn>
+    void for_each_subschema(json& node, const std::string& hint, Fn&& fn) {
+        if (!node.is_object()) return;
+        for (const char* k : schema_keys) {
+            auto it = node.find(k);
+            if (it != node.end() && it->is_object()) fn(*it, hint + "_item");
+        }
+        for (const char* k : schema_list_keys) {
+            auto it = node.find(k);
+            if (it != node.end() && it->is_array()) {
+                for (auto& e : *it) if (e.is_object()) fn(e, hint + "_variant");
+            }
+        }
+        for (const char* k : schema_map_keys) {
+            if (std::string(k) == "$defs" || std::string(k) == "definitions") continue;
+            auto it = node.find(k);
+            if (it != node.end() && it->is_object()) {
+                for (auto p = it->begin(); p != it->end(); ++p) if (p->is_object()) fn(*p, p.key());
+            }
+        }
+    }
+
+    // A $defs name built from a property name. Only [A-Za-z0-9_.-] is kept
+    // (anything else becomes '_'), so "#/$defs/<name>" is a valid JSON
+    // pointer and URI fragment without escaping '~', '/' or '%'.
+    std::string def_name(const std::string& hint) {
+        std::string out = hint;
+        for (char& c : out) {
+            const unsigned char u = static_cast<unsigned char>(c);
+            if (!(std::isalnum(u) && u < 0x80) && c != '_' && c != '.' && c != '-') c = '_';
+        }
+        return out.empty() ? "def" : out;
+    }
+
+    struct Optimizer {
+        const SchemaOptimizeOptions& opts;
+        SchemaOptimizationReport& rep;
+
+        void clean(json& node, const std::string& prop_name) {
+            if (!node.is_object()) return;
+            if (opts.drop_noop_keywords) {
+                for (auto it = node.begin(); it != node.end();) {
+                    if (is_noop(it.key(), it.value(), prop_name)) { it = node.erase(it); ++rep.dropped_keywords; }
+                    else ++it;
+                }
+            }
+            auto d = node.find("description");
+            if (d != node.end() && d->is_string()) {
+                std::string s = d->get<std::string>();
+                if (truncate_description(s, opts.max_description_bytes)) { *d = s; ++rep.truncated_descriptions; }
+            }
+            for_each_subschema(node, prop_name, [&](json& child, const std::string& name) { clean(child, name); });
+            for (const char* k : { "$defs", "definitions" }) {
+                auto it = node.find(k);
+                if (it != node.end() && it->is_object()) for (auto p = it->begin(); p != it->end(); ++p) clean(*p, p.key());
+            }
+        }
+
+        // Repeatedly hoist the repeated sub-schema that saves the most bytes.
+        void hoist(json& params) {
+            std::set<std::string> used_names;
+            if (params.contains("$defs") && params["$defs"].is_object()) {
+                for (auto p = params["$defs"].begin(); p != params["$defs"].end(); ++p) used_names.insert(p.key());
+            }
+            while (true) {
+                std::map<std::string, std::pair<size_t, std::string>> seen;   // dump -> (count, first hint)
+                std::function<void(json&, const std::string&)> count = [&](json& n, const std::string& hint) {
+                    const std::string key = n.dump();
+                    auto& e = seen[key];
+                    if (e.first++ == 0) e.second = hint;
+                    for_each_subschema(n, hint, count);
+                };
+                for_each_subschema(params, "def", count);
+
+                std::string best;
+                long best_saving = 0;
+                std::string best_hint;
+                for (const auto& [dump, e] : seen) {
+                    if (e.first < 2 || dump.size() < opts.min_hoist_bytes) continue;
+                    const long ref_cost = static_cast<long>(std::string(R"({"$ref":"#/$defs/"})").size() + e.second.size());
+                    const long saving = static_cast<long>((e.first - 1) * dump.size()) - static_cast<long>(e.first) * ref_cost
+                                      - static_cast<long>(e.second.size()) - 4;
+                    if (saving > best_saving) { best_saving = saving; best = dump; best_hint = e.second; }
+                }
+                if (best.empty()) return;
+
+                const std::string base = def_name(best_hint);
+                std::string name = base;
+                for (int i = 2; used_names.count(name); ++i) name = base + "_" + std::to_string(i);
+                used_names.insert(name);
+
+                const json ref = { {"$ref", "#/$defs/" + name} };
+                std::function<void(json&, const std::string&)> replace = [&](json& n, const std::string& hint) {
+                    if (n.dump() == best) { n = ref; return; }
+                    for_each_subschema(n, hint, replace);
+                };
+                json def = json::parse(best);
+                for_each_subschema(params, "def", replace);
+                params["$defs"][name] = std::move(def);
+                ++rep.hoisted_definitions;
+            }
+        }
+    };
+} // namespace
+
+
+// ---------- implementations ----------
+
+size_t estimate_tokens(const std::string& text) {
+    size_t tokens = 0;
+    size_t run = 0;
+    for (char raw : text) {
+        const unsigned char c = static_cast<unsigned char>(raw);
+        if (std::isalnum(c) || c >= 0x80) { ++run; continue; }
+        if (run) { tokens += (run + 3) / 4; run = 0; }
+        if (!std::isspace(c)) ++tokens;
+    }
+    if (run) tokens += (run + 3) / 4;
+    return tokens;
+}
+
+json optimize_schema(const json& schema, const SchemaOptimizeOptions& opts, SchemaOptimizationReport* report) {
+    SchemaOptimizationReport local;
+    SchemaOptimizationReport& rep = report ? *report : local;
+    rep = SchemaOptimizationReport();
+
+    const std::string original = schema.dump();
+    rep.original_bytes = original.size();
+    rep.original_tokens = estimate_tokens(original);
+
+    json out = schema;
+    Optimizer o{ opts, rep };
+    if (out.is_object()) {
+        auto d = out.find("description");
+        if (d != out.end() && d->is_string()) {
+            std::string s = d->get<std::string>();
+            if (truncate_description(s, opts.max_description_bytes)) { *d = s; ++rep.truncated_descriptions; }
+        }
+        auto p = out.find("parameters");
+        if (p != out.end() && p->is_object()) {
+            o.clean(*p, "");
+            if (opts.hoist_shared_definitions) o.hoist(*p);
+        }
+    }
+
+    const std::string optimized = out.dump();
+    rep.optimized_bytes = optimized.size();
+    rep.optimized_tokens = estimate_tokens(optimized);
+    return out;
+}
+
+} // namespace lct
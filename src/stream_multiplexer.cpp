@@ -0,0 +1,317 @@
+#include "llama_cpp_tools/stream_multiplexer.h"
+
+#include <atomic>
+#include <cerrno>
+#include <deque>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace lct {
+
+// ---------- internals ----------
+
+class StreamMultiplexer::WorkerPool {
+public:
+    explicit WorkerPool(size_t n) {
+        threads_.reserve(n);
+        for (size_t i = 0; i < n; ++i) threads_.emplace_back([this] { loop(); });
+    }
+
+    // Drains queued tasks, then joins.
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    void post(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void loop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
+
+struct StreamMultiplexer::Reactor {
+    int epfd = -1;
+    int wakefd = -1;    // eventfd; readable means "stop"
+    std::vector<char> buf;
+    std::thread thread;
+};
+
+struct StreamMultiplexer::Stream {
+    std::uint64_t id = 0;
+    int fd = -1;
+    Reactor* reactor = nullptr;
+    ResultCallback on_result;
+    CloseCallback on_close;
+    std::mutex deliver_mutex;
+    // Batches waiting for the one running on the pool; run_next() posts the
+    // next one only when the current one is done, so they run in order.
+    std::mutex queue_mutex;
+    std::deque<std::function<void()>> queue;
+    bool running = false;
+    std::atomic<int> refs{1};   // the reader's reference, plus one per queued batch
+    bool reading = true;        // the reader still owns fd (and its reference); reactor thread only
+    int error = 0;
+    std::unique_ptr<ToolRegistry::StreamSession> session;
+};
+
+namespace {
+    [[noreturn]] void throw_errno(const char* what) {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+StreamMultiplexer::StreamMultiplexer(const ToolRegistry& reg)
+    : StreamMultiplexer(reg, Options())
+{
+}
+
+StreamMultiplexer::StreamMultiplexer(const ToolRegistry& reg, Options opts)
+    : reg_(reg), opts_(opts)
+{
+    if (opts_.reactor_threads == 0) opts_.reactor_threads = 1;
+    if (opts_.read_chunk_bytes == 0) opts_.read_chunk_bytes = 16 * 1024;
+    if (opts_.worker_threads > 0) pool_ = std::make_unique<WorkerPool>(opts_.worker_threads);
+
+    for (size_t i = 0; i < opts_.reactor_threads; ++i) {
+        auto r = std::make_unique<Reactor>();
+        r->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (r->epfd < 0) throw_errno("epoll_create1");
+        r->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (r->wakefd < 0) {
+            close(r->epfd);
+            throw_errno("eventfd");
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) < 0) {
+            const int err = errno;
+            close(r->wakefd);
+            close(r->epfd);
+            errno = err;
+            throw_errno("epoll_ctl(EPOLL_CTL_ADD)");
+        }
+        r->buf.resize(opts_.read_chunk_bytes);
+        reactors_.push_back(std::move(r));
+    }
+    for (auto& r : reactors_) {
+        Reactor* raw = r.get();
+        raw->thread = std::thread([this, raw] { run_reactor(*raw); });
+    }
+}
+
+StreamMultiplexer::~StreamMultiplexer() {
+    for (auto& r : reactors_) {
+        std::uint64_t one = 1;
+        (void)!write(r->wakefd, &one, sizeof(one));
+    }
+    for (auto& r : reactors_) r->thread.join();
+
+    // Streams still being read are cancelled: stop reading, let queued
+    // batches finish, then report ECANCELED. Streams that already hit EOF or
+    // an error only wait for their batches; their fd is closed already.
+    std::vector<std::shared_ptr<Stream>> open;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& [id, s] : streams_) {
+            if (s->reading) open.push_back(s);
+        }
+    }
+    for (auto& s : open) {
+        close(s->fd);
+        s->error = ECANCELED;
+    }
+    pool_.reset();
+    for (auto& s : open) release(s);
+
+    for (auto& r : reactors_) {
+        close(r->wakefd);
+        close(r->epfd);
+    }
+}
+
+std::uint64_t StreamMultiplexer::add_stream(int fd, ResultCallback on_result, CloseCallback on_close) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        throw_errno("fcntl(O_NONBLOCK)");
+    }
+
+    auto s = std::make_shared<Stream>();
+    s->fd = fd;
+    s->on_result = std::move(on_result);
+    s->on_close = std::move(on_close);
+
+    Stream* raw = s.get();
+    auto deliver = [raw](const ToolRegistry::ExecutionResult& r) {
+        std::lock_guard<std::mutex> lock(raw->deliver_mutex);
+        if (raw->on_result) raw->on_result(r);
+    };
+    TaskExecutor executor;
+    if (pool_) {
+        // Each queued batch pins the stream until it has delivered its results.
+        executor = [this, raw](std::function<void()> task) {
+            raw->refs.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(raw->queue_mutex);
+                raw->queue.push_back(std::move(task));
+                if (raw->running) return;
+                raw->running = true;
+            }
+            pool_->post([this, raw] { run_next(raw); });
+        };
+    }
+    s->session = std::make_unique<ToolRegistry::StreamSession>(reg_, deliver, opts_.concurrent, std::move(executor));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s->id = next_id_++;
+        s->reactor = reactors_[s->id % reactors_.size()].get();
+        streams_.emplace(s->id, s);
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = raw;
+    if (epoll_ctl(s->reactor->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        const int err = errno;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            streams_.erase(s->id);
+        }
+        close(fd);      // ours since the call
+        errno = err;
+        throw_errno("epoll_ctl(EPOLL_CTL_ADD)");
+    }
+    return s->id;
+}
+
+size_t StreamMultiplexer::active_streams() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_.size();
+}
+
+void StreamMultiplexer::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return streams_.empty(); });
+}
+
+void StreamMultiplexer::run_reactor(Reactor& r) {
+    epoll_event events[128];
+    while (true) {
+        int n = epoll_wait(r.epfd, events, 128, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (!events[i].data.ptr) return;  // woken up to stop
+            Stream* raw = static_cast<Stream*>(events[i].data.ptr);
+            std::shared_ptr<Stream> s;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                s = streams_.at(raw->id);
+            }
+            on_readable(r, s);
+        }
+    }
+}
+
+void StreamMultiplexer::on_readable(Reactor& r, const std::shared_ptr<Stream>& s) {
+    // Level-triggered: one read per wakeup keeps a firehose stream from
+    // starving its neighbours; epoll reports it again if more is pending.
+    ssize_t n;
+    do {
+        n = read(s->fd, r.buf.data(), r.buf.size());
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        s->session->feed(r.buf.data(), static_cast<size_t>(n));
+        return;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+    if (n < 0) s->error = errno;
+    epoll_ctl(r.epfd, EPOLL_CTL_DEL, s->fd, nullptr);
+    s->reading = false;
+    close(s->fd);
+    if (n == 0) s->session->finish();
+    release(s);
+}
+
+void StreamMultiplexer::run_next(Stream* raw) {
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock(raw->queue_mutex);
+        task = std::move(raw->queue.front());
+        raw->queue.pop_front();
+    }
+    try { task(); } catch (...) { /* a throwing on_result must not kill the pool */ }
+
+    // Back of the pool queue rather than straight on, so a busy stream
+    // takes turns with the others.
+    bool more;
+    {
+        std::lock_guard<std::mutex> lock(raw->queue_mutex);
+        more = !raw->queue.empty();
+        raw->running = more;
+    }
+    if (more) pool_->post([this, raw] { run_next(raw); });
+
+    std::shared_ptr<Stream> self;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        self = streams_.at(raw->id);
+    }
+    release(self);
+}
+
+void StreamMultiplexer::release(const std::shared_ptr<Stream>& s) {
+    if (s->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+    if (s->on_close) {
+        try { s->on_close(s->error); } catch (...) {}
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    streams_.erase(s->id);
+    if (streams_.empty()) idle_cv_.notify_all();
+}
+
+} // namespace lct
@@ -0,0 +1,160 @@
+#include "llama_cpp_tools/tool_index.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    // BM25 parameters and field weights.
+    constexpr float k1 = 1.2f;
+    constexpr float b = 0.75f;
+    constexpr float name_weight = 3.0f;
+    constexpr float param_weight = 2.0f;
+    constexpr float text_weight = 1.0f;
+    // Trigrams catch fragments and typos but must not outvote whole words.
+    constexpr float trigram_weight = 0.25f;
+    constexpr char trigram_tag = '\x01';
+
+    // Lowercased words, split on non-alphanumerics and lower->Upper edges.
+    template <typename OnWord>
+    void for_each_word(const std::string& text, OnWord&& on_word) {
+        std::string word;
+        char prev = 0;
+        for (char raw : text) {
+            const unsigned char c = static_cast<unsigned char>(raw);
+            if (!std::isalnum(c)) {
+                if (!word.empty()) { on_word(word); word.clear(); }
+                prev = 0;
+                continue;
+            }
+            if (std::isupper(c) && prev && std::islower(static_cast<unsigned char>(prev)) && !word.empty()) {
+                on_word(word);
+                word.clear();
+            }
+            word.push_back(static_cast<char>(std::tolower(c)));
+            prev = raw;
+        }
+        if (!word.empty()) on_word(word);
+    }
+
+    // "#word#" trigrams, tagged so they never collide with word terms.
+    template <typename OnGram>
+    void for_each_trigram(const std::string& word, OnGram&& on_gram) {
+        std::string padded = "#" + word + "#";
+        std::string gram(4, trigram_tag);
+        for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+            gram.replace(1, 3, padded, i, 3);
+            on_gram(gram);
+        }
+    }
+
+    void collect_params(const json& schema, std::string& names, std::string& text) {
+        if (!schema.is_object()) return;
+        auto props = schema.find("properties");
+        if (props != schema.end() && props->is_object()) {
+            for (auto it = props->begin(); it != props->end(); ++it) {
+                names += it.key();
+                names += ' ';
+                if (it.value().is_object()) {
+                    auto d = it.value().find("description");
+                    if (d != it.value().end() && d->is_string()) { text += d->get<std::string>(); text += ' '; }
+                    collect_params(it.value(), names, text);
+                }
+            }
+        }
+        auto items = schema.find("items");
+        if (items != schema.end()) collect_params(*items, names, text);
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+ToolIndex::TermId ToolIndex::intern(const std::string& term) {
+    auto it = terms_.find(term);
+    if (it != terms_.end()) return it->second;
+    const TermId id = static_cast<TermId>(postings_.size());
+    terms_.emplace(term, id);
+    postings_.emplace_back();
+    return id;
+}
+
+void ToolIndex::add_terms(const std::string& text, float weight, std::unordered_map<TermId, float>& tf) {
+    for_each_word(text, [&](const std::string& w) {
+        tf[intern(w)] += weight;
+        for_each_trigram(w, [&](const std::string& g) { tf[intern(g)] += weight * trigram_weight; });
+    });
+}
+
+void ToolIndex::add(const std::string& name, const json& schema) {
+    std::unordered_map<TermId, float> tf;
+    add_terms(name, name_weight, tf);
+    if (schema.is_object()) {
+        auto d = schema.find("description");
+        if (d != schema.end() && d->is_string()) add_terms(d->get<std::string>(), text_weight, tf);
+        auto p = schema.find("parameters");
+        if (p != schema.end()) {
+            std::string param_names, param_text;
+            collect_params(*p, param_names, param_text);
+            add_terms(param_names, param_weight, tf);
+            add_terms(param_text, text_weight, tf);
+        }
+    }
+
+    const auto doc = static_cast<std::uint32_t>(names_.size());
+    float len = 0;
+    for (const auto& [term, f] : tf) {
+        postings_[term].push_back(Posting{ doc, f });
+        len += f;
+    }
+    names_.push_back(name);
+    doc_len_.push_back(len);
+    total_len_ += len;
+}
+
+std::vector<ToolIndex::Hit> ToolIndex::query(const std::string& text, size_t k) const {
+    std::vector<Hit> hits;
+    if (k == 0 || names_.empty()) return hits;
+
+    // Query terms with their weights; unknown terms can't score.
+    std::unordered_map<TermId, float> qtf;
+    for_each_word(text, [&](const std::string& w) {
+        auto it = terms_.find(w);
+        if (it != terms_.end()) qtf[it->second] += 1.0f;
+        for_each_trigram(w, [&](const std::string& g) {
+            auto gt = terms_.find(g);
+            if (gt != terms_.end()) qtf[gt->second] += trigram_weight;
+        });
+    });
+
+    const float n = static_cast<float>(names_.size());
+    const float avgdl = static_cast<float>(total_len_ / names_.size());
+    std::vector<float> score(names_.size(), 0.0f);
+    std::vector<std::uint32_t> touched;
+
+    for (const auto& [term, qw] : qtf) {
+        const auto& plist = postings_[term];
+        const float df = static_cast<float>(plist.size());
+        const float idf = std::log(1.0f + (n - df + 0.5f) / (df + 0.5f));
+        for (const auto& p : plist) {
+            const float norm = k1 * (1.0f - b + b * doc_len_[p.doc] / avgdl);
+            if (score[p.doc] == 0.0f) touched.push_back(p.doc);
+            score[p.doc] += qw * idf * (p.tf * (k1 + 1.0f)) / (p.tf + norm);
+        }
+    }
+
+    auto better = [&](std::uint32_t a, std::uint32_t c) {
+        return score[a] != score[c] ? score[a] > score[c] : a < c;
+    };
+    const size_t top = std::min(k, touched.size());
+    std::partial_sort(touched.begin(), touched.begin() + static_cast<std::ptrdiff_t>(top), touched.end(), better);
+
+    hits.reserve(top);
+    for (size_t i = 0; i < top; ++i) hits.push_back(Hit{ touched[i], names_[touched[i]], score[touched[i]] });
+    return hits;
+}
+
+} // namespace lct
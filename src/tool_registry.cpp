@@ -1,16 +1,125 @@
 #include "llama_cpp_tools/tool_registry.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <future>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <thread>
 
 namespace lct {
 
-json ToolRegistry::invoke_concurrent(const std::string& name, const json& args) const {
+json ToolRegistry::invoke(const std::string& name, const json& args) const {
+    const detail::ResultBodyScope outer;
+    json result = invoke_measured(name, args, {}, 0, 0, nullptr);
+    detail::take_result_body();     // no ExecutionResult to carry it
+    return result;
+}
+
+json ToolRegistry::invoke_measured(const std::string& name, const json& args, std::string_view call_id,
+                                   std::uint64_t queue_ns, std::uint64_t serialize_ns, std::uint64_t* exec_ns) const {
     auto it = tools_.find(name);
     if (it == tools_.end()) throw std::runtime_error("Tool not found: " + name);
-    auto fut = std::async(std::launch::async, it->second, args);
+    trace(TracePoint::handler_begin, name, call_id);
+    const auto start = std::chrono::steady_clock::now();
+    auto took = [&] {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        if (exec_ns) *exec_ns = static_cast<std::uint64_t>(ns);
+        return static_cast<std::uint64_t>(ns);
+    };
+    try {
+        json result = it->second(args);
+        metrics_->record(name, queue_ns, took(), serialize_ns, false);
+        trace(TracePoint::handler_end, name, call_id, 0);
+        return result;
+    } catch (...) {
+        detail::take_result_body();
+        metrics_->record(name, queue_ns, took(), serialize_ns, true);
+        trace(TracePoint::handler_end, name, call_id, 1);
+        throw;
+    }
+}
+
+void ToolRegistry::route_tool(const std::string& name, ToolHandler route) {
+    auto it = tools_.find(name);
+    if (it == tools_.end()) throw std::runtime_error("Tool not found: " + name);
+    local_handlers_.emplace(name, std::move(it->second));   // keeps the first original on re-routing
+    it->second = std::move(route);
+}
+
+json ToolRegistry::invoke_local(const std::string& name, const json& args) const {
+    auto local = local_handlers_.find(name);
+    if (local != local_handlers_.end()) return local->second(args);
+    auto it = tools_.find(name);
+    if (it == tools_.end()) throw std::runtime_error("Tool not found: " + name);
+    return it->second(args);
+}
+
+json ToolRegistry::invoke_concurrent(const std::string& name, const json& args) const {
+    auto fut = std::async(std::launch::async, [this, name, args]() { return invoke(name, args); });
     return fut.get();
 }
 
+// Pinned tools (deduplicated, registered ones only), then the rest in
+// registration order.
+template <typename Fn>
+void ToolRegistry::for_each_stable(Fn&& fn) const {
+    std::set<std::string> pinned;
+    for (const auto& name : pinned_) {
+        if (schemas_.count(name) && pinned.insert(name).second) fn(name);
+    }
+    for (const auto& name : order_) {
+        if (!pinned.count(name)) fn(name);
+    }
+}
+
+json ToolRegistry::tools_for_openai(ToolOrder order) const {
+    if (order == ToolOrder::by_name) return tools_for_openai();
+    json arr = json::array();
+    for_each_stable([&](const std::string& name) { arr.push_back(schemas_.at(name)); });
+    return arr;
+}
+
+std::string ToolRegistry::tools_for_openai_string(ToolOrder order, PrefixReport* report) const {
+    std::string out;
+    if (order == ToolOrder::by_name) {
+        out = tools_for_openai_string();
+    } else {
+        size_t total = 2;
+        for (const auto& [name, bytes] : schema_bytes_) total += bytes.size() + 1;
+        out.reserve(total);
+        out.push_back('[');
+        for_each_stable([&](const std::string& name) {
+            if (out.size() > 1) out.push_back(',');
+            out.append(schema_bytes_.at(name));
+        });
+        out.push_back(']');
+    }
+
+    std::lock_guard<std::mutex> lock(stats_.mutex);
+    if (report) {
+        const std::string& prev = stats_.last_stable_payload;
+        const auto mismatch = std::mismatch(prev.begin(), prev.end(), out.begin(), out.end());
+        report->previous_bytes = prev.size();
+        report->current_bytes = out.size();
+        report->common_prefix_bytes = static_cast<size_t>(mismatch.first - prev.begin());
+        report->reuse_ratio = out.empty() ? 0.0 : double(report->common_prefix_bytes) / double(out.size());
+    }
+    stats_.last_stable_payload = out;
+    return out;
+}
+
+json ToolRegistry::tools_for_query(const std::string& user_text, size_t k) const {
+    json arr = json::array();
+    for (const auto& hit : index_.query(user_text, k)) {
+        arr.push_back(schemas_.at(hit.name));
+    }
+    return arr;
+}
+
 json ToolRegistry::handle_tool_call_response(const json& api_response) const {
     json entries = api_response;
     if (api_response.is_object()) {
@@ -47,29 +156,52 @@ ToolRegistry& global_registry() {
 
 // ---------- helpers (anonymous namespace) ----------
 namespace {
+    // The discovery helpers below are templates over the DOM type so that a
+    // response parsed into an Arena (arena_json) is walked without copying.
+    inline std::string std_string(const std::string& s) { return s; }
+
+    template <typename Alloc>
+    inline std::string std_string(const std::basic_string<char, std::char_traits<char>, Alloc>& s) {
+        return std::string(s.data(), s.size());
+    }
+
     // Parse "arguments" which may be a JSON string or already a JSON value.
-    inline json parse_function_arguments(const json& func) {
+    template <typename J>
+    inline json parse_function_arguments(const J& func) {
         if (!func.contains("arguments")) return json::object();
         const auto& a = func["arguments"];
         if (a.is_string()) {
-            try { return json::parse(a.get<std::string>()); }
+            const auto& text = a.template get_ref<const typename J::string_t&>();
+            try { return json::parse(text.begin(), text.end()); }
             catch (...) { return json::object(); }
         }
-        if (a.is_object() || a.is_array()) return a;
+        if (a.is_object() || a.is_array()) return json(a);
         return json::object();
     }
 
+    template <typename J>
+    inline ToolCall make_call(std::string id, std::string name, const J& func) {
+        const auto start = std::chrono::steady_clock::now();
+        ToolCall call{ std::move(id), std::move(name), parse_function_arguments(func) };
+        call.ready = std::chrono::steady_clock::now();
+        call.decode_ns = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(call.ready - start).count());
+        return call;
+    }
+
     // Collect tool calls from a response object (supports OpenAI-style fields).
-    inline void collect_tool_calls_from_node(const json& node,
-                                             std::vector<std::pair<std::string, json>>& out)
+    template <typename J>
+    inline void collect_tool_calls_from_node(const J& node, std::vector<ToolCall>& out)
     {
-        // Newer OpenAI: message.tool_calls:[{type:"function", function:{name,arguments}}]
+        // Newer OpenAI: message.tool_calls:[{id, type:"function", function:{name,arguments}}]
         if (node.contains("tool_calls") && node["tool_calls"].is_array()) {
             for (const auto& tc : node["tool_calls"]) {
-                const json& func = tc.contains("function") ? tc["function"] : tc;
-                std::string name = func.value("name", "");
+                const J& func = tc.contains("function") ? tc["function"] : tc;
+                std::string name = std_string(func.value("name", ""));
                 if (!name.empty()) {
-                    out.emplace_back(name, parse_function_arguments(func));
+                    std::string id = (tc.contains("id") && tc["id"].is_string())
+                        ? std_string(tc["id"].template get_ref<const typename J::string_t&>()) : "";
+                    out.push_back(make_call(std::move(id), std::move(name), func));
                 }
             }
         }
@@ -77,15 +209,16 @@ namespace {
         // Older OpenAI: message.function_call:{name, arguments}
         if (node.contains("function_call") && node["function_call"].is_object()) {
             const auto& fc = node["function_call"];
-            std::string name = fc.value("name", "");
+            std::string name = std_string(fc.value("name", ""));
             if (!name.empty()) {
-                out.emplace_back(name, parse_function_arguments(fc));
+                out.push_back(make_call("", std::move(name), fc));
             }
         }
     }
 
     // Extract the logical "message-like" node from a choice-ish entry.
-    inline const json& pick_message_like(const json& choice_or_msg) {
+    template <typename J>
+    inline const J& pick_message_like(const J& choice_or_msg) {
         if (choice_or_msg.is_object()) {
             if (choice_or_msg.contains("message")) return choice_or_msg["message"];
             if (choice_or_msg.contains("delta"))   return choice_or_msg["delta"];
@@ -95,7 +228,8 @@ namespace {
 
     // Robust, string/escape-aware extractor of complete top-level JSON values.
     // Pulls full objects or arrays from 'buffer' and erases consumed text.
-    inline std::vector<std::string> extract_complete_json_values(std::string& buffer) {
+    // `skipped` accumulates the bytes dropped in front of each extracted value.
+    inline std::vector<std::string> extract_complete_json_values(std::string& buffer, std::uint64_t& skipped) {
         std::vector<std::string> out;
         size_t i = 0;
         while (i < buffer.size()) {
@@ -128,6 +262,7 @@ namespace {
                             // complete JSON value [start..i]
                             size_t end = i + 1;
                             out.emplace_back(buffer.substr(start, end - start));
+                            skipped += start;
                             buffer.erase(0, end);  // drop consumed prefix
                             i = 0;                 // restart scanning from beginning
                             break;
@@ -143,67 +278,376 @@ namespace {
         return out;
     }
 
+    // Incremental scanner that reports a tool call's name as soon as the
+    // value's closing quote arrives, so a tool can be identified long before
+    // the enclosing JSON value is complete. Only the `name` of a `function`
+    // or `function_call` object (or of a `tool_calls` entry itself) counts;
+    // a "name" key nested in inline-object arguments does not. State survives
+    // across chunks; keys inside string-encoded arguments are never seen.
+    class NameSniffer {
+    public:
+        template <typename OnName>
+        void feed(const char* data, size_t size, OnName&& on_name) {
+            for (size_t i = 0; i < size; ++i) {
+                const char c = data[i];
+                if (in_string_) {
+                    if (escape_) { escape_ = false; push(c); continue; }
+                    if (c == '\\') { escape_ = true; continue; }
+                    if (c != '"') { push(c); continue; }
+                    in_string_ = false;
+                    if (stack_.empty() || !stack_.back().object) continue;
+                    Frame& f = stack_.back();
+                    if (f.expect_key) {
+                        f.key = overflow_ ? Key::other : key_of(token_);
+                        f.expect_key = false;
+                    } else if (f.key == Key::name && f.role == Role::call && !overflow_) {
+                        on_name(token_);
+                    }
+                    continue;
+                }
+                switch (c) {
+                case '"': in_string_ = true; token_.clear(); overflow_ = false; break;
+                case '{': case '[': stack_.push_back(Frame{ c == '{', role_of_next(), Key::other, c == '{' }); break;
+                case '}': case ']': if (!stack_.empty()) stack_.pop_back(); break;
+                case ',': if (!stack_.empty() && stack_.back().object) stack_.back().expect_key = true; break;
+                default: break;
+                }
+            }
+        }
+
+    private:
+        // Tool names are short; don't buffer multi-megabyte argument strings.
+        static constexpr size_t max_token = 256;
+
+        enum class Key : unsigned char { other, name, function, tool_calls, arguments };
+        // call: an object whose "name" is a tool name; calls: a tool_calls
+        // array; arguments: anywhere inside inline-object arguments.
+        enum class Role : unsigned char { other, call, calls, arguments };
+        struct Frame {
+            bool object;
+            Role role;
+            Key key;            // the current key, in an object
+            bool expect_key;    // in an object, the next string is a key
+        };
+
+        static Key key_of(const std::string& k) {
+            if (k == "name") return Key::name;
+            if (k == "function" || k == "function_call") return Key::function;
+            if (k == "tool_calls") return Key::tool_calls;
+            if (k == "arguments") return Key::arguments;
+            return Key::other;
+        }
+
+        // The role of a container opened where the scanner is now.
+        Role role_of_next() const {
+            if (stack_.empty()) return Role::other;
+            const Frame& parent = stack_.back();
+            if (parent.role == Role::arguments) return Role::arguments;
+            if (!parent.object) return parent.role == Role::calls ? Role::call : Role::other;
+            if (parent.key == Key::arguments) return Role::arguments;
+            if (parent.key == Key::function) return Role::call;
+            if (parent.key == Key::tool_calls) return Role::calls;
+            return Role::other;
+        }
+
+        void push(char c) {
+            if (token_.size() < max_token) token_.push_back(c);
+            else overflow_ = true;
+        }
+
+        std::vector<Frame> stack_;
+        bool in_string_ = false;
+        bool escape_ = false;
+        bool overflow_ = false;
+        std::string token_;
+    };
+
+    // Discover all tool calls in a response, in order.
+    template <typename J>
+    inline std::vector<ToolCall> discover_tool_calls(const J& api_response) {
+        // Normalize to a list of "entries" that each might contain a message/delta
+        // (by reference: copying the response would copy every argument).
+        std::vector<ToolCall> calls;
+        auto visit = [&](const J& entry) { collect_tool_calls_from_node(pick_message_like(entry), calls); };
+        if (api_response.is_object() && api_response.contains("choices")) {
+            for (const auto& entry : api_response["choices"]) visit(entry);
+        } else if (api_response.is_array()) {
+            for (const auto& entry : api_response) visit(entry);
+        } else {
+            visit(api_response);
+        }
+        return calls;
+    }
+
+    // Makes an arena current for the enclosing scope and rewinds it on the
+    // way out. Declare it before anything allocated from the arena.
+    struct ArenaLease {
+        explicit ArenaLease(Arena& a) : arena(a), scope(a) {}
+        ~ArenaLease() { arena.reset(); }
+        Arena& arena;
+        ArenaScope scope;
+    };
+
+    // Where a streaming handler on this thread sends its chunks; null means
+    // nobody takes partial updates and the chunks are collected instead.
+    thread_local ResultSink* t_chunk_sink = nullptr;
+
+    struct ChunkSinkScope {
+        ResultSink* previous;
+        explicit ChunkSinkScope(ResultSink* sink) : previous(t_chunk_sink) { t_chunk_sink = sink; }
+        ~ChunkSinkScope() { t_chunk_sink = previous; }
+    };
+
+    struct CollectingSink : ResultSink {
+        json chunks = json::array();
+        void write(json chunk) override { chunks.push_back(std::move(chunk)); }
+    };
+
+    inline std::uint64_t elapsed_us(std::chrono::steady_clock::time_point from,
+                                    std::chrono::steady_clock::time_point to) {
+        if (to <= from) return 0;
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+    }
+
 } // namespace
 
 
 // ---------- implementations ----------
 
+ToolRegistry::Stats::Stats(const Stats& other) {
+    std::lock_guard<std::mutex> lock(other.mutex);
+    prewarm = other.prewarm;
+    last_stable_payload = other.last_stable_payload;
+    stream_totals = other.stream_totals;
+}
+
+ToolRegistry::Stats& ToolRegistry::Stats::operator=(const Stats& other) {
+    if (this == &other) return *this;
+    std::scoped_lock lock(mutex, other.mutex);
+    prewarm = other.prewarm;
+    last_stable_payload = other.last_stable_payload;
+    stream_totals = other.stream_totals;
+    return *this;
+}
+
+void ToolRegistry::register_streaming_tool(const std::string& name, StreamingToolHandler handler,
+                                           const json& schema) {
+    register_tool(name, [h = std::move(handler)](const json& args) -> json {
+        if (ResultSink* out = t_chunk_sink) {
+            ChunkSinkScope nested(nullptr);     // tools this one calls don't stream into our caller
+            return h(args, *out);
+        }
+        CollectingSink collected;
+        json result = h(args, collected);
+        return result.is_null() ? std::move(collected.chunks) : result;
+    }, schema);
+}
+
+void ToolRegistry::set_result_budget(const ResultBudget& budget) {
+    result_budget_ = budget;
+    enable_cursors();
+}
+
+void ToolRegistry::set_result_budget(const std::string& tool, const ResultBudget& budget) {
+    tool_budgets_[tool] = budget;
+    enable_cursors();
+}
+
+void ToolRegistry::enable_cursors() {
+    if (cursors_) return;
+    // next_page results are exempt from encoding and budgets; that must
+    // never apply to a user tool of the same name.
+    if (tools_.count("next_page")) {
+        throw std::runtime_error("result budgets need the tool name next_page, which is already registered");
+    }
+    cursors_ = std::make_shared<ResultCursorStore>();
+    register_tool("next_page", [store = cursors_](const json& args) {
+        return store->next_page(args.at("cursor").get<std::string>());
+    }, {
+        {"name", "next_page"},
+        {"description", "Returns the next part of a tool result that was cut short. "
+                        "Pass the next_cursor value from that result."},
+        {"parameters", {{"type", "object"},
+                        {"properties", {{"cursor", {{"type", "string"}}}}},
+                        {"required", {"cursor"}}}},
+    });
+}
+
+void ToolRegistry::finalize_result(ExecutionResult& r) const {
+    apply_result_encoding(r);
+    apply_result_budget(r);
+}
+
+void ToolRegistry::apply_result_encoding(ExecutionResult& r) const {
+    if (!r.error.empty() || (!result_encoding_ && tool_encodings_.empty())) return;
+    if (cursors_ && r.tool_name == "next_page") return;     // pages are already prompt text
+    auto it = tool_encodings_.find(r.tool_name);
+    const ResultEncodeOptions* opts = it != tool_encodings_.end() ? &it->second
+                                    : result_encoding_ ? &*result_encoding_ : nullptr;
+    if (!opts) return;
+    ResultEncodeReport report;
+    r.result = encode_result(*r.result, *opts, &report);
+    r.tokens_saved = report.saved_tokens();
+}
+
+void ToolRegistry::apply_result_budget(ExecutionResult& r) const {
+    if (!cursors_ || !r.error.empty() || r.tool_name == "next_page") return;
+    ResultBudget budget = result_budget_;
+    auto it = tool_budgets_.find(r.tool_name);
+    if (it != tool_budgets_.end()) budget = ResultBudget::combine(budget, it->second);
+    if (!budget.limited()) return;
+    ResultPage page = render_result_page(*r.result, 0, budget);
+    if (!page.more) return;
+    r.cursor = cursors_->put(ResultCursorStore::Entry{ std::move(r.result), page.next_offset, budget, nullptr });
+    r.result = json{{"content", std::move(page.text)}, {"next_cursor", r.cursor}};
+}
+
+std::vector<ToolCall> ToolRegistry::find_tool_calls(const json& api_response) {
+    return discover_tool_calls(api_response);
+}
+
+void ToolRegistry::record_stream(const StreamStats& stats) const {
+    std::lock_guard<std::mutex> lock(stats_.mutex);
+    stats_.stream_totals.add(stats);
+}
+
+StreamTotals ToolRegistry::stream_stats() const {
+    std::lock_guard<std::mutex> lock(stats_.mutex);
+    return stats_.stream_totals;
+}
+
+std::string ToolRegistry::metrics_prometheus() const {
+    return metrics_->render_prometheus() + render_prometheus(stream_stats());
+}
+
+ToolRegistry::PrewarmStats ToolRegistry::prewarm_stats(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(stats_.mutex);
+    auto it = stats_.prewarm.find(name);
+    return it == stats_.prewarm.end() ? PrewarmStats{} : it->second;
+}
+
+void ToolRegistry::record_prewarm(const std::string& name, const PrewarmStats& delta) const {
+    std::lock_guard<std::mutex> lock(stats_.mutex);
+    auto& s = stats_.prewarm[name];
+    s.fired      += delta.fired;
+    s.unused     += delta.unused;
+    s.prewarm_us += delta.prewarm_us;
+    s.hidden_us  += delta.hidden_us;
+    s.waited_us  += delta.waited_us;
+}
+
 std::vector<ToolRegistry::ExecutionResult>
 ToolRegistry::process_remote_response_and_execute(const json& api_response, bool concurrent) const
 {
-    // Normalize to a list of "entries" that each might contain a message/delta.
-    json entries = api_response;
-    if (api_response.is_object() && api_response.contains("choices")) {
-        entries = api_response["choices"];
-    } else if (!api_response.is_array()) {
-        entries = json::array({ api_response });
+    return execute_calls(discover_tool_calls(api_response), concurrent, {});
+}
+
+std::vector<ToolRegistry::ExecutionResult>
+ToolRegistry::execute_calls(const std::vector<ToolCall>& calls, bool concurrent) const
+{
+    return execute_calls(calls, concurrent, {});
+}
+
+std::vector<ToolRegistry::ExecutionResult>
+ToolRegistry::process_remote_response_and_execute(std::string_view response_body, Arena& arena,
+                                                  bool concurrent) const
+{
+    std::vector<ToolCall> calls;
+    {
+        ArenaLease lease(arena);
+        const arena_json response = arena_json::parse(response_body.begin(), response_body.end());
+        calls = discover_tool_calls(response);
+    }
+    return execute_calls(calls, concurrent, {});
+}
+
+ToolRegistry::ExecutionResult
+ToolRegistry::execute_call(const ToolCall& call, const SharedJson& args, const CallGate& gate,
+                           const PartialSink& partial, bool finalize) const
+{
+    // Turns each chunk of a streaming handler into a partial result.
+    struct Forwarder : ResultSink {
+        const ToolCall& call;
+        const SharedJson& args;
+        const PartialSink& partial;
+        std::uint64_t sequence = 0;
+
+        Forwarder(const ToolCall& c, const SharedJson& a, const PartialSink& p) : call(c), args(a), partial(p) {}
+        void write(json chunk) override {
+            ExecutionResult p;
+            p.call_id = call.id;
+            p.tool_name = call.name;
+            p.arguments = args;
+            p.result = std::move(chunk);
+            p.partial = true;
+            p.sequence = sequence++;
+            partial(p);
+        }
+    } forwarder(call, args, partial);
+    ChunkSinkScope scope(partial ? &forwarder : nullptr);
+
+    ExecutionResult r;
+    r.call_id = call.id;
+    r.tool_name = call.name;
+    r.arguments = args;
+    r.serialize_ns = call.decode_ns;
+    const detail::ResultBodyScope outer;
+    try {
+        if (gate) gate();
+        if (call.ready != std::chrono::steady_clock::time_point{}) {
+            r.queue_ns = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(0,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - call.ready).count()));
+        }
+        r.result = invoke_measured(call.name, *args, call.id, r.queue_ns, r.serialize_ns, &r.exec_ns);
+        r.body = detail::take_result_body();
+    } catch (const std::exception& e) {
+        r.error = e.what();
+    } catch (...) {
+        r.error = "Unknown error invoking tool";
     }
+    r.sequence = forwarder.sequence;
+    if (finalize) finalize_result(r);
+    return r;
+}
 
-    // 1) Discover all tool calls in order.
-    std::vector<std::pair<std::string, json>> calls;
-    for (const auto& entry : entries) {
-        const json& node = pick_message_like(entry);
-        collect_tool_calls_from_node(node, calls);
+std::vector<ToolRegistry::ExecutionResult>
+ToolRegistry::execute_calls(const std::vector<ToolCall>& calls, bool concurrent,
+                            const std::vector<CallGate>& gates, const PartialSink& partial) const
+{
+    // Concurrent calls stream their chunks one at a time.
+    std::mutex partial_mutex;
+    PartialSink serialized;
+    if (partial && concurrent) {
+        serialized = [&](const ExecutionResult& p) {
+            std::lock_guard<std::mutex> lock(partial_mutex);
+            partial(p);
+        };
     }
+    const PartialSink& sink = serialized ? serialized : partial;
+    auto run = [this, &sink](const ToolCall& call, const CallGate& gate) {
+        return execute_call(call, call.arguments, gate, sink);
+    };
+    static const CallGate no_gate;
+    auto gate_for = [&](size_t i) -> const CallGate& { return i < gates.size() ? gates[i] : no_gate; };
 
-    // 2) Execute them (sync or concurrent).
     std::vector<ExecutionResult> results;
     results.reserve(calls.size());
 
     if (!concurrent) {
-        for (const auto& [name, args] : calls) {
-            ExecutionResult r;
-            r.tool_name = name;
-            r.arguments = args;
-            try {
-                r.result = invoke(name, args);
-            } catch (const std::exception& e) {
-                r.error = e.what();
-            } catch (...) {
-                r.error = "Unknown error invoking tool";
-            }
-            results.push_back(std::move(r));
+        for (size_t i = 0; i < calls.size(); ++i) {
+            results.push_back(run(calls[i], gate_for(i)));
         }
         return results;
     }
 
-    // concurrent path
+    // concurrent path; every future is joined below, so the tasks can take
+    // the calls and gates by reference.
     std::vector<std::future<ExecutionResult>> futs;
     futs.reserve(calls.size());
-    for (const auto& [name, args] : calls) {
-        futs.emplace_back(std::async(std::launch::async, [this, name, args]() -> ExecutionResult {
-            ExecutionResult r;
-            r.tool_name = name;
-            r.arguments = args;
-            try {
-                r.result = this->invoke(name, args);
-            } catch (const std::exception& e) {
-                r.error = e.what();
-            } catch (...) {
-                r.error = "Unknown error invoking tool";
-            }
-            return r;
-        }));
+    for (size_t i = 0; i < calls.size(); ++i) {
+        futs.emplace_back(std::async(std::launch::async, run,
+                                     std::cref(calls[i]), std::cref(gate_for(i))));
     }
 
     // Preserve discovery order in the returned vector.
@@ -214,43 +658,328 @@ ToolRegistry::process_remote_response_and_execute(const json& api_response, bool
 }
 
 
-void ToolRegistry::process_streaming_response_and_execute(
-    std::function<bool(std::string&)> get_chunk,
-    std::function<void(const ExecutionResult&)> on_result,
-    bool concurrent) const
-{
+namespace {
+    // A prewarm hook queued or in flight. Whoever gets to it first runs it: a
+    // worker, or the call that consumes it (right before invoking the tool)
+    // if no worker has picked it up yet, so a busy executor can't deadlock it.
+    struct PrewarmTicket {
+        ToolPrewarm hook;
+        std::atomic<bool> claimed{false};
+        std::promise<void> finished;
+        std::shared_future<void> done = finished.get_future().share();
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+
+        void run() {
+            if (claimed.exchange(true)) return;
+            start = std::chrono::steady_clock::now();
+            try { hook(); } catch (...) { /* best effort */ }
+            end = std::chrono::steady_clock::now();
+            finished.set_value();
+        }
+        void run_or_wait() {
+            run();
+            done.wait();
+        }
+    };
+
+    // Runs the prewarm hooks of sessions without an executor of their own.
+    // Shared by every session so a burst of tool names can't start a thread
+    // each; hooks still queued at exit are dropped (nobody waits on them).
+    class PrewarmPool {
+    public:
+        static PrewarmPool& shared() {
+            static PrewarmPool pool(std::max(2u, std::thread::hardware_concurrency()));
+            return pool;
+        }
+
+        void post(std::shared_ptr<PrewarmTicket> ticket) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_back(std::move(ticket));
+            }
+            cv_.notify_one();
+        }
+
+        ~PrewarmPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (auto& t : threads_) t.join();
+        }
+
+    private:
+        explicit PrewarmPool(unsigned n) {
+            for (unsigned i = 0; i < n; ++i) threads_.emplace_back([this] { loop(); });
+        }
+
+        void loop() {
+            while (true) {
+                std::shared_ptr<PrewarmTicket> ticket;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                    if (stop_) return;
+                    ticket = std::move(queue_.front());
+                    queue_.pop_front();
+                }
+                ticket->run();
+            }
+        }
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<std::shared_ptr<PrewarmTicket>> queue_;
+        std::vector<std::thread> threads_;
+        bool stop_ = false;
+    };
+} // namespace
+
+struct ToolRegistry::StreamSession::State {
+    const ToolRegistry* reg;
+    std::function<void(const ExecutionResult&)> on_result;
+    bool concurrent;
+    TaskExecutor executor;
+    BatchSink sink;
+
     std::string buffer;
-    std::string chunk;
+    Arena* arena = nullptr;
+    NameSniffer sniffer;
+    StreamStats stats;
+    std::chrono::steady_clock::time_point first_byte;
+    std::map<std::string, std::deque<std::shared_ptr<PrewarmTicket>>> pending;
+
+    void on_name(const std::string& name) {
+        auto it = reg->prewarms_.find(name);
+        if (it == reg->prewarms_.end()) return;
+        auto ticket = std::make_shared<PrewarmTicket>();
+        ticket->hook = it->second;
+        if (executor) {
+            executor([ticket] { ticket->run(); });
+        } else {
+            PrewarmPool::shared().post(ticket);
+        }
+        pending[name].push_back(std::move(ticket));
+    }
 
-    while (true) {
-        chunk.clear();
-        if (!get_chunk(chunk)) break;
-        buffer.append(chunk);
+    template <typename J>
+    void dispatch(const J& value) {
+        auto calls = discover_tool_calls(value);
+        if (!calls.empty() && stats.calls == 0) {
+            stats.first_call_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - first_byte).count());
+        }
+        stats.calls += calls.size();
+        for (const auto& c : calls) reg->trace(TracePoint::call_dispatched, c.name, c.id);
+
+        // Pair each call with the oldest outstanding prewarm for its tool.
+        std::vector<CallGate> gates(calls.size());
+        for (size_t i = 0; i < calls.size(); ++i) {
+            auto it = pending.find(calls[i].name);
+            if (it == pending.end() || it->second.empty()) continue;
+            std::shared_ptr<PrewarmTicket> ticket = std::move(it->second.front());
+            it->second.pop_front();
+            gates[i] = [r = reg, name = calls[i].name, ticket]() {
+                const auto dispatched = std::chrono::steady_clock::now();
+                ticket->run_or_wait();
+                PrewarmStats d;
+                d.fired = 1;
+                d.prewarm_us = elapsed_us(ticket->start, ticket->end);
+                d.hidden_us = elapsed_us(ticket->start, std::min(ticket->end, dispatched));
+                d.waited_us = elapsed_us(dispatched, ticket->end);
+                r->record_prewarm(name, d);
+            };
+        }
+
+        if (sink) {
+            sink(std::move(calls), std::move(gates));
+            return;
+        }
+        if (!executor) {
+            auto batch = reg->execute_calls(calls, concurrent, gates, on_result);
+            for (const auto& r : batch) {
+                reg->trace(TracePoint::result_delivered, r.tool_name, r.call_id);
+                on_result(r);
+            }
+            return;
+        }
+        executor([r = reg, calls = std::move(calls), gates = std::move(gates),
+                  concurrent = concurrent, on_result = on_result]() {
+            auto batch = r->execute_calls(calls, concurrent, gates, on_result);
+            for (const auto& res : batch) {
+                r->trace(TracePoint::result_delivered, res.tool_name, res.call_id);
+                on_result(res);
+            }
+        });
+    }
 
+    void drain() {
         // Pull any complete JSON values from the buffer.
-        auto json_blobs = extract_complete_json_values(buffer);
+        auto json_blobs = extract_complete_json_values(buffer, stats.dropped_bytes);
         for (const auto& s : json_blobs) {
-            try {
-                json obj = json::parse(s);
-                auto batch = process_remote_response_and_execute(obj, concurrent);
-                for (const auto& r : batch) on_result(r);
-            } catch (...) {
-                // Ignore parse errors for partial/garbage fragments; keep accumulating.
+            if (s == "[DONE]") {            // OpenAI / llama.cpp SSE end-of-stream sentinel
+                stats.dropped_bytes += s.size();
+                continue;
+            }
+            ++stats.values;
+            reg->trace(TracePoint::value_extracted, {}, {}, s.size());
+            if (arena) {
+                ArenaLease lease(*arena);
+                parse_and_dispatch<arena_json>(s);
+            } else {
+                parse_and_dispatch<json>(s);
             }
         }
     }
 
-    // Final flush in case the buffer ends with a complete JSON value.
-    auto final_blobs = extract_complete_json_values(buffer);
-    for (const auto& s : final_blobs) {
+    // A bad value is counted and skipped; the stream carries on.
+    template <typename J>
+    void parse_and_dispatch(const std::string& s) {
+        J value;
+        try {
+            value = J::parse(s.begin(), s.end());
+        } catch (const json::parse_error&) {
+            ++stats.syntax_errors;
+            return;
+        }
         try {
-            json obj = json::parse(s);
-            auto batch = process_remote_response_and_execute(obj, concurrent);
-            for (const auto& r : batch) on_result(r);
+            dispatch(value);
         } catch (...) {
-            // swallow
+            ++stats.dispatch_errors;
+        }
+    }
+
+    ~State() {
+        reg->record_stream(stats);
+        // Hooks whose call never materialized still have to finish first.
+        for (auto& [name, tickets] : pending) {
+            for (auto& ticket : tickets) {
+                ticket->run_or_wait();
+                PrewarmStats d;
+                d.fired = 1;
+                d.unused = 1;
+                d.prewarm_us = elapsed_us(ticket->start, ticket->end);
+                reg->record_prewarm(name, d);
+            }
+        }
+    }
+};
+
+ToolRegistry::StreamSession::StreamSession(const ToolRegistry& reg,
+                                           std::function<void(const ExecutionResult&)> on_result,
+                                           bool concurrent,
+                                           TaskExecutor executor)
+    : state_(new State{&reg, std::move(on_result), concurrent, std::move(executor), nullptr, {}, nullptr, {}, {}, {}, {}})
+{
+}
+
+ToolRegistry::StreamSession::StreamSession(const ToolRegistry& reg, BatchSink sink)
+    : state_(new State{&reg, nullptr, false, nullptr, std::move(sink), {}, nullptr, {}, {}, {}, {}})
+{
+}
+
+ToolRegistry::StreamSession::StreamSession(StreamSession&&) noexcept = default;
+ToolRegistry::StreamSession& ToolRegistry::StreamSession::operator=(StreamSession&&) noexcept = default;
+ToolRegistry::StreamSession::~StreamSession() = default;
+
+void ToolRegistry::StreamSession::feed(const char* data, size_t size) {
+    state_->reg->trace(TracePoint::chunk_received, {}, {}, size);
+    auto& st = state_->stats;
+    if (st.bytes == 0 && size > 0) state_->first_byte = std::chrono::steady_clock::now();
+    st.bytes += size;
+    ++st.chunks;
+    if (!state_->reg->prewarms_.empty()) {
+        state_->sniffer.feed(data, size, [this](const std::string& name) { state_->on_name(name); });
+    }
+    state_->buffer.append(data, size);
+    st.peak_buffer_bytes = std::max<std::uint64_t>(st.peak_buffer_bytes, state_->buffer.size());
+    state_->drain();
+}
+
+void ToolRegistry::StreamSession::finish() {
+    // Final flush in case the buffer ends with a complete JSON value.
+    state_->drain();
+    auto& buffer = state_->buffer;
+    if (buffer.find_first_of("{[") != std::string::npos) ++state_->stats.truncated;
+    state_->stats.dropped_bytes += buffer.size();
+    buffer.clear();
+}
+
+const StreamStats& ToolRegistry::StreamSession::stats() const {
+    return state_->stats;
+}
+
+void ToolRegistry::StreamSession::use_arena(Arena& arena) {
+    state_->arena = &arena;
+}
+
+void ToolRegistry::process_remote_response_and_execute_as_completed(
+    const json& api_response,
+    std::function<void(size_t, const ExecutionResult&)> on_result) const
+{
+    auto calls = discover_tool_calls(api_response);
+
+    // Results waiting for on_result. A tool streaming chunks faster than they
+    // are delivered blocks once this many are queued.
+    constexpr size_t max_queued = 64;
+    std::mutex mutex;
+    std::condition_variable cv, space;
+    std::deque<std::pair<size_t, ExecutionResult>> done;
+
+    std::vector<std::future<void>> futs;
+    futs.reserve(calls.size());
+    for (size_t i = 0; i < calls.size(); ++i) {
+        futs.emplace_back(std::async(std::launch::async, [&, i]() {
+            auto post = [&](ExecutionResult r) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    space.wait(lock, [&] { return done.size() < max_queued; });
+                    done.emplace_back(i, std::move(r));
+                }
+                cv.notify_one();
+            };
+            post(execute_call(calls[i], calls[i].arguments, nullptr, post));
+        }));
+    }
+
+    // Hand results over on this thread, in the order they finish; partial
+    // results don't count towards completion.
+    for (size_t delivered = 0; delivered < calls.size();) {
+        std::pair<size_t, ExecutionResult> next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return !done.empty(); });
+            next = std::move(done.front());
+            done.pop_front();
+        }
+        space.notify_one();
+        if (!next.second.partial) {
+            trace(TracePoint::result_delivered, next.second.tool_name, next.second.call_id);
+            ++delivered;
         }
+        on_result(next.first, next.second);
+    }
+}
+
+
+void ToolRegistry::process_streaming_response_and_execute(
+    std::function<bool(std::string&)> get_chunk,
+    std::function<void(const ExecutionResult&)> on_result,
+    bool concurrent,
+    StreamStats* stats) const
+{
+    StreamSession session(*this, std::move(on_result), concurrent);
+    std::string chunk;
+
+    while (true) {
+        chunk.clear();
+        if (!get_chunk(chunk)) break;
+        session.feed(chunk);
     }
+    session.finish();
+    if (stats) *stats = session.stats();
 }
 
 } // namespace lct
@@ -0,0 +1,201 @@
+#include "llama_cpp_tools/tracing.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <unordered_map>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    std::atomic<std::uint64_t> next_exporter_id{ 1 };
+
+    template <size_t N>
+    std::uint8_t copy_truncated(char (&dst)[N], std::string_view src) {
+        const size_t n = std::min(src.size(), N);
+        std::memcpy(dst, src.data(), n);
+        return static_cast<std::uint8_t>(n);
+    }
+
+    std::string quoted(std::string_view s) {
+        return nlohmann::json(std::string(s)).dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    }
+} // namespace
+
+struct ChromeTraceExporter::Ring {
+    struct Event {
+        TracePoint point;
+        std::uint8_t tool_len;
+        std::uint8_t id_len;
+        std::uint64_t ts_ns;
+        std::uint64_t value;
+        char tool[64];
+        char id[64];
+    };
+
+    explicit Ring(size_t capacity, int tid) : events(capacity), tid(tid) {}
+
+    std::vector<Event> events;
+    const int tid;
+    std::atomic<std::uint64_t> head{ 0 };   // written by the owning thread
+    std::atomic<std::uint64_t> tail{ 0 };   // written by the drainer
+    std::atomic<bool> owned{ true };        // a live thread records into it
+    std::atomic<bool> orphaned{ false };    // the exporter is gone
+};
+
+
+// ---------- implementations ----------
+
+const char* trace_point_name(TracePoint point) {
+    switch (point) {
+    case TracePoint::chunk_received:   return "chunk_received";
+    case TracePoint::value_extracted:  return "value_extracted";
+    case TracePoint::call_dispatched:  return "call_dispatched";
+    case TracePoint::handler_begin:    return "handler_begin";
+    case TracePoint::handler_end:      return "handler_end";
+    case TracePoint::result_delivered: return "result_delivered";
+    }
+    return "unknown";
+}
+
+ChromeTraceExporter::ChromeTraceExporter(const std::string& path)
+    : ChromeTraceExporter(path, Options())
+{
+}
+
+ChromeTraceExporter::ChromeTraceExporter(const std::string& path, Options opts)
+    : id_(next_exporter_id.fetch_add(1)), opts_(opts), epoch_(std::chrono::steady_clock::now())
+{
+    file_ = std::fopen(path.c_str(), "w");
+    if (!file_) throw std::system_error(errno, std::generic_category(), "open trace file " + path);
+    std::fputs("[", file_);
+    flusher_ = std::thread([this] { flusher(); });
+}
+
+ChromeTraceExporter::~ChromeTraceExporter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    flusher_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_locked();
+    for (auto& ring : rings_) ring->orphaned.store(true, std::memory_order_relaxed);
+    std::fputs("\n]\n", file_);
+    std::fclose(file_);
+}
+
+ChromeTraceExporter::Ring& ChromeTraceExporter::ring_for_this_thread() {
+    // Keyed by exporter id, not address, so a later exporter reusing the
+    // address never picks up a dead ring. A thread hands its rings back when
+    // it exits, so short-lived threads (std::async per call) reuse them
+    // instead of growing the list; shared ownership keeps a ring valid for a
+    // thread that outlives its exporter.
+    struct ThreadRings {
+        std::unordered_map<std::uint64_t, std::shared_ptr<Ring>> by_exporter;
+        ~ThreadRings() {
+            for (auto& [id, ring] : by_exporter) ring->owned.store(false, std::memory_order_release);
+        }
+    };
+    thread_local ThreadRings rings;
+    auto it = rings.by_exporter.find(id_);
+    if (it != rings.by_exporter.end()) return *it->second;
+    for (auto i = rings.by_exporter.begin(); i != rings.by_exporter.end();) {
+        if (i->second->orphaned.load(std::memory_order_relaxed)) i = rings.by_exporter.erase(i);
+        else ++i;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::shared_ptr<Ring> r;
+    for (auto& ring : rings_) {
+        if (!ring->owned.load(std::memory_order_acquire)) {
+            ring->owned.store(true, std::memory_order_relaxed);
+            r = ring;
+            break;
+        }
+    }
+    if (!r) {
+        r = std::make_shared<Ring>(std::max<size_t>(opts_.ring_events, 1), static_cast<int>(rings_.size()) + 1);
+        rings_.push_back(r);
+    }
+    rings.by_exporter.emplace(id_, r);
+    return *r;
+}
+
+void ChromeTraceExporter::record(TracePoint point, std::string_view tool, std::string_view call_id,
+                                 std::uint64_t value) {
+    const auto now = std::chrono::steady_clock::now();
+    Ring& ring = ring_for_this_thread();
+    const std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= ring.events.size()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& e = ring.events[head % ring.events.size()];
+    e.point = point;
+    e.ts_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - epoch_).count());
+    e.value = value;
+    e.tool_len = copy_truncated(e.tool, tool);
+    e.id_len = copy_truncated(e.id, call_id);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void ChromeTraceExporter::drain_locked() {
+    for (auto& ring : rings_) {
+        const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+        std::uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        for (; tail < head; ++tail) {
+            const auto& e = ring->events[tail % ring->events.size()];
+            const std::string_view tool(e.tool, e.tool_len);
+            const std::string_view id(e.id, e.id_len);
+
+            std::string line = first_event_ ? "\n" : ",\n";
+            first_event_ = false;
+            char ts[32];
+            std::snprintf(ts, sizeof(ts), "%.3f", static_cast<double>(e.ts_ns) / 1000.0);
+            line += "{\"pid\":1,\"tid\":" + std::to_string(ring->tid) + ",\"ts\":" + ts + ",\"cat\":\"lct\",";
+            switch (e.point) {
+            case TracePoint::handler_begin:
+            case TracePoint::handler_end:
+                line += "\"ph\":\"";
+                line += e.point == TracePoint::handler_begin ? "B" : "E";
+                line += "\",\"name\":" + quoted(tool) + ",\"args\":{\"call_id\":" + quoted(id);
+                if (e.point == TracePoint::handler_end) line += ",\"error\":" + std::string(e.value ? "true" : "false");
+                line += "}}";
+                break;
+            case TracePoint::chunk_received:
+            case TracePoint::value_extracted:
+                line += "\"ph\":\"i\",\"s\":\"t\",\"name\":\"" + std::string(trace_point_name(e.point)) +
+                        "\",\"args\":{\"bytes\":" + std::to_string(e.value) + "}}";
+                break;
+            default:
+                line += "\"ph\":\"i\",\"s\":\"t\",\"name\":\"" + std::string(trace_point_name(e.point)) +
+                        "\",\"args\":{\"tool\":" + quoted(tool) + ",\"call_id\":" + quoted(id) + "}}";
+                break;
+            }
+            std::fwrite(line.data(), 1, line.size(), file_);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+}
+
+void ChromeTraceExporter::flush() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain_locked();
+    std::fflush(file_);
+}
+
+void ChromeTraceExporter::flusher() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        cv_.wait_for(lock, opts_.flush_interval);
+        drain_locked();
+    }
+}
+
+} // namespace lct
@@ -0,0 +1,84 @@
+#include "llama_cpp_tools/wire_format.h"
+
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+
+namespace lct {
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    // A stream buffer over a fixed array. Writing past the end fails, and
+    // the stream is set to throw on failure, so encoding stops right there.
+    class BoundedBuf : public std::streambuf {
+    public:
+        BoundedBuf(char* out, size_t capacity) { setp(out, out + capacity); }
+        size_t size() const { return static_cast<size_t>(pptr() - pbase()); }
+
+    protected:
+        int_type overflow(int_type) override { return traits_type::eof(); }
+    };
+} // namespace
+
+
+// ---------- implementations ----------
+
+const char* wire_format_name(WireFormat format) {
+    switch (format) {
+        case WireFormat::json: return "json";
+        case WireFormat::msgpack: return "msgpack";
+        case WireFormat::cbor: return "cbor";
+    }
+    return "unknown";
+}
+
+std::optional<WireFormat> parse_wire_format(std::string_view name) {
+    if (name == "json") return WireFormat::json;
+    if (name == "msgpack" || name == "messagepack") return WireFormat::msgpack;
+    if (name == "cbor") return WireFormat::cbor;
+    return std::nullopt;
+}
+
+void wire_encode(const json& value, WireFormat format, std::string& out) {
+    switch (format) {
+        case WireFormat::json: out += value.dump(-1, ' ', false, json::error_handler_t::replace); return;
+        case WireFormat::msgpack: json::to_msgpack(value, out); return;
+        case WireFormat::cbor: json::to_cbor(value, out); return;
+    }
+}
+
+std::string wire_encode(const json& value, WireFormat format) {
+    std::string out;
+    wire_encode(value, format, out);
+    return out;
+}
+
+size_t wire_encode_to(const json& value, WireFormat format, char* out, size_t capacity) {
+    if (format == WireFormat::json) {
+        const std::string text = value.dump(-1, ' ', false, json::error_handler_t::replace);
+        if (text.size() > capacity) return std::string::npos;
+        std::memcpy(out, text.data(), text.size());
+        return text.size();
+    }
+    BoundedBuf buf(out, capacity);
+    std::ostream os(&buf);
+    os.exceptions(std::ios_base::badbit);
+    try {
+        if (format == WireFormat::msgpack) json::to_msgpack(value, os);
+        else json::to_cbor(value, os);
+    } catch (const std::ios_base::failure&) {
+        return std::string::npos;
+    }
+    return buf.size();
+}
+
+json wire_decode(const char* data, size_t size, WireFormat format) {
+    switch (format) {
+        case WireFormat::msgpack: return json::from_msgpack(data, data + size);
+        case WireFormat::cbor: return json::from_cbor(data, data + size);
+        case WireFormat::json: break;
+    }
+    return json::parse(data, data + size);
+}
+
+} // namespace lct
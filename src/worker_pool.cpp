@@ -0,0 +1,325 @@
+#include "llama_cpp_tools/worker_pool.h"
+
+#include <climits>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace lct {
+
+// Lives at the start of the shared mapping; one Channel per worker follows.
+struct WorkerPool::Shared {
+    std::atomic<std::uint32_t> shutdown{0};
+    std::atomic<std::uint64_t> crashes{0};
+    std::atomic<std::uint64_t> restarts{0};
+};
+
+// One worker's mailbox. `state` is the futex word: the host writes a request
+// and flips idle -> request; the worker answers in place and flips
+// request -> response; the zygote flips request -> crashed if the worker
+// dies mid-call. Request: a WireFormat byte, u32 name length, name, the
+// encoded arguments. Response: a status byte (0 ok, 1 error), then the
+// result in the request's format or the error message.
+struct WorkerPool::Channel {
+    std::atomic<std::uint32_t> state{0};
+    std::atomic<std::int32_t> pid{0};
+    std::atomic<std::int32_t> last_status{0};   // wait status of the last worker that died here
+    std::uint32_t length = 0;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+// ---------- helpers (anonymous namespace) ----------
+namespace {
+    enum : std::uint32_t { idle = 0, request = 1, response = 2, crashed = 3 };
+
+    constexpr size_t cache_line = 64;
+
+    inline size_t round_up(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+    // Shared (not FUTEX_PRIVATE) operations: the word is mapped in several processes.
+    inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected, const timespec* timeout) {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+    }
+
+    inline void futex_wake(std::atomic<std::uint32_t>& word) {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    std::string describe_exit(int status) {
+        if (WIFSIGNALED(status)) return "killed by signal " + std::to_string(WTERMSIG(status));
+        if (WIFEXITED(status)) return "exited with status " + std::to_string(WEXITSTATUS(status));
+        return "exited";
+    }
+
+    // True once the zygote has exited. waitpid() fails if another thread
+    // already reaped it, or if the host ignores SIGCHLD; fall back to kill(0).
+    inline bool zygote_gone(pid_t zygote) {
+        const pid_t r = ::waitpid(zygote, nullptr, WNOHANG);
+        if (r == 0) return false;
+        return r == zygote || ::kill(zygote, 0) != 0;
+    }
+
+    // Serves one channel until the pool shuts down. Runs in a worker process.
+    [[noreturn]] void worker_main(const ToolRegistry& reg, std::atomic<std::uint32_t>& shutdown,
+                                  std::atomic<std::uint32_t>& state, std::uint32_t& length, char* data,
+                                  size_t slot_bytes, unsigned spin) {
+        for (;;) {
+            std::uint32_t s;
+            unsigned polls = 0;
+            while ((s = state.load(std::memory_order_acquire)) != request) {
+                if (shutdown.load(std::memory_order_relaxed)) ::_exit(0);
+                if (polls++ < spin) { cpu_relax(); continue; }
+                futex_wait(state, s, nullptr);
+            }
+
+            const WireFormat format = static_cast<WireFormat>(data[0]);
+            std::uint32_t name_len;
+            std::memcpy(&name_len, data + 1, sizeof(name_len));
+            const char* payload = data + 1 + sizeof(name_len);
+            const std::string name(payload, name_len);
+            payload += name_len;
+            std::string error;
+            size_t written = 0;
+            try {
+                const json args = wire_decode(payload, static_cast<size_t>(data + length - payload), format);
+                const json result = reg.invoke_local(name, args);
+                // The request has been consumed; the result overwrites it.
+                written = wire_encode_to(result, format, data + 1, slot_bytes - 1);
+                if (written == std::string::npos) {
+                    error = "worker pool: result of " + name + " exceeds slot_bytes (" + std::to_string(slot_bytes) + ")";
+                }
+            } catch (const std::exception& e) {
+                error = e.what();
+            } catch (...) {
+                error = "Unknown error invoking tool";
+            }
+            // A body is a handle into this process; it can't go back in the
+            // slot, and must not leak into the next request either.
+            if (detail::take_result_body() && error.empty()) {
+                error = "worker pool: " + name + " set a result body, which can't leave the worker";
+            }
+            char status = 0;
+            if (!error.empty()) {
+                status = 1;
+                if (error.size() + 1 > slot_bytes) error.resize(slot_bytes - 1);
+                std::memcpy(data + 1, error.data(), error.size());
+                written = error.size();
+            }
+            data[0] = status;
+            length = static_cast<std::uint32_t>(written + 1);
+            state.store(response, std::memory_order_release);
+            futex_wake(state);
+        }
+    }
+} // namespace
+
+
+// ---------- implementations ----------
+
+WorkerPool::WorkerPool(const ToolRegistry& reg) : WorkerPool(reg, Options()) {}
+
+WorkerPool::WorkerPool(const ToolRegistry& reg, Options opts) : opts_(opts) {
+    if (opts_.workers == 0) throw std::invalid_argument("WorkerPool: workers must be > 0");
+    if (opts_.slot_bytes > UINT32_MAX) throw std::invalid_argument("WorkerPool: slot_bytes must fit in 32 bits");
+    if (std::thread::hardware_concurrency() == 1) opts_.spin = 0;   // the peer can't run while we spin
+    const size_t header = round_up(sizeof(Shared), cache_line);
+    channel_bytes_ = round_up(sizeof(Channel) + opts_.slot_bytes, cache_line);
+    mapping_bytes_ = header + channel_bytes_ * opts_.workers;
+
+    void* mem = ::mmap(nullptr, mapping_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) throw std::system_error(errno, std::generic_category(), "WorkerPool: mmap");
+    shared_ = new (mem) Shared();
+    for (size_t i = 0; i < opts_.workers; ++i) new (&channel(i)) Channel();
+
+    const pid_t host = ::getpid();
+    const pid_t z = ::fork();
+    if (z < 0) {
+        const int err = errno;
+        ::munmap(mem, mapping_bytes_);
+        throw std::system_error(err, std::generic_category(), "WorkerPool: fork");
+    }
+    if (z == 0) {
+        // Zygote: fork the workers, then reap and replace them for good.
+        ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (::getppid() != host) ::_exit(0);
+        auto spawn = [&](size_t i) {
+            Channel& ch = channel(i);
+            for (;;) {
+                const pid_t p = ::fork();
+                if (p == 0) {
+                    ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+                    // The host's crash handlers must not run here: a crash
+                    // should just end the worker, with the signal as status.
+                    for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM}) ::signal(sig, SIG_DFL);
+                    worker_main(reg, shared_->shutdown, ch.state, ch.length, ch.data(),
+                                opts_.slot_bytes, opts_.spin);
+                }
+                if (p > 0) { ch.pid.store(p); return; }
+                ::usleep(100 * 1000);   // out of processes: retry
+            }
+        };
+        for (size_t i = 0; i < opts_.workers; ++i) spawn(i);
+        for (;;) {
+            int status = 0;
+            const pid_t dead = ::waitpid(-1, &status, 0);
+            if (dead < 0) {
+                if (errno == EINTR) continue;
+                ::_exit(0);
+            }
+            if (shared_->shutdown.load()) continue;
+            for (size_t i = 0; i < opts_.workers; ++i) {
+                Channel& ch = channel(i);
+                if (ch.pid.load() != dead) continue;
+                shared_->crashes.fetch_add(1);
+                ch.last_status.store(status);
+                // Only a call in flight is failed; an answer already written stands.
+                std::uint32_t busy = request;
+                if (ch.state.compare_exchange_strong(busy, crashed)) futex_wake(ch.state);
+                spawn(i);
+                shared_->restarts.fetch_add(1);
+                break;
+            }
+        }
+    }
+
+    zygote_ = z;
+    free_.reserve(opts_.workers);
+    for (size_t i = opts_.workers; i-- > 0;) free_.push_back(i);
+}
+
+WorkerPool::~WorkerPool() {
+    shared_->shutdown.store(1);
+    for (size_t i = 0; i < opts_.workers; ++i) futex_wake(channel(i).state);
+    ::kill(zygote_, SIGKILL);             // workers follow through PR_SET_PDEATHSIG
+    ::waitpid(zygote_, nullptr, 0);
+    ::munmap(shared_, mapping_bytes_);
+}
+
+WorkerPool::Channel& WorkerPool::channel(size_t i) const {
+    char* base = reinterpret_cast<char*>(shared_) + round_up(sizeof(Shared), cache_line);
+    return *reinterpret_cast<Channel*>(base + i * channel_bytes_);
+}
+
+size_t WorkerPool::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    free_cv_.wait(lock, [&] { return !free_.empty(); });
+    const size_t i = free_.back();
+    free_.pop_back();
+    return i;
+}
+
+void WorkerPool::release(size_t i) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(i);
+    }
+    free_cv_.notify_one();
+}
+
+json WorkerPool::call(const std::string& tool, const json& args) {
+    const std::uint32_t name_len = static_cast<std::uint32_t>(tool.size());
+    const size_t header = 1 + sizeof(name_len) + tool.size();
+    if (header > opts_.slot_bytes) {
+        throw std::runtime_error("worker pool: request for " + tool + " exceeds slot_bytes");
+    }
+
+    const size_t i = acquire();
+    struct Release {
+        WorkerPool* pool;
+        size_t i;
+        ~Release() { pool->release(i); }
+    } release_on_exit{this, i};
+    Channel& ch = channel(i);
+
+    char* d = ch.data();
+    d[0] = static_cast<char>(opts_.wire);
+    std::memcpy(d + 1, &name_len, sizeof(name_len));
+    std::memcpy(d + 1 + sizeof(name_len), tool.data(), tool.size());
+    const size_t written = wire_encode_to(args, opts_.wire, d + header, opts_.slot_bytes - header);
+    if (written == std::string::npos) {
+        throw std::runtime_error("worker pool: request for " + tool + " exceeds slot_bytes (" +
+                                 std::to_string(opts_.slot_bytes) + ")");
+    }
+    ch.length = static_cast<std::uint32_t>(header + written);
+    ch.state.store(request, std::memory_order_release);
+    futex_wake(ch.state);
+    calls_.fetch_add(1, std::memory_order_relaxed);
+
+    // Wait for the answer. The futex sleeps in slices so that a dead zygote
+    // (nobody left to report a crash) and the call timeout are noticed.
+    const auto deadline = std::chrono::steady_clock::now() + opts_.call_timeout;
+    bool timed_out = false;
+    unsigned polls = 0;
+    std::uint32_t s;
+    while ((s = ch.state.load(std::memory_order_acquire)) == request) {
+        if (polls++ < opts_.spin) { cpu_relax(); continue; }
+        const timespec slice{0, 50 * 1000 * 1000};
+        futex_wait(ch.state, request, &slice);
+        if (zygote_gone(zygote_)) throw std::runtime_error("worker pool: zygote exited");
+        if (!timed_out && opts_.call_timeout.count() > 0 && std::chrono::steady_clock::now() >= deadline) {
+            timed_out = true;
+            timeouts_.fetch_add(1, std::memory_order_relaxed);
+            ::kill(ch.pid.load(), SIGKILL);
+        }
+    }
+
+    if (s == crashed) {
+        ch.state.store(idle, std::memory_order_relaxed);
+        if (timed_out) {
+            throw std::runtime_error("worker pool: " + tool + " timed out after " +
+                                     std::to_string(opts_.call_timeout.count()) + " ms");
+        }
+        throw std::runtime_error("worker pool: worker running " + tool + " " + describe_exit(ch.last_status.load()));
+    }
+    const bool ok = d[0] == 0;
+    if (ok) {
+        json result = wire_decode(d + 1, ch.length - 1, opts_.wire);
+        ch.state.store(idle, std::memory_order_relaxed);
+        return result;
+    }
+    std::string message(d + 1, ch.length - 1);
+    ch.state.store(idle, std::memory_order_relaxed);
+    throw std::runtime_error(message);
+}
+
+void WorkerPool::route(ToolRegistry& reg, const std::shared_ptr<WorkerPool>& pool,
+                       const std::vector<std::string>& tools) {
+    for (const auto& name : tools) {
+        reg.route_tool(name, [pool, name](const json& args) { return pool->call(name, args); });
+    }
+}
+
+WorkerPool::Stats WorkerPool::stats() const {
+    Stats s;
+    s.calls = calls_.load(std::memory_order_relaxed);
+    s.timeouts = timeouts_.load(std::memory_order_relaxed);
+    s.crashes = shared_->crashes.load();
+    s.restarts = shared_->restarts.load();
+    return s;
+}
+
+std::vector<pid_t> WorkerPool::worker_pids() const {
+    std::vector<pid_t> out;
+    for (size_t i = 0; i < opts_.workers; ++i) out.push_back(channel(i).pid.load());
+    return out;
+}
+
+} // namespace lct
@@ -2,10 +2,29 @@
 #include <catch2/catch_all.hpp>
 #include <nlohmann/json.hpp>
 #include "llama_cpp_tools/tool_registry.h"
+#include "llama_cpp_tools/agent_loop.h"
+#include "llama_cpp_tools/alloc_accounting.h"
+#include "llama_cpp_tools/wire_format.h"
 
+#include <atomic>
 #include <thread>
 #include <chrono>
 #include <cctype>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <set>
+
+#ifdef __linux__
+#include "llama_cpp_tools/stream_multiplexer.h"
+#include "llama_cpp_tools/worker_pool.h"
+#include <csignal>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 using json = nlohmann::json;
 using namespace lct;
@@ -189,3 +208,1779 @@ TEST_CASE("process_streaming_response_and_execute processes JSON chunks") {
     REQUIRE(got[0].tool_name == "upper");
     REQUIRE(got[0].result.at("out") == "HEY");
 }
+
+TEST_CASE("prewarm fires as soon as the streamed tool name is complete") {
+    ToolRegistry reg;
+
+    std::atomic<bool> warmed{false};
+    ToolSpec lookup;
+    lookup.name = "lookup";
+    lookup.description = "needs a warm index";
+    lookup.parameters = {{"type","object"}, {"properties", {{"k", {{"type","string"}}}}}, {"required", {"k"}}};
+    lookup.prewarm = [&]{
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        warmed = true;
+    };
+    lookup.handler = [&](const json& args){ return json{{"warm", warmed.load()}, {"k", args.at("k")}}; };
+    reg.register_tool_spec(lookup);
+
+    // The name arrives in the first chunk; the arguments trail well behind it.
+    std::vector<std::string> chunks = {
+        R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"lookup",)",
+        R"("arguments":"{\"k\":\"v\"}"}}]}}]})"
+    };
+    size_t next = 0;
+    auto get_chunk = [&](std::string& out) -> bool {
+        if (next >= chunks.size()) return false;
+        if (next > 0) std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        out = chunks[next++];
+        return true;
+    };
+
+    std::vector<ToolRegistry::ExecutionResult> got;
+    reg.process_streaming_response_and_execute(get_chunk, [&](const ToolRegistry::ExecutionResult& r){
+        got.push_back(r);
+    });
+
+    REQUIRE(got.size() == 1);
+    REQUIRE(got[0].error.empty());
+    REQUIRE(got[0].result.at("warm") == true);
+
+    auto stats = reg.prewarm_stats("lookup");
+    REQUIRE(stats.fired == 1);
+    REQUIRE(stats.unused == 0);
+    REQUIRE(stats.prewarm_us >= 25000);
+    // The whole hook ran while the arguments were still streaming.
+    REQUIRE(stats.hidden_us == stats.prewarm_us);
+    REQUIRE(stats.waited_us == 0);
+    REQUIRE(reg.prewarm_stats("missing").fired == 0);
+}
+
+TEST_CASE("prewarm only fires for a tool call's own name") {
+    ToolRegistry reg;
+    std::atomic<int> hooks{0};
+    ToolSpec lookup;
+    lookup.name = "lookup";
+    lookup.description = "needs a warm index";
+    lookup.parameters = {{"type", "object"}};
+    lookup.prewarm = [&] { ++hooks; };
+    lookup.handler = [](const json&) { return json(true); };
+    reg.register_tool_spec(lookup);
+
+    const std::string body =
+        // tool_calls[].function.name, with "name" keys inside inline-object arguments
+        R"({"choices":[{"message":{"tool_calls":[{"id":"a","function":{"name":"lookup",)"
+        R"("arguments":{"name":"lookup","nested":{"function":{"name":"lookup"}},"list":[{"name":"lookup"}]}}}]}}]})" "\n"
+        // the older function_call.name
+        R"({"choices":[{"message":{"function_call":{"name":"lookup","arguments":"{\"name\":\"lookup\"}"}}}]})" "\n"
+        // a name that is not a call's
+        R"({"choices":[{"message":{"role":"tool","name":"lookup","content":"hi"}}],"name":"lookup"})" "\n"
+        // a tool_calls entry carrying its name directly
+        R"({"tool_calls":[{"name":"lookup","arguments":{"name":"lookup"}}]})" "\n";
+    size_t pos = 0, calls = 0;
+    reg.process_streaming_response_and_execute([&](std::string& out) {
+        if (pos >= body.size()) return false;
+        out = body.substr(pos, 5);
+        pos += out.size();
+        return true;
+    }, [&](const ToolRegistry::ExecutionResult& r) { calls += r.error.empty(); });
+
+    CHECK(calls == 3);
+    CHECK(hooks == 3);
+    const auto stats = reg.prewarm_stats("lookup");
+    CHECK(stats.fired == 3);
+    CHECK(stats.unused == 0);
+}
+
+TEST_CASE("prewarm hooks run on a bounded set of threads") {
+    ToolRegistry reg;
+    std::atomic<int> running{0}, peak{0}, hooks{0};
+    ToolSpec lookup;
+    lookup.name = "lookup";
+    lookup.description = "needs a warm index";
+    lookup.parameters = {{"type", "object"}};
+    lookup.prewarm = [&] {
+        const int now = ++running;
+        for (int p = peak.load(); now > p && !peak.compare_exchange_weak(p, now);) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        --running;
+        ++hooks;
+    };
+    lookup.handler = [](const json&) { return json(true); };
+    reg.register_tool_spec(lookup);
+
+    const int calls = 40;
+    std::vector<ToolCall> tc;
+    for (int i = 0; i < calls; ++i) tc.push_back(ToolCall{"c" + std::to_string(i), "lookup", json::object()});
+    const std::string body = MockChatTransport::tool_call_response(tc).dump();
+
+    // Without an executor: the shared pool, not a thread per name (plus the
+    // feeding thread, which runs a hook no worker has started yet).
+    size_t delivered = 0;
+    {
+        ToolRegistry::StreamSession session(reg, [&](const ToolRegistry::ExecutionResult& r) { delivered += r.error.empty(); });
+        for (size_t i = 0; i < body.size(); i += 64) session.feed(body.substr(i, 64));
+        session.finish();
+    }
+    CHECK(delivered == calls);
+    CHECK(hooks == calls);
+    CHECK(peak <= static_cast<int>(std::max(2u, std::thread::hardware_concurrency())) + 1);
+
+    // With an executor the hooks are its tasks. Run them only afterwards, batch
+    // first: a call whose hook hasn't started runs it inline.
+    std::vector<std::function<void()>> tasks;
+    delivered = 0;
+    hooks = 0;
+    {
+        ToolRegistry::StreamSession session(reg, [&](const ToolRegistry::ExecutionResult& r) { delivered += r.error.empty(); },
+                                            false, [&](std::function<void()> t) { tasks.push_back(std::move(t)); });
+        session.feed(body);
+        session.finish();
+        CHECK(hooks == 0);
+        CHECK(tasks.size() == calls + 1);
+        for (auto it = tasks.rbegin(); it != tasks.rend(); ++it) (*it)();
+    }
+    CHECK(delivered == calls);
+    CHECK(hooks == calls);
+    CHECK(reg.prewarm_stats("lookup").fired == 2 * calls);
+}
+
+#ifdef __linux__
+TEST_CASE("StreamMultiplexer drives 10k concurrent streams over socketpairs") {
+    ToolRegistry reg;
+
+    ToolSpec echo;
+    echo.name = "echo";
+    echo.description = "echo an index";
+    echo.parameters = {{"type","object"}, {"properties", {{"i", {{"type","integer"}}}}}, {"required", {"i"}}};
+    echo.handler = [](const json& args){ return json{{"i", args.at("i")}}; };
+    reg.register_tool_spec(echo);
+
+    // Each pair costs two descriptors while open; stay inside RLIMIT_NOFILE.
+    rlimit lim{};
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    const size_t streams = 10000;
+    const size_t window = 512;   // writers kept open at once
+    REQUIRE(lim.rlim_cur > streams + window + 64);
+
+    StreamMultiplexer::Options opts;
+    opts.worker_threads = 2;
+    StreamMultiplexer mux(reg, opts);
+
+    std::vector<std::atomic<int>> seen(streams);
+    std::atomic<size_t> closed{0}, errors{0};
+
+    auto chunks_for = [](size_t i) {
+        std::string body = R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"echo","arguments":"{\"i\":)"
+                         + std::to_string(i) + R"(}"}}]}}]})";
+        const size_t third = body.size() / 3;
+        return std::vector<std::string>{ body.substr(0, third), body.substr(third, third), body.substr(2 * third) };
+    };
+    auto send_all = [](int fd, const std::string& s) {
+        size_t off = 0;
+        while (off < s.size()) {
+            ssize_t n = write(fd, s.data() + off, s.size() - off);
+            if (n <= 0) return false;
+            off += static_cast<size_t>(n);
+        }
+        return true;
+    };
+
+    // Interleave: open a stream and send its first chunk; once `window`
+    // writers are open, finish the oldest one chunk at a time.
+    std::deque<std::pair<size_t, int>> open_writers;
+    auto finish_oldest = [&] {
+        auto [i, fd] = open_writers.front();
+        open_writers.pop_front();
+        auto chunks = chunks_for(i);
+        REQUIRE(send_all(fd, chunks[1]));
+        REQUIRE(send_all(fd, chunks[2]));
+        close(fd);
+    };
+    for (size_t i = 0; i < streams; ++i) {
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        mux.add_stream(sv[0],
+            [&seen, i](const ToolRegistry::ExecutionResult& r) {
+                if (r.error.empty() && r.result.at("i").get<size_t>() == i) seen[i].fetch_add(1);
+            },
+            [&](int err) { if (err) errors.fetch_add(1); closed.fetch_add(1); });
+        REQUIRE(send_all(sv[1], chunks_for(i)[0]));
+        open_writers.emplace_back(i, sv[1]);
+        if (open_writers.size() >= window) finish_oldest();
+    }
+    while (!open_writers.empty()) finish_oldest();
+
+    mux.wait_idle();
+    REQUIRE(mux.active_streams() == 0);
+    REQUIRE(closed.load() == streams);
+    REQUIRE(errors.load() == 0);
+    size_t delivered = 0;
+    for (auto& n : seen) delivered += (n.load() == 1);
+    REQUIRE(delivered == streams);
+}
+
+TEST_CASE("stream multiplexer shutdown cancels only streams still being read") {
+    ToolRegistry reg;
+    ToolSpec slow;
+    slow.name = "slow";
+    slow.description = "sleep a little";
+    slow.parameters = {{"type","object"}, {"properties", json::object()}};
+    slow.handler = [](const json&){
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return json{{"ok", true}};
+    };
+    reg.register_tool_spec(slow);
+
+    int done[2], open_pair[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, done) == 0);
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, open_pair) == 0);
+    std::atomic<int> done_error{-1}, open_error{-1};
+    std::atomic<int> results{0};
+    {
+        StreamMultiplexer::Options opts;
+        opts.worker_threads = 1;
+        StreamMultiplexer mux(reg, opts);
+        mux.add_stream(done[0], [&](const ToolRegistry::ExecutionResult&){ results.fetch_add(1); },
+                       [&](int err){ done_error = err; });
+        mux.add_stream(open_pair[0], [](const ToolRegistry::ExecutionResult&){},
+                       [&](int err){ open_error = err; });
+
+        const std::string body = R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"slow","arguments":"{}"}}]}}]})";
+        REQUIRE(write(done[1], body.data(), body.size()) == static_cast<ssize_t>(body.size()));
+        close(done[1]);
+        // Let the reactor see EOF while the call is still running.
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    REQUIRE(results.load() == 1);
+    REQUIRE(done_error.load() == 0);            // a clean EOF stays clean
+    REQUIRE(open_error.load() == ECANCELED);
+    REQUIRE(fcntl(done[0], F_GETFD) == -1);     // closed once, by the reader
+    REQUIRE(fcntl(open_pair[0], F_GETFD) == -1);
+    close(open_pair[1]);
+}
+
+TEST_CASE("StreamMultiplexer runs the batches of one stream in order") {
+    ToolRegistry reg;
+    reg.register_tool("step", [](const json& args) {
+        const int i = args.at("i");
+        std::this_thread::sleep_for(std::chrono::microseconds((i % 4) * 300));   // later batches often finish first
+        return json(i);
+    }, {{"name", "step"}});
+
+    StreamMultiplexer::Options opts;
+    opts.worker_threads = 4;
+    StreamMultiplexer mux(reg, opts);
+    const int batches = 200;
+    const int streams = 3;
+    std::vector<std::vector<int>> order(streams);
+    for (int s = 0; s < streams; ++s) {
+        int sv[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        mux.add_stream(sv[0], [&order, s](const ToolRegistry::ExecutionResult& r) {
+            order[s].push_back(r.error.empty() ? r.result->get<int>() : -1);
+        });
+        std::string body;
+        for (int i = 0; i < batches; ++i) {
+            body += R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"step","arguments":"{\"i\":)"
+                  + std::to_string(i) + R"(}"}}]}}]})" "\n";
+        }
+        // One write per response, so the reader dispatches them one by one.
+        for (size_t at = 0, nl; (nl = body.find('\n', at)) != std::string::npos; at = nl + 1) {
+            REQUIRE(write(sv[1], body.data() + at, nl + 1 - at) == static_cast<ssize_t>(nl + 1 - at));
+        }
+        close(sv[1]);
+    }
+    mux.wait_idle();
+
+    std::vector<int> expected(batches);
+    std::iota(expected.begin(), expected.end(), 0);
+    for (const auto& got : order) CHECK(got == expected);
+}
+
+TEST_CASE("add_stream closes the descriptor it was given when it fails") {
+    ToolRegistry reg;
+    StreamMultiplexer mux(reg);
+    int fd = open("/dev/null", O_RDONLY);     // regular files can't be watched by epoll
+    REQUIRE(fd >= 0);
+    REQUIRE_THROWS_AS(mux.add_stream(fd, [](const ToolRegistry::ExecutionResult&){}), std::system_error);
+    REQUIRE(fcntl(fd, F_GETFD) == -1);
+    REQUIRE(mux.active_streams() == 0);
+}
+#endif
+
+namespace {
+    // A stream of `n` separate responses, one `echo` call each, 7-byte chunks.
+    std::function<bool(std::string&)> echo_stream(size_t n) {
+        auto body = std::make_shared<std::string>();
+        for (size_t i = 0; i < n; ++i) {
+            *body += R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"echo","arguments":"{\"i\":)"
+                   + std::to_string(i) + R"(}"}}]}}]})" "\n";
+        }
+        auto pos = std::make_shared<size_t>(0);
+        return [body, pos](std::string& out) -> bool {
+            if (*pos >= body->size()) return false;
+            size_t n = std::min<size_t>(7, body->size() - *pos);
+            out = body->substr(*pos, n);
+            *pos += n;
+            return true;
+        };
+    }
+
+    void register_echo(ToolRegistry& reg) {
+        ToolSpec echo;
+        echo.name = "echo";
+        echo.description = "echo an index";
+        echo.parameters = {{"type","object"}, {"properties", {{"i", {{"type","integer"}}}}}, {"required", {"i"}}};
+        echo.handler = [](const json& args){ return json{{"i", args.at("i")}}; };
+        reg.register_tool_spec(echo);
+    }
+}
+
+TEST_CASE("pipelined streaming blocks on a slow consumer without losing results") {
+    ToolRegistry reg;
+    register_echo(reg);
+
+    PipelineOptions opts;
+    opts.call_queue_capacity = 2;
+    opts.result_queue_capacity = 2;
+
+    std::vector<int> got;
+    auto stats = reg.process_streaming_response_pipelined(echo_stream(20), [&](const ToolRegistry::ExecutionResult& r){
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        got.push_back(r.result.at("i").get<int>());
+    }, opts);
+
+    REQUIRE(got.size() == 20);
+    for (int i = 0; i < 20; ++i) REQUIRE(got[i] == i);  // one executor keeps discovery order
+    REQUIRE(stats.parse.items == 20);
+    REQUIRE(stats.execute.items == 20);
+    REQUIRE(stats.deliver.items == 20);
+    REQUIRE(stats.parse.queue_high_water <= 2);
+    REQUIRE(stats.execute.queue_high_water <= 2);
+    REQUIRE(stats.execute.stall_us > 0);
+    REQUIRE(stats.parse.dropped + stats.execute.dropped == 0);
+}
+
+TEST_CASE("pipelined streaming drop_oldest and fail policies") {
+    ToolRegistry reg;
+    register_echo(reg);
+
+    PipelineOptions opts;
+    opts.call_queue_capacity = 64;
+    opts.result_queue_capacity = 1;
+    opts.policy = BackpressurePolicy::drop_oldest;
+
+    size_t delivered = 0;
+    auto stats = reg.process_streaming_response_pipelined(echo_stream(50), [&](const ToolRegistry::ExecutionResult&){
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        ++delivered;
+    }, opts);
+    REQUIRE(stats.execute.items == 50);
+    REQUIRE(stats.execute.dropped > 0);
+    REQUIRE(delivered + stats.execute.dropped == 50);
+
+    opts.policy = BackpressurePolicy::fail;
+    REQUIRE_THROWS_AS(reg.process_streaming_response_pipelined(echo_stream(50), [](const ToolRegistry::ExecutionResult&){
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }, opts), std::runtime_error);
+}
+
+TEST_CASE("as_completed delivers results in completion order with their index") {
+    ToolRegistry reg;
+
+    ToolSpec nap;
+    nap.name = "nap";
+    nap.description = "sleep for ms then return it";
+    nap.parameters = {{"type","object"}, {"properties", {{"ms", {{"type","integer"}}}}}, {"required", {"ms"}}};
+    nap.handler = [](const json& args){
+        std::this_thread::sleep_for(std::chrono::milliseconds(args.at("ms").get<int>()));
+        return json{{"ms", args.at("ms")}};
+    };
+    reg.register_tool_spec(nap);
+
+    json api_resp = {
+        {"choices", {{
+            {"message", {
+                {"tool_calls", {
+                    {{"function", {{"name", "nap"}, {"arguments", R"({"ms":120})"}}}},
+                    {{"function", {{"name", "nap"}, {"arguments", R"({"ms":5})"}}}},
+                    {{"function", {{"name", "missing"}, {"arguments", "{}"}}}}
+                }}
+            }}
+        }}}
+    };
+
+    std::vector<size_t> order;
+    std::vector<long long> at_ms;
+    auto t0 = std::chrono::steady_clock::now();
+    reg.process_remote_response_and_execute_as_completed(api_resp, [&](size_t i, const ToolRegistry::ExecutionResult& r){
+        order.push_back(i);
+        at_ms.push_back(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count());
+        if (i == 2) REQUIRE(!r.error.empty());
+        else REQUIRE(r.result.at("ms") == (i == 0 ? 120 : 5));
+    });
+
+    REQUIRE(order.size() == 3);
+    REQUIRE(order.back() == 0);     // the slow call no longer holds the others back
+    REQUIRE(at_ms[0] < 100);
+    REQUIRE(at_ms[1] < 100);
+}
+
+TEST_CASE("dag mode resolves $ref chains in one turn and reports cycles") {
+    ToolRegistry reg;
+    auto add = [&](const std::string& name, ToolHandler h) {
+        ToolSpec s;
+        s.name = name;
+        s.description = name;
+        s.parameters = {{"type","object"}};
+        s.handler = std::move(h);
+        reg.register_tool_spec(s);
+    };
+    add("get_user", [](const json& a){ return json{{"id", 42}, {"name", a.at("login")}}; });
+    add("get_orders", [](const json& a){
+        return json{{"user", a.at("user_id")}, {"orders", json::array({ json{{"id", "o-1"}}, json{{"id", "o-2"}} })}};
+    });
+    add("get_order_total", [](const json& a){ return json{{"order", a.at("order_id")}, {"total", 99.5}}; });
+    add("get_weather", [](const json&){
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        return json{{"temp_c", 21}};
+    });
+
+    // Recorded multi-hop turn: user -> orders -> total, plus one independent call.
+    json api_resp = json::parse(R"({"choices":[{"message":{"tool_calls":[
+        {"id":"call_u","function":{"name":"get_user","arguments":"{\"login\":\"ada\"}"}},
+        {"id":"call_o","function":{"name":"get_orders","arguments":"{\"user_id\":{\"$ref\":\"call_u.result.id\"}}"}},
+        {"id":"call_t","function":{"name":"get_order_total","arguments":"{\"order_id\":{\"$ref\":\"call_o.result.orders.1.id\"}}"}},
+        {"id":"call_w","function":{"name":"get_weather","arguments":"{}"}}
+    ]}}]})");
+
+    ToolRegistry::DagStats stats;
+    auto results = reg.process_remote_response_and_execute_dag(api_resp, &stats);
+    REQUIRE(results.size() == 4);
+    for (const auto& r : results) REQUIRE(r.error.empty());
+    REQUIRE(results[1].arguments.at("user_id") == 42);
+    REQUIRE(results[2].result.at("order") == "o-2");
+    REQUIRE(results[3].result.at("temp_c") == 21);
+    REQUIRE(stats.calls == 4);
+    REQUIRE(stats.edges == 2);
+    REQUIRE(stats.depth == 3);
+    REQUIRE(stats.round_trips_saved == 2);   // a hop-per-turn loop needs 3 model turns, dag mode 1
+
+    json cyclic = json::parse(R"({"choices":[{"message":{"tool_calls":[
+        {"id":"a","function":{"name":"get_user","arguments":"{\"login\":{\"$ref\":\"b.result.name\"}}"}},
+        {"id":"b","function":{"name":"get_user","arguments":"{\"login\":{\"$ref\":\"a.result.name\"}}"}},
+        {"id":"c","function":{"name":"get_user","arguments":"{\"login\":{\"$ref\":\"nope.result\"}}"}},
+        {"id":"d","function":{"name":"get_orders","arguments":"{\"user_id\":{\"$ref\":\"c.result.id\"}}"}},
+        {"id":"e","function":{"name":"get_user","arguments":"{\"login\":\"x\"}"}}
+    ]}}]})");
+    results = reg.process_remote_response_and_execute_dag(cyclic, &stats);
+    REQUIRE(results.size() == 5);
+    REQUIRE(results[0].error == "dependency cycle: a -> b -> a");
+    REQUIRE(results[1].error == "dependency cycle: b -> a -> b");
+    REQUIRE(results[2].error == "unresolved $ref: nope.result");
+    REQUIRE(results[3].error == "dependency failed: c");
+    REQUIRE(results[4].error.empty());
+    REQUIRE(stats.cycle_errors == 2);
+
+    // A call with a bad $ref that also sits on a cycle reports the bad $ref.
+    json both = json::parse(R"({"choices":[{"message":{"tool_calls":[
+        {"id":"f","function":{"name":"get_user","arguments":"{\"a\":{\"$ref\":\"g.result\"},\"b\":{\"$ref\":\"nope.result\"}}"}},
+        {"id":"g","function":{"name":"get_user","arguments":"{\"login\":{\"$ref\":\"f.result.name\"}}"}}
+    ]}}]})");
+    results = reg.process_remote_response_and_execute_dag(both, &stats);
+    REQUIRE(results.size() == 2);
+    REQUIRE(results[0].error == "unresolved $ref: nope.result");
+    REQUIRE(results[1].error == "dependency cycle: g -> f -> g");
+    REQUIRE(stats.cycle_errors == 1);
+}
+
+TEST_CASE("AgentLoop runs tool turns against the mock transport") {
+    ToolRegistry reg;
+    ToolSpec weather;
+    weather.name = "get_weather";
+    weather.description = "weather for a city";
+    weather.parameters = {{"type","object"}, {"properties", {{"city", {{"type","string"}}}}}, {"required", {"city"}}};
+    weather.handler = [](const json& args){
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        return json{{"city", args.at("city")}, {"temp_c", 18}};
+    };
+    reg.register_tool_spec(weather);
+
+    MockChatTransport server([](const json& req, size_t turn) -> json {
+        if (turn == 0) {
+            return MockChatTransport::tool_call_response({
+                ToolCall{"call_a", "get_weather", json{{"city", "Oslo"}}},
+                ToolCall{"", "get_weather", json{{"city", "Rome"}}}
+            });
+        }
+        return MockChatTransport::text_response("done after " + std::to_string(req.at("messages").size()) + " messages");
+    }, std::chrono::microseconds(2000));
+
+    AgentLoopOptions opts;
+    opts.model = "mock";
+    AgentLoop loop(reg, server, opts);
+    auto run = loop.run(json::array({ json{{"role","user"},{"content","weather in Oslo and Rome?"}} }));
+
+    REQUIRE(run.finished);
+    REQUIRE(run.turns.size() == 2);
+    REQUIRE(run.turns[0].tool_calls == 2);
+    REQUIRE(run.turns[0].model_us >= 2000);
+    REQUIRE(run.turns[0].tools_us >= 5000);
+    REQUIRE(run.final_message.at("content") == "done after 4 messages");
+
+    // user, assistant(tool_calls), tool, tool, assistant
+    REQUIRE(run.messages.size() == 5);
+    REQUIRE(run.messages[2].at("role") == "tool");
+    REQUIRE(run.messages[2].at("tool_call_id") == "call_a");
+    REQUIRE(json::parse(run.messages[2].at("content").get<std::string>()).at("city") == "Oslo");
+    const std::string synthesized = run.messages[3].at("tool_call_id");
+    REQUIRE(!synthesized.empty());
+    REQUIRE(run.messages[1].at("tool_calls")[1].at("id") == synthesized);
+
+    auto reqs = server.requests();
+    REQUIRE(reqs.size() == 2);
+    REQUIRE(reqs[0].at("model") == "mock");
+    REQUIRE(reqs[0].at("tools").size() == 1);
+    REQUIRE(reqs[1].at("messages") == json(std::vector<json>(run.messages.begin(), run.messages.end() - 1)));
+}
+
+TEST_CASE("AgentLoop replies to legacy and multi-choice calls with matching ids") {
+    ToolRegistry reg;
+    register_echo(reg);
+
+    MockChatTransport server([](const json&, size_t turn) -> json {
+        if (turn == 0) {    // legacy function_call: no tool_calls array, no id
+            return { {"choices", json::array({ { {"index", 0}, {"message", { {"role", "assistant"}, {"content", nullptr},
+                     {"function_call", { {"name", "echo"}, {"arguments", "{\"i\":1}"} }} }} } })} };
+        }
+        if (turn == 1) {    // one call in each of two choices
+            json r = MockChatTransport::tool_call_response({ ToolCall{"c_a", "echo", json{{"i", 2}}} });
+            r["choices"].push_back(MockChatTransport::tool_call_response({ ToolCall{"c_b", "echo", json{{"i", 3}}} })["choices"][0]);
+            return r;
+        }
+        return MockChatTransport::text_response("done");
+    });
+    AgentLoop loop(reg, server);
+    auto run = loop.run(json{{"role","user"},{"content","go"}});
+
+    REQUIRE(run.finished);
+    // user, assistant, tool, assistant, tool, tool, assistant
+    REQUIRE(run.messages.size() == 7);
+    const json& legacy = run.messages[1];
+    CHECK_FALSE(legacy.contains("function_call"));
+    REQUIRE(legacy.at("tool_calls").size() == 1);
+    CHECK(legacy["tool_calls"][0].at("id") == run.messages[2].at("tool_call_id"));
+    CHECK(json::parse(run.messages[2].at("content").get<std::string>()) == json{{"i", 1}});
+
+    const json& multi = run.messages[3];
+    REQUIRE(multi.at("tool_calls").size() == 2);
+    CHECK(multi["tool_calls"][0].at("id") == "c_a");
+    CHECK(multi["tool_calls"][1].at("id") == "c_b");
+    CHECK(run.messages[4].at("tool_call_id") == "c_a");
+    CHECK(run.messages[5].at("tool_call_id") == "c_b");
+    CHECK(json::parse(run.messages[5].at("content").get<std::string>()) == json{{"i", 3}});
+}
+
+TEST_CASE("ConversationBuilder serializes each message once across a 200-turn conversation") {
+    json head = { {"model", "m"}, {"tools", json::array({ json{{"name","t"},{"parameters",{{"type","object"}}}} })} };
+    ConversationBuilder conv(head);
+    json reference = head;
+    reference["messages"] = json::array();
+
+    std::uint64_t prev = conv.bytes_serialized();
+    for (int turn = 0; turn < 200; ++turn) {
+        json user = { {"role","user"}, {"content", "question " + std::to_string(turn)} };
+        json tool = { {"role","tool"}, {"tool_call_id", "c" + std::to_string(turn)}, {"content", std::string(100, 'x')} };
+        conv.append(user);
+        conv.append(tool);
+        reference["messages"].push_back(user);
+        reference["messages"].push_back(tool);
+
+        // Each turn pays only for its own two messages (plus separators).
+        REQUIRE(conv.bytes_serialized() - prev == user.dump().size() + tool.dump().size() + 2 - (turn == 0 ? 1 : 0));
+        prev = conv.bytes_serialized();
+    }
+
+    const std::string body = conv.str();
+    REQUIRE(body.size() == conv.body_size());
+    REQUIRE(json::parse(body) == reference);
+    REQUIRE(conv.segments().size() == 400 + 2);
+
+    // Scatter-gather straight to a file descriptor.
+    FILE* f = std::tmpfile();
+    REQUIRE(f != nullptr);
+    FdBodySink sink(fileno(f));
+    conv.write_to(sink);
+    std::string back(body.size(), '\0');
+    std::rewind(f);
+    REQUIRE(std::fread(&back[0], 1, back.size(), f) == back.size());
+    std::fclose(f);
+    REQUIRE(back == body);
+
+    conv.reset(json::object());
+    REQUIRE(conv.str() == R"({"messages":[]})");
+}
+
+TEST_CASE("tools_for_query ranks a large registry with BM25") {
+    ToolRegistry reg;
+    auto add = [&](const std::string& name, const std::string& desc, json props) {
+        ToolSpec s;
+        s.name = name;
+        s.description = desc;
+        s.parameters = {{"type","object"}, {"properties", std::move(props)}};
+        s.handler = [](const json&){ return json::object(); };
+        reg.register_tool_spec(s);
+    };
+    // 1,500 filler tools sharing generic vocabulary.
+    for (int i = 0; i < 1500; ++i) {
+        add("service_" + std::to_string(i) + "_op", "Performs internal operation " + std::to_string(i) + " on a record",
+            {{"record_id", {{"type","string"}}}});
+    }
+    add("get_current_weather", "Get the current weather forecast for a city",
+        {{"city", {{"type","string"}}}, {"units", {{"type","string"}}}});
+    add("sendEmail", "Send an email message to a recipient", {{"recipient", {{"type","string"}}}, {"subject", {{"type","string"}}}});
+    add("convert_currency", "Convert an amount between currencies", {{"amount", {{"type","number"}}}, {"to_currency", {{"type","string"}}}});
+
+    auto top = reg.tools_for_query("what's the weather like in Paris?", 3);
+    REQUIRE(top.size() == 3);
+    REQUIRE(top[0].at("name") == "get_current_weather");
+
+    // camelCase splitting and parameter names both count.
+    REQUIRE(reg.tools_for_query("email the recipient", 1)[0].at("name") == "sendEmail");
+    REQUIRE(reg.tools_for_query("to_currency amount", 1)[0].at("name") == "convert_currency");
+    // Trigrams tolerate a misspelling.
+    REQUIRE(reg.tools_for_query("currancy conversion", 1)[0].at("name") == "convert_currency");
+
+    REQUIRE(reg.tools_for_query("zzqx", 5).empty());
+    REQUIRE(reg.tools_for_query("weather", 0).empty());
+
+    // Registering more tools updates the index in place.
+    add("get_stock_quote", "Latest stock price quote for a ticker symbol", {{"ticker", {{"type","string"}}}});
+    REQUIRE(reg.tools_for_query("stock price for AAPL", 1)[0].at("name") == "get_stock_quote");
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < 100; ++i) reg.tools_for_query("send the weather forecast by email", 8);
+    auto per_query_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count() / 100;
+    REQUIRE(per_query_us < 5000);   // a few hundred microseconds in Release builds; generous for Debug/CI
+}
+
+TEST_CASE("stable tools payload is append-only across registrations") {
+    ToolRegistry reg;
+    auto add = [&](const std::string& name) {
+        ToolSpec s;
+        s.name = name;
+        s.description = "tool " + name;
+        s.parameters = {{"type","object"}, {"properties", {{"ratio", {{"type","number"}, {"default", 0.1}}}}}};
+        s.handler = [](const json&){ return json::object(); };
+        reg.register_tool_spec(s);
+    };
+    add("zeta");
+    add("alpha");
+
+    PrefixReport rep;
+    const std::string p1 = reg.tools_for_openai_string(ToolOrder::stable, &rep);
+    REQUIRE(rep.previous_bytes == 0);
+    REQUIRE(json::parse(p1)[0].at("name") == "zeta");        // registration order, not by name
+    REQUIRE(reg.tools_for_openai_string(ToolOrder::stable, &rep) == p1);
+    REQUIRE(rep.common_prefix_bytes == p1.size());
+
+    // "beta" would sort into the middle by name; stable order appends it.
+    const std::string by_name_before = reg.tools_for_openai_string();
+    add("beta");
+    const std::string p2 = reg.tools_for_openai_string(ToolOrder::stable, &rep);
+    REQUIRE(p2.compare(0, p1.size() - 1, p1, 0, p1.size() - 1) == 0);
+    REQUIRE(rep.common_prefix_bytes == p1.size() - 1);      // everything but the closing ']'
+    REQUIRE(rep.reuse_ratio > 0.6);
+    const std::string by_name_after = reg.tools_for_openai_string();
+    auto lcp = std::mismatch(by_name_before.begin(), by_name_before.end(), by_name_after.begin()).first - by_name_before.begin();
+    REQUIRE(static_cast<size_t>(lcp) < rep.common_prefix_bytes);
+
+    REQUIRE(json::parse(p2) == reg.tools_for_openai(ToolOrder::stable));
+    REQUIRE(reg.tools_for_openai(ToolOrder::by_name) == reg.tools_for_openai());
+
+    reg.pin_tools({"beta", "missing", "beta"});
+    auto pinned = reg.tools_for_openai(ToolOrder::stable);
+    REQUIRE(pinned.size() == 3);
+    REQUIRE(pinned[0].at("name") == "beta");
+    REQUIRE(pinned[1].at("name") == "zeta");
+    REQUIRE(pinned[2].at("name") == "alpha");
+}
+
+TEST_CASE("schema optimization hoists shared definitions and drops no-op keywords") {
+    const json address = {
+        {"type","object"},
+        {"title","Address"},
+        {"properties", {{"street", {{"type","string"}, {"description",""}}},
+                        {"city", {{"type","string"}}},
+                        {"postcode", {{"type","string"}, {"minLength", 0}}}}},
+        {"required", {"street","city"}},
+        {"additionalProperties", true}
+    };
+    ToolSpec s;
+    s.name = "ship_order";
+    s.description = "Ship an order from one address to another, choosing the cheapest carrier that meets the deadline";
+    s.parameters = {{"type","object"}, {"$comment","generated"},
+                    {"properties", {{"from", address}, {"to", address}, {"return_to", address},
+                                    {"express", {{"type","boolean"}, {"default", nullptr}}}}},
+                    {"required", json::array()}};
+    s.handler = [](const json& a){ return json{{"city", a.at("to").at("city")}}; };
+
+    SchemaOptimizeOptions opts;
+    opts.hoist_shared_definitions = true;
+    opts.max_description_bytes = 40;
+
+    ToolRegistry reg;
+    reg.set_schema_optimization(opts);
+    reg.register_tool_spec(s);
+
+    const json emitted = reg.tools_for_openai(ToolOrder::stable)[0];
+    const json& params = emitted.at("parameters");
+    REQUIRE(params.at("$defs").size() == 1);
+    const std::string def = params.at("$defs").begin().key();
+    REQUIRE(def == "from");                                           // named after the first occurrence
+    for (const char* p : {"from", "to", "return_to"})
+        REQUIRE(params.at("properties").at(p) == json{{"$ref", "#/$defs/from"}});
+    const json& hoisted = params.at("$defs").at(def);
+    REQUIRE(hoisted.contains("title"));                               // "Address" does not restate "from"
+    REQUIRE_FALSE(hoisted.contains("additionalProperties"));
+    REQUIRE_FALSE(hoisted.at("properties").at("street").contains("description"));
+    REQUIRE(hoisted.at("required") == json{"street","city"});         // non-empty required is kept
+    REQUIRE_FALSE(params.contains("required"));
+    REQUIRE_FALSE(params.contains("$comment"));
+    REQUIRE_FALSE(params.at("properties").at("express").contains("default"));
+    REQUIRE(emitted.at("description").get<std::string>().size() <= 40);
+    REQUIRE(emitted.at("description").get<std::string>().compare(0, 24, "Ship an order from one a") == 0);
+
+    const auto& rep = reg.schema_report("ship_order");
+    REQUIRE(rep.hoisted_definitions == 1);
+    REQUIRE(rep.truncated_descriptions == 1);
+    REQUIRE(rep.dropped_keywords >= 7);
+    REQUIRE(rep.optimized_bytes < rep.original_bytes);
+    REQUIRE(rep.saved_tokens() > 0);
+    REQUIRE_THROWS(reg.schema_report("missing"));
+
+    // Retrieval still indexes the full description; calls are unaffected.
+    REQUIRE(reg.tools_for_query("cheapest carrier deadline", 1)[0].at("name") == "ship_order");
+    json args = {{"from", {{"street","a"},{"city","x"}}}, {"to", {{"street","b"},{"city","y"}}}};
+    REQUIRE(reg.invoke("ship_order", args).at("city") == "y");
+
+    // Without hoisting nothing is moved into $defs.
+    const json plain = optimize_schema(json{{"name","t"},{"parameters", s.parameters}}, SchemaOptimizeOptions());
+    REQUIRE_FALSE(plain.at("parameters").contains("$defs"));
+
+    // Definition names stay valid in a JSON pointer whatever the property is called.
+    json odd = s.parameters;
+    odd["properties"] = {{"a~/b", address}, {"x", address}, {"y", address}};
+    const json hoisted_odd = optimize_schema(json{{"name","t"},{"parameters", odd}}, opts).at("parameters");
+    const std::string ref = hoisted_odd.at("properties").at("x").at("$ref");
+    REQUIRE(ref == "#/$defs/a__b");
+    REQUIRE(hoisted_odd.at(json::json_pointer(ref.substr(1))).at("required") == json{"street","city"});
+    REQUIRE(estimate_tokens("") == 0);
+    REQUIRE(estimate_tokens("{\"type\":\"string\"}") == 10);   // 7 punctuation + type + str/ing
+}
+
+TEST_CASE("per-tool metrics count calls and errors and export Prometheus text") {
+    REQUIRE(LatencyHistogram::bucket_for(0) == 0);
+    REQUIRE(LatencyHistogram::bucket_for(31) == 31);
+    for (std::uint64_t v : {32ull, 1000ull, 123456ull, 987654321ull}) {
+        const size_t b = LatencyHistogram::bucket_for(v);
+        REQUIRE(LatencyHistogram::bucket_upper(b) >= v);
+        REQUIRE(LatencyHistogram::bucket_upper(b - 1) < v);
+        REQUIRE(LatencyHistogram::bucket_upper(b) - v <= v / 16);     // ~6% precision
+    }
+
+    ToolRegistry reg;
+    reg.register_tool("slow", [](const json&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        return json{{"ok", true}};
+    }, {{"name","slow"}});
+    reg.register_tool("bad\"tool", [](const json& a) -> json {
+        if (a.value("fail", false)) throw std::runtime_error("boom");
+        return json::object();
+    }, {{"name","bad\"tool"}});
+
+    json resp = {{"choices", json::array()}};
+    for (int i = 0; i < 8; ++i) {
+        resp["choices"].push_back({{"message", {{"tool_calls", {{{"id", "c" + std::to_string(i)},
+            {"function", {{"name", "slow"}, {"arguments", "{\"n\":" + std::to_string(i) + "}"}}}}}}}}});
+    }
+    auto results = reg.process_remote_response_and_execute(resp, true);
+    REQUIRE(results.size() == 8);
+    for (const auto& r : results) {
+        REQUIRE(r.exec_ns >= 2000000);
+        REQUIRE(r.serialize_ns > 0);
+    }
+    reg.invoke("bad\"tool", json::object());
+    REQUIRE_THROWS(reg.invoke("bad\"tool", {{"fail", true}}));
+    REQUIRE_THROWS(reg.invoke("missing", json::object()));
+
+    const ToolMetrics slow = reg.tool_metrics("slow");
+    REQUIRE(slow.calls == 8);
+    REQUIRE(slow.errors == 0);
+    REQUIRE(slow.exec.count() == 8);
+    REQUIRE(slow.exec.percentile(0.5) >= 2000000);
+    REQUIRE(slow.exec.percentile(1.0) == slow.exec.max_ns());
+    REQUIRE(slow.queue.count() == 8);
+    const ToolMetrics bad = reg.tool_metrics("bad\"tool");
+    REQUIRE(bad.calls == 2);
+    REQUIRE(bad.errors == 1);
+    REQUIRE(reg.tool_metrics("missing").calls == 0);
+
+    const std::string text = reg.metrics_prometheus();
+    REQUIRE(text.find("# TYPE lct_tool_exec_seconds histogram") != std::string::npos);
+    REQUIRE(text.find("lct_tool_calls_total{tool=\"slow\"} 8\n") != std::string::npos);
+    REQUIRE(text.find("lct_tool_errors_total{tool=\"bad\\\"tool\"} 1\n") != std::string::npos);
+    REQUIRE(text.find("lct_tool_exec_seconds_bucket{tool=\"slow\",le=\"+Inf\"} 8\n") != std::string::npos);
+    REQUIRE(text.find("lct_tool_exec_seconds_bucket{tool=\"slow\",le=\"0.001\"} 0\n") != std::string::npos);
+    REQUIRE(text.find("lct_tool_exec_seconds_bucket{tool=\"slow\",le=\"1\"} 8\n") != std::string::npos);
+
+    // Export bounds fall inside HDR buckets ([992, 1023] holds 1 us); values
+    // on either side of a bound still land on the right side of it.
+    StreamTotals totals;
+    for (std::uint64_t ns : {999ull, 1000ull, 1001ull, 1023ull}) {
+        StreamStats st;
+        st.calls = 1;
+        st.first_call_ns = ns;
+        totals.add(st);
+    }
+    const std::string ttfc = render_prometheus(totals);
+    REQUIRE(ttfc.find("lct_stream_time_to_first_call_seconds_bucket{le=\"1e-06\"} 2\n") != std::string::npos);
+    REQUIRE(ttfc.find("lct_stream_time_to_first_call_seconds_bucket{le=\"5e-06\"} 4\n") != std::string::npos);
+    REQUIRE(ttfc.find("lct_stream_time_to_first_call_seconds_count 4\n") != std::string::npos);
+}
+
+TEST_CASE("tool metrics give every thread its own shard past the first block") {
+    ToolMetricsTable table;
+    table.add("t");
+    const int threads = 3 * static_cast<int>(ToolMetricsTable::shard_count) + 5;
+    const int per_thread = 2000;
+    std::atomic<int> arrived{0}, finished{0};
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            ++arrived;
+            while (arrived.load() < threads) std::this_thread::yield();   // all alive at once
+            for (int i = 0; i < per_thread; ++i) table.record("t", 10, 1000 + t, 5, i % 100 == 0);
+            ++finished;
+            while (finished.load() < threads) std::this_thread::yield();
+        });
+    }
+    for (auto& th : pool) th.join();
+
+    const ToolMetricsTable copy(table);
+    for (const ToolMetrics& m : {table.snapshot("t"), copy.snapshot("t")}) {
+        CHECK(m.calls == static_cast<std::uint64_t>(threads * per_thread));
+        CHECK(m.errors == static_cast<std::uint64_t>(threads * per_thread / 100));
+        CHECK(m.exec.count() == static_cast<std::uint64_t>(threads * per_thread));
+        CHECK(m.exec.max_ns() == static_cast<std::uint64_t>(1000 + threads - 1));
+        CHECK(m.queue.sum_ns() == static_cast<std::uint64_t>(10 * threads * per_thread));
+    }
+}
+
+TEST_CASE("registries copy and move with their tools, settings and counters") {
+    ToolRegistry reg;
+    register_echo(reg);
+    reg.invoke("echo", json{{"i", 1}});
+
+    ToolRegistry copy = reg;
+    CHECK(copy.invoke("echo", json{{"i", 2}}) == json{{"i", 2}});
+    CHECK(copy.tool_metrics("echo").calls == 2);
+    CHECK(reg.tool_metrics("echo").calls == 1);     // counters are cloned, not shared
+    CHECK(copy.tools_for_openai_string() == reg.tools_for_openai_string());
+
+    ToolRegistry moved = std::move(copy);
+    CHECK(moved.invoke("echo", json{{"i", 3}}) == json{{"i", 3}});
+    CHECK(moved.tool_metrics("echo").calls == 3);
+
+    ToolRegistry assigned;
+    assigned = reg;
+    CHECK(assigned.tool_metrics("echo").calls == 1);
+    assigned = std::move(moved);
+    CHECK(assigned.tool_metrics("echo").calls == 3);
+    static_assert(std::is_copy_constructible_v<ToolRegistry> && std::is_move_assignable_v<ToolRegistry>);
+}
+
+TEST_CASE("tracer sees span boundaries and the Chrome exporter writes trace events") {
+    struct Recorder : Tracer {
+        std::mutex m;
+        std::vector<std::pair<TracePoint, std::string>> events;
+        void record(TracePoint p, std::string_view tool, std::string_view, std::uint64_t) override {
+            std::lock_guard<std::mutex> lock(m);
+            events.emplace_back(p, std::string(tool));
+        }
+    };
+
+    ToolRegistry reg;
+    register_echo(reg);
+    auto rec = std::make_shared<Recorder>();
+    reg.set_tracer(rec);
+
+    auto source = echo_stream(3);
+    long chunks = 0;
+    size_t delivered = 0;
+    reg.process_streaming_response_and_execute(
+        [&](std::string& out) { return source(out) && ++chunks; },
+        [&](const ToolRegistry::ExecutionResult&) { ++delivered; });
+    REQUIRE(delivered == 3);
+
+    auto count = [&](TracePoint p) {
+        return std::count_if(rec->events.begin(), rec->events.end(), [&](const auto& e) { return e.first == p; });
+    };
+    REQUIRE(count(TracePoint::chunk_received) == chunks);
+    REQUIRE(count(TracePoint::value_extracted) == 3);
+    REQUIRE(count(TracePoint::call_dispatched) == 3);
+    REQUIRE(count(TracePoint::handler_begin) == 3);
+    REQUIRE(count(TracePoint::handler_end) == 3);
+    REQUIRE(count(TracePoint::result_delivered) == 3);
+    // Per call: dispatched -> begin -> end -> delivered.
+    std::vector<TracePoint> call_events;
+    for (const auto& e : rec->events) if (!e.second.empty()) call_events.push_back(e.first);
+    REQUIRE(call_events[0] == TracePoint::call_dispatched);
+    REQUIRE(call_events[1] == TracePoint::handler_begin);
+    REQUIRE(call_events[2] == TracePoint::handler_end);
+    REQUIRE(call_events[3] == TracePoint::result_delivered);
+
+    const char* path = "lct_trace_test.json";
+    {
+        auto exporter = std::make_shared<ChromeTraceExporter>(path);
+        reg.set_tracer(exporter);
+        json resp = {{"choices", json::array()}};
+        for (int i = 0; i < 4; ++i)
+            resp["choices"].push_back({{"message", {{"tool_calls", {{{"id", "c" + std::to_string(i)},
+                {"function", {{"name", "echo"}, {"arguments", "{\"i\":1}"}}}}}}}}});
+        reg.process_remote_response_and_execute(resp, true);
+        reg.set_tracer(nullptr);
+        REQUIRE(exporter->dropped() == 0);
+    }
+    std::FILE* f = std::fopen(path, "r");
+    REQUIRE(f);
+    std::string text;
+    char buf[4096];
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) text.append(buf, n);
+    std::fclose(f);
+    std::remove(path);
+
+    const json trace = json::parse(text);
+    REQUIRE(trace.size() == 8);
+    std::set<int> tids;
+    for (const auto& e : trace) {
+        REQUIRE(e.at("name") == "echo");
+        REQUIRE(e.at("cat") == "lct");
+        tids.insert(e.at("tid").get<int>());
+    }
+    REQUIRE(tids.size() >= 1);
+    REQUIRE(std::count_if(trace.begin(), trace.end(), [](const json& e) { return e.at("ph") == "B"; }) == 4);
+
+    // Threads that come and go one after another share a single ring.
+    {
+        ChromeTraceExporter exporter(path);
+        for (int i = 0; i < 20; ++i) {
+            std::thread([&] { exporter.record(TracePoint::call_dispatched, "echo", "c" + std::to_string(i), 0); }).join();
+        }
+    }
+    f = std::fopen(path, "r");
+    REQUIRE(f);
+    text.clear();
+    for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) text.append(buf, n);
+    std::fclose(f);
+    std::remove(path);
+    const json reused = json::parse(text);
+    REQUIRE(reused.size() == 20);
+    for (size_t i = 0; i < reused.size(); ++i) {
+        REQUIRE(reused[i].at("tid") == 1);
+        REQUIRE(reused[i].at("args").at("call_id") == "c" + std::to_string(i));
+    }
+}
+
+TEST_CASE("streaming stats count bytes, values, failures and time to first call") {
+    ToolRegistry reg;
+    register_echo(reg);
+
+    const std::string body =
+        "data: " R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"echo","arguments":"{\"i\":1}"}}]}}]})" "\n\n"
+        "data: {\"usage\": 5}\n\n"                    // a value with no tool call
+        "data: {oops: 1}\n\n"                         // balanced but not JSON
+        "data: " R"({"choices":[{"message":{"tool_calls":[{"function":{"name":"echo","arguments":"{\"i\":2}"}}]}}]})" "\n\n"
+        "data: {\"choices\": [";                      // cut off
+    size_t pos = 0;
+    size_t delivered = 0;
+    StreamStats st;
+    reg.process_streaming_response_and_execute(
+        [&](std::string& out) {
+            if (pos >= body.size()) return false;
+            out = body.substr(pos, 16);
+            pos += 16;
+            return true;
+        },
+        [&](const ToolRegistry::ExecutionResult&) { ++delivered; }, false, &st);
+
+    REQUIRE(delivered == 2);
+    REQUIRE(st.bytes == body.size());
+    REQUIRE(st.chunks == (body.size() + 15) / 16);
+    REQUIRE(st.values == 4);
+    REQUIRE(st.calls == 2);
+    REQUIRE(st.syntax_errors == 1);
+    REQUIRE(st.truncated == 1);
+    REQUIRE(st.dispatch_errors == 0);
+    REQUIRE(st.dropped_bytes == 4 * std::string("\n\ndata: ").size() + std::string("data: {\"choices\": [").size());   // SSE framing + the tail
+    REQUIRE(st.peak_buffer_bytes > 16);
+    REQUIRE(st.peak_buffer_bytes < body.size());
+    REQUIRE(st.first_call_ns > 0);
+
+    {
+        ToolRegistry::StreamSession session(reg, [](const ToolRegistry::ExecutionResult&) {});
+        session.feed("{\"x\":1}");
+        REQUIRE(session.stats().values == 1);
+        REQUIRE(session.stats().calls == 0);
+        session.feed("\n\ndata: [DONE]\n\n");                  // SSE sentinel is framing, not a bad value
+        session.finish();
+        REQUIRE(session.stats().values == 1);
+        REQUIRE(session.stats().syntax_errors == 0);
+        REQUIRE(session.stats().dropped_bytes == 16);
+    }
+
+    const StreamTotals totals = reg.stream_stats();
+    REQUIRE(totals.streams == 2);
+    REQUIRE(totals.sum.values == 5);
+    REQUIRE(totals.sum.syntax_errors == 1);
+    REQUIRE(totals.time_to_first_call.count() == 1);
+
+    const std::string text = reg.metrics_prometheus();
+    REQUIRE(text.find("lct_stream_sessions_total 2\n") != std::string::npos);
+    REQUIRE(text.find("lct_stream_parse_failures_total{category=\"syntax\"} 1\n") != std::string::npos);
+    REQUIRE(text.find("lct_stream_parse_failures_total{category=\"truncated\"} 1\n") != std::string::npos);
+    REQUIRE(text.find("lct_stream_time_to_first_call_seconds_count 1\n") != std::string::npos);
+    REQUIRE(text.find("lct_tool_calls_total{tool=\"echo\"} 2\n") != std::string::npos);
+}
+
+TEST_CASE("hot paths stay within their allocation budgets") {
+    REQUIRE(allocation_hook_installed());
+
+    ToolRegistry reg;
+    reg.register_tool("noop", [](const json&) { return json(); }, {{"name","noop"}});
+    for (int i = 0; i < 9; ++i) reg.register_tool("t" + std::to_string(i), [](const json&) { return json(); }, {{"name", "t"}});
+    const json args = {{"city", "Oslo"}};
+    const json resp = {{"choices", {{{"message", {{"tool_calls", {{{"id", "c1"},
+        {"function", {{"name", "noop"}, {"arguments", "{\"city\":\"Oslo\"}"}}}}}}}}}}}};
+    const std::string chunk = resp.dump();
+
+    // Measures `op` once warm (metrics cells, stable payload cache...); the
+    // least of a few runs, since a latency in a new power of two allocates a
+    // histogram block once.
+    auto allocs = [](auto&& op) {
+        op();
+        std::uint64_t least = ~std::uint64_t(0);
+        for (int i = 0; i < 3; ++i) {
+            AllocationScope scope;
+            op();
+            least = std::min<std::uint64_t>(least, scope.delta().allocations);
+        }
+        return least;
+    };
+    const auto invoke = allocs([&] { reg.invoke("noop", args); });
+    const auto find = allocs([&] { ToolRegistry::find_tool_calls(resp); });
+    const auto execute = allocs([&] { reg.process_remote_response_and_execute(resp); });
+    const auto stable = allocs([&] { reg.tools_for_openai_string(ToolOrder::stable); });
+    const auto stream = allocs([&] {
+        ToolRegistry::StreamSession s(reg, [](const ToolRegistry::ExecutionResult&) {});
+        s.feed(chunk);
+        s.finish();
+    });
+    // Ceilings sit a little above today's counts (0 / 12 / 13 / 1 / 50 with
+    // nlohmann 3.11, libstdc++); lower them when a change saves allocations.
+    CHECK(invoke == 0);
+    CHECK(find <= 13);          // one call: id, name, decoded arguments and their handle, the vector
+    CHECK(execute <= 15);
+    CHECK(stable <= 1);         // the returned string
+    CHECK(stream <= 56);
+}
+
+#ifdef __linux__
+TEST_CASE("WorkerPool runs routed tools out of process and survives crashes") {
+    ToolRegistry reg;
+    const std::string warm = "loaded before the fork";
+    reg.register_tool("work", [warm](const json& a) {
+        const std::string mode = a.value("mode", "");
+        if (mode == "crash") std::raise(SIGSEGV);
+        if (mode == "hang") std::this_thread::sleep_for(std::chrono::seconds(30));
+        if (mode == "throw") throw std::runtime_error("bad input");
+        if (mode == "body") set_result_body(ResultBody::from_string("stays in the worker"));
+        return json{{"pid", static_cast<long>(::getpid())}, {"warm", warm}, {"echo", a.value("x", 0)}};
+    }, {{"name","work"}});
+    reg.register_tool("local", [](const json&) { return json(static_cast<long>(::getpid())); }, {{"name","local"}});
+
+    WorkerPool::Options opts;
+    opts.workers = 2;
+    opts.slot_bytes = 4096;
+    opts.call_timeout = std::chrono::milliseconds(300);
+    auto pool = std::make_shared<WorkerPool>(reg, opts);
+    WorkerPool::route(reg, pool, {"work"});
+
+    const json ok = reg.invoke("work", {{"x", 7}});
+    CHECK(ok.at("echo") == 7);
+    CHECK(ok.at("warm") == warm);
+    CHECK(ok.at("pid").get<long>() != static_cast<long>(::getpid()));
+    CHECK(reg.invoke("local", json::object()).get<long>() == static_cast<long>(::getpid()));
+    CHECK(reg.invoke_local("work", {{"x", 1}}).at("pid").get<long>() == static_cast<long>(::getpid()));
+
+    // Handler errors, crashes and hangs come back as per-call errors.
+    auto call = [](const char* id, const char* args) {
+        return json{{"id", id}, {"function", {{"name", "work"}, {"arguments", args}}}};
+    };
+    const json tool_calls = json::array({ call("a", R"({"mode":"throw"})"), call("b", R"({"mode":"crash"})"),
+                                          call("c", R"({"x":3})") });
+    const json resp = {{"choices", {{{"message", {{"tool_calls", tool_calls}}}}}}};
+    const auto results = reg.process_remote_response_and_execute(resp, true);
+    REQUIRE(results.size() == 3);
+    CHECK(results[0].error == "bad input");
+    CHECK(results[1].error.find("killed by signal " + std::to_string(SIGSEGV)) != std::string::npos);
+    CHECK(results[2].result.at("echo") == 3);
+    auto error_of = [&](const json& args) {
+        try { reg.invoke("work", args); } catch (const std::exception& e) { return std::string(e.what()); }
+        return std::string();
+    };
+    CHECK(error_of({{"mode", "hang"}}).find("timed out") != std::string::npos);
+    CHECK(error_of({{"x", std::string(5000, 'x')}}).find("exceeds slot_bytes") != std::string::npos);
+    // A result body can't cross back; the worker says so and keeps none.
+    CHECK(error_of({{"mode", "body"}}).find("set a result body") != std::string::npos);
+
+    // Replacements serve the next calls; the tool's error count saw all of it.
+    for (int i = 0; i < 4; ++i) CHECK(reg.invoke("work", {{"x", i}}).at("echo") == i);
+    const auto st = pool->stats();
+    CHECK(st.crashes == 2);
+    CHECK(st.restarts == 2);
+    CHECK(st.timeouts == 1);
+    CHECK(reg.tool_metrics("work").errors == 5);
+}
+#endif
+
+TEST_CASE("large arguments are materialized once from parse to delivery") {
+    ToolRegistry reg;
+    std::mutex mutex;
+    std::set<const json*> seen;
+    reg.register_tool("size", [&](const json& a) {
+        std::lock_guard<std::mutex> lock(mutex);
+        seen.insert(&a);
+        return json{{"bytes", a.at("blob").get_ref<const std::string&>().size()}};
+    }, {{"name","size"}});
+
+    const std::string blob(10 * 1024 * 1024, 'x');
+    json calls = json::array();
+    for (int i = 0; i < 2; ++i) {
+        calls.push_back({{"id", "c" + std::to_string(i)},
+                         {"function", {{"name", "size"}, {"arguments", json{{"blob", blob}}.dump()}}}});
+    }
+    const json resp = {{"choices", {{{"message", {{"tool_calls", calls}}}}}}};
+
+    // What decoding the arguments costs on its own (the lexer's buffers
+    // included); execution must not add a copy on top of it.
+    const AllocationScope decode_scope;
+    ToolRegistry::find_tool_calls(resp);
+    const auto decode_bytes = decode_scope.delta().bytes;
+
+    for (bool concurrent : {false, true}) {
+        seen.clear();
+        const AllocationScope scope;
+        const auto results = reg.process_remote_response_and_execute(resp, concurrent);
+        REQUIRE(results.size() == 2);
+        for (const auto& r : results) {
+            CHECK(r.result.at("bytes") == blob.size());
+            CHECK(seen.count(&*r.arguments) == 1);   // the handler saw this very object
+            CHECK(r.arguments.use_count() == 1);     // nothing else kept a copy
+        }
+        const auto copy = results[0];
+        CHECK(copy.arguments.use_count() == 2);
+        CHECK(&*copy.result == &*results[0].result);
+        if (allocation_hook_installed()) CHECK(scope.delta().bytes < decode_bytes + blob.size() / 2);
+    }
+
+    // The const json read API carries over.
+    const SharedJson v = json{{"flag", true}, {"n", 3}, {"x", 0.5}, {"list", {1, 2}}};
+    size_t keys = 0;
+    for (const auto& item : v.items()) keys += !item.key().empty();
+    CHECK(keys == 4);
+    CHECK(v["flag"].is_boolean());
+    CHECK(v.find("n") != v.end());
+    CHECK(v.count("missing") == 0);
+    CHECK(SharedJson(json(true)).is_boolean());
+    CHECK(SharedJson(json(3)).is_number_integer());
+    CHECK(SharedJson(json(0.5)).is_number_float());
+    CHECK(SharedJson(json::array({1, 2})).back() == 2);
+    CHECK(SharedJson(json("s")).get_ref<const std::string&>() == "s");
+    CHECK(v.dump(-1, ' ', true) == json(*v).dump(-1, ' ', true));
+}
+
+TEST_CASE("arena-backed parsing matches the heap path with fewer allocations") {
+    Arena scratch;
+    {
+        ArenaScope scope(scratch);
+        arena_json v = arena_json::parse(R"({"a":[1,2,{"b":"a string longer than SSO"}]})");
+        json copy = v["a"];
+        CHECK(copy[2]["b"] == "a string longer than SSO");
+        CHECK(scratch.bytes_used() > 0);
+    }
+    scratch.reset();
+    CHECK(scratch.bytes_used() == 0);
+    CHECK(scratch.bytes_reserved() > 0);   // kept for the next request
+
+    ToolRegistry reg;
+    reg.register_tool("echo", [](const json& a) { return a; }, {{"name","echo"}});
+    json calls = json::array();
+    for (int i = 0; i < 8; ++i) {
+        calls.push_back({{"id", "c" + std::to_string(i)},
+                         {"function", {{"name", i % 2 ? "echo" : "missing"},
+                                       {"arguments", json{{"i", i}, {"pad", std::string(64, 'x')}}.dump()}}}});
+    }
+    const std::string body = json{{"choices", {{{"message", {{"tool_calls", calls}}}}}}}.dump();
+
+    Arena arena;
+    const auto heap = reg.process_remote_response_and_execute(json::parse(body));
+    const auto pooled = reg.process_remote_response_and_execute(body, arena);
+    REQUIRE(pooled.size() == heap.size());
+    for (size_t i = 0; i < heap.size(); ++i) {
+        CHECK(pooled[i].call_id == heap[i].call_id);
+        CHECK(pooled[i].tool_name == heap[i].tool_name);
+        CHECK(pooled[i].arguments == heap[i].arguments);
+        CHECK(pooled[i].result == heap[i].result);
+        CHECK(pooled[i].error == heap[i].error);
+    }
+    CHECK(arena.bytes_used() == 0);
+    CHECK_THROWS_AS(reg.process_remote_response_and_execute(std::string_view("{\"choices\":"), arena), json::parse_error);
+
+    std::vector<std::string> streamed;
+    ToolRegistry::StreamSession s(reg, [&](const ToolRegistry::ExecutionResult& r) { streamed.push_back(r.call_id); });
+    s.use_arena(arena);
+    s.feed(body.substr(0, body.size() / 2));
+    s.feed(body.substr(body.size() / 2));
+    s.finish();
+    CHECK(streamed.size() == heap.size());
+    CHECK(arena.bytes_used() == 0);
+
+    if (allocation_hook_installed()) {
+        auto allocs = [](auto&& op) {
+            op();
+            AllocationScope scope;
+            op();
+            return scope.delta().allocations;
+        };
+        const auto with_heap = allocs([&] { reg.process_remote_response_and_execute(json::parse(body)); });
+        const auto with_arena = allocs([&] { reg.process_remote_response_and_execute(body, arena); });
+        CHECK(with_arena < with_heap);
+    }
+}
+
+TEST_CASE("result bodies reach the request body without a copy") {
+    const std::string tricky = "say \"hi\"\\\n\t\x01 caf\xC3\xA9";
+    auto safe = ResultBody::from_string("plain text, caf\xC3\xA9 \xF0\x9F\x98\x80");
+    auto unsafe = ResultBody::from_string(tricky);
+    CHECK(safe->json_safe());
+    CHECK_FALSE(unsafe->json_safe());
+    CHECK("\"" + unsafe->escaped() + "\"" == json(tricky).dump());
+    const std::string broken = "ok \xC3 \xED\xA0\x80 end";
+    CHECK("\"" + ResultBody::from_string(broken)->escaped() + "\"" ==
+          json(broken).dump(-1, ' ', false, json::error_handler_t::replace));
+
+    // A file-backed body from an unaligned offset, going out through sendfile.
+    FILE* src = std::tmpfile();
+    REQUIRE(src != nullptr);
+    const std::string payload(300000, 'r');
+    const std::string file = std::string(5000, '#') + payload + "trailer";
+    REQUIRE(std::fwrite(file.data(), 1, file.size(), src) == file.size());
+    std::fflush(src);
+    auto mapped = ResultBody::from_fd(fileno(src), 5000, payload.size());
+    std::fclose(src);    // the body holds its own descriptor
+    REQUIRE(mapped->view() == payload);
+    REQUIRE(mapped->fd() >= 0);
+
+    ConversationBuilder conv(json{{"model", "m"}});
+    conv.append(json{{"role", "user"}, {"content", "dump it"}});
+    const AllocationScope scope;
+    conv.append_tool_result("c1", mapped);
+    const auto appended = scope.delta();
+    conv.append_tool_result("c2", unsafe);
+    conv.append_tool_result("c3", safe);
+    if (allocation_hook_installed()) CHECK(appended.bytes < 1024);
+    CHECK(conv.bytes_serialized() < 1024 + tricky.size() * 2);
+
+    const std::string body = conv.str();
+    CHECK(body.size() == conv.body_size());
+    const json parsed = json::parse(body);
+    CHECK(parsed.at("messages")[1] == json{{"role", "tool"}, {"tool_call_id", "c1"}, {"content", payload}});
+    CHECK(parsed.at("messages")[2].at("content") == tricky);
+    CHECK(parsed.at("messages")[3].at("content") == std::string(safe->view()));
+
+    FILE* out = std::tmpfile();
+    REQUIRE(out != nullptr);
+    FdBodySink sink(fileno(out));
+    conv.write_to(sink);
+    std::string back(body.size(), '\0');
+    std::rewind(out);
+    REQUIRE(std::fread(&back[0], 1, back.size(), out) == back.size());
+    std::fclose(out);
+    CHECK(back == body);
+
+    // Through the agent loop: the handler attaches the body, the next request carries it.
+    ToolRegistry reg;
+    reg.register_tool("dump", [&](const json&) {
+        set_result_body(mapped);
+        return json{{"bytes", mapped->size()}};
+    }, {{"name", "dump"}});
+    MockChatTransport server([&](const json& req, size_t turn) -> json {
+        if (turn == 0) return MockChatTransport::tool_call_response({ ToolCall{"d1", "dump", json::object()} });
+        return MockChatTransport::text_response(req.at("messages").back().at("content") == payload ? "got it" : "wrong");
+    });
+    AgentLoop loop(reg, server);
+    auto run = loop.run(json::array({ json{{"role", "user"}, {"content", "dump"}} }));
+    REQUIRE(run.finished);
+    CHECK(run.final_message.at("content") == "got it");
+    REQUIRE(run.bodies.size() == 1);
+    CHECK(run.bodies.begin()->second == mapped);
+    CHECK(run.messages[run.bodies.begin()->first].at("content").is_null());
+
+    const auto results = reg.process_remote_response_and_execute(
+        MockChatTransport::tool_call_response({ ToolCall{"d2", "dump", json::object()} }));
+    REQUIRE(results.size() == 1);
+    CHECK(results[0].body == mapped);
+    CHECK(results[0].result.at("bytes") == payload.size());
+    reg.invoke("dump", json::object());     // drops the body; nothing leaks into the next call
+    reg.register_tool("plain", [](const json&) { return json(1); }, {{"name", "plain"}});
+    CHECK(reg.process_remote_response_and_execute(
+        MockChatTransport::tool_call_response({ ToolCall{"p", "plain", json::object()} }))[0].body == nullptr);
+}
+
+TEST_CASE("result bodies that need escaping are not copied either") {
+    std::string text;
+    for (int i = 0; i < 20000; ++i) text += std::string(49, 'x') + "\n";   // ~1 MiB, an escape every 50 bytes
+    text += "\"tab\there\"";
+    FILE* src = std::tmpfile();
+    REQUIRE(src != nullptr);
+    REQUIRE(std::fwrite(text.data(), 1, text.size(), src) == text.size());
+    std::fflush(src);
+    auto lines = ResultBody::from_fd(fileno(src), 0, text.size());
+    std::fclose(src);
+    auto in_memory = ResultBody::from_string(text);
+    CHECK_FALSE(lines->json_safe());
+    CHECK(lines->escapes().size() == 20000 + 3);
+    CHECK(lines->escaped_size() == json(text).dump().size() - 2);
+
+    ConversationBuilder conv(json{{"model", "m"}});
+    FILE* out = std::tmpfile();
+    REQUIRE(out != nullptr);
+    FdBodySink sink(fileno(out));
+    const AllocationScope scope;
+    conv.append_tool_result("c1", lines);
+    conv.append_tool_result("c2", in_memory);
+    conv.write_to(sink);
+    const auto used = scope.delta();
+    if (allocation_hook_installed()) CHECK(used.bytes < text.size() / 4);
+    CHECK(conv.bytes_serialized() < 1024);
+
+    std::string back(conv.body_size(), '\0');
+    std::rewind(out);
+    REQUIRE(std::fread(&back[0], 1, back.size(), out) == back.size());
+    std::fclose(out);
+    CHECK(back == conv.str());
+    const json parsed = json::parse(back);
+    CHECK(parsed.at("messages")[0].at("content") == text);
+    CHECK(parsed.at("messages")[1].at("content") == text);
+}
+
+TEST_CASE("a nested invoke keeps the outer handler's result body") {
+    auto outer_body = ResultBody::from_string("outer");
+    auto inner_body = ResultBody::from_string("inner");
+    ToolRegistry reg;
+    reg.register_tool("inner", [&](const json&) {
+        set_result_body(inner_body);
+        return json("inner done");
+    }, {{"name", "inner"}});
+    reg.register_tool("outer", [&](const json& args) {
+        if (args.value("set_first", false)) set_result_body(outer_body);
+        const json got = reg.invoke("inner", json::object());
+        const auto nested = reg.process_remote_response_and_execute(
+            MockChatTransport::tool_call_response({ ToolCall{"n", "inner", json::object()} }));
+        if (!args.value("set_first", false)) set_result_body(outer_body);
+        return json::array({ got, nested[0].body == inner_body });
+    }, {{"name", "outer"}});
+
+    for (bool set_first : {true, false}) {
+        const auto results = reg.process_remote_response_and_execute(
+            MockChatTransport::tool_call_response({ ToolCall{"o", "outer", json{{"set_first", set_first}}} }));
+        REQUIRE(results.size() == 1);
+        CHECK(results[0].error.empty());
+        CHECK(*results[0].result == json::array({ "inner done", true }));
+        CHECK(results[0].body == outer_body);
+    }
+    // invoke() itself drops the body, and leaves none behind on the thread.
+    CHECK(reg.invoke("outer", json{{"set_first", true}}) == json::array({ "inner done", true }));
+    CHECK(detail::take_result_body() == nullptr);
+}
+
+TEST_CASE("streaming tools deliver partial results ahead of the final one") {
+    ToolRegistry reg;
+    std::atomic<int> seen_by_consumer{0};
+    std::atomic<bool> progressive{true};
+    reg.register_streaming_tool("tail", [&](const json& args, ResultSink& out) -> json {
+        const int n = args.at("lines");
+        for (int i = 0; i < n; ++i) {
+            out.write(json{{"line", i}});
+            // With a consumer attached, each chunk is out before the next one is produced.
+            if (seen_by_consumer.load() > 0 && seen_by_consumer.load() < i + 1) progressive = false;
+        }
+        if (args.value("fail", false)) throw std::runtime_error("log rotated");
+        return json{{"lines", n}};
+    }, {{"name", "tail"}});
+    ToolSpec scan;
+    scan.name = "scan";
+    scan.description = "returns only chunks";
+    scan.parameters = {{"type", "object"}};
+    scan.streaming_handler = [](const json&, ResultSink& out) {
+        out.write("a");
+        out.write("b");
+        return json();
+    };
+    reg.register_tool_spec(scan);
+
+    // Without a consumer for partial updates the chunks are collected.
+    CHECK(reg.invoke("scan", json::object()) == json::array({"a", "b"}));
+    CHECK(reg.invoke("tail", json{{"lines", 3}}) == json{{"lines", 3}});
+    const auto batch = reg.process_remote_response_and_execute(
+        MockChatTransport::tool_call_response({ ToolCall{"s", "scan", json::object()} }));
+    REQUIRE(batch.size() == 1);
+    CHECK_FALSE(batch[0].partial);
+    CHECK(batch[0].result == json::array({"a", "b"}));
+
+    const std::string response = MockChatTransport::tool_call_response({
+        ToolCall{"t1", "tail", json{{"lines", 4}}},
+        ToolCall{"t2", "tail", json{{"lines", 2}, {"fail", true}}},
+        ToolCall{"s1", "scan", json::object()},
+    }).dump();
+    auto chunked = [&](size_t step) {
+        return [&response, step, pos = size_t(0)](std::string& out) mutable {
+            if (pos >= response.size()) return false;
+            out = response.substr(pos, step);
+            pos += step;
+            return true;
+        };
+    };
+    // Per call: chunks 0..n-1 in order, then exactly one final result.
+    auto check_order = [](const std::vector<ToolRegistry::ExecutionResult>& got) {
+        std::map<std::string, std::uint64_t> next;
+        std::set<std::string> finished;
+        for (const auto& r : got) {
+            CHECK(finished.count(r.call_id) == 0);
+            if (r.partial) {
+                CHECK(r.sequence == next[r.call_id]++);
+                CHECK(r.error.empty());
+            } else {
+                CHECK(r.sequence == next[r.call_id]);
+                finished.insert(r.call_id);
+            }
+        }
+        CHECK(finished.size() == 3);
+    };
+
+    std::vector<ToolRegistry::ExecutionResult> got;
+    reg.process_streaming_response_and_execute(chunked(7), [&](const ToolRegistry::ExecutionResult& r) {
+        if (r.partial) ++seen_by_consumer;
+        got.push_back(r);
+    });
+    CHECK(progressive);
+    check_order(got);
+    // Chunks go out while the batch runs, final results once it is done.
+    REQUIRE(got.size() == 4 + 2 + 2 + 3);
+    CHECK(got[1].result == json{{"line", 1}});
+    CHECK(got[1].arguments == json{{"lines", 4}});
+    CHECK(got[8].result == json{{"lines", 4}});
+    CHECK(got[9].error == "log rotated");
+    CHECK(got[9].sequence == 2);
+    CHECK(got[10].result.is_null());     // the chunks went out as they came; nothing was kept
+
+    got.clear();
+    reg.process_streaming_response_and_execute(chunked(11), [&](const ToolRegistry::ExecutionResult& r) {
+        got.push_back(r);
+    }, true);
+    check_order(got);
+    CHECK(got.size() == 11);
+
+    got.clear();
+    PipelineOptions popts;
+    popts.executor_threads = 2;
+    reg.process_streaming_response_pipelined(chunked(13), [&](const ToolRegistry::ExecutionResult& r) {
+        got.push_back(r);
+    }, popts);
+    check_order(got);
+    CHECK(got.size() == 11);
+
+    got.clear();
+    std::map<size_t, size_t> partials;
+    reg.process_remote_response_and_execute_as_completed(json::parse(response),
+        [&](size_t index, const ToolRegistry::ExecutionResult& r) {
+            if (r.partial) ++partials[index];
+            got.push_back(r);
+        });
+    check_order(got);
+    CHECK(partials == std::map<size_t, size_t>{{0, 4}, {1, 2}, {2, 2}});
+}
+
+TEST_CASE("as_completed holds back a tool that outruns its consumer") {
+    ToolRegistry reg;
+    std::atomic<int> written{0}, seen{0}, ahead{0};
+    reg.register_streaming_tool("flood", [&](const json&, ResultSink& out) -> json {
+        for (int i = 0; i < 2000; ++i) {
+            out.write(json(i));
+            const int lead = ++written - seen.load();
+            for (int a = ahead.load(); lead > a && !ahead.compare_exchange_weak(a, lead);) {}
+        }
+        return json("done");
+    }, {{"name", "flood"}});
+    reg.register_tool("quick", [](const json&) { return json(1); }, {{"name", "quick"}});
+
+    int finals = 0;
+    reg.process_remote_response_and_execute_as_completed(
+        MockChatTransport::tool_call_response({ ToolCall{"f", "flood", json::object()}, ToolCall{"q", "quick", json::object()} }),
+        [&](size_t, const ToolRegistry::ExecutionResult& r) {
+            if (!r.partial) { ++finals; return; }
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+            ++seen;
+        });
+    CHECK(finals == 2);
+    CHECK(seen == 2000);
+    // Queue capacity, plus the chunk in on_result and the one being written.
+    CHECK(ahead <= 64 + 2);
+}
+
+TEST_CASE("concurrent next_page calls on one cursor never repeat a page") {
+    std::string text;
+    for (int i = 0; i < 2000; ++i) text += "row " + std::to_string(i) + "\n";
+    for (bool as_string : {true, false}) {
+        ResultCursorStore store;
+        const json value = as_string ? json(text) : json::array({ text });
+        const std::string cursor = store.put(ResultCursorStore::Entry{ value, 0, ResultBudget{64, 0}, nullptr });
+
+        std::mutex mutex;
+        std::vector<std::string> pages;
+        std::vector<std::thread> pool;
+        for (int t = 0; t < 8; ++t) {
+            pool.emplace_back([&] {
+                while (true) {
+                    json page;
+                    try {
+                        page = store.next_page(cursor);
+                    } catch (const std::runtime_error&) {
+                        return;     // the last page went to someone else
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    pages.push_back(page.at("content").get<std::string>());
+                    if (!page.contains("next_cursor")) return;
+                }
+            });
+        }
+        for (auto& th : pool) th.join();
+
+        const std::string whole = as_string ? text : value.dump();
+        size_t total = 0;
+        for (const auto& p : pages) total += p.size();
+        CHECK(total == whole.size());
+        CHECK(std::set<std::string>(pages.begin(), pages.end()).size() == pages.size());
+        CHECK(store.size() == 0);
+    }
+}
+
+TEST_CASE("results over budget are cut and paged through next_page") {
+    ToolRegistry reg;
+    std::atomic<int> runs{0};
+    std::string text;
+    for (int i = 0; i < 200; ++i) text += "line " + std::to_string(i) + " caf\xC3\xA9\n";
+    reg.register_tool("dump", [&](const json&) { ++runs; return json(text); }, {{"name", "dump"}});
+    json rows = json::array();
+    for (int i = 0; i < 300; ++i) rows.push_back(json{{"id", i}, {"name", "row " + std::to_string(i)}});
+    reg.register_tool("rows", [&](const json&) { ++runs; return rows; }, {{"name", "rows"}});
+    reg.register_tool("small", [](const json&) { return json{{"ok", true}}; }, {{"name", "small"}});
+    reg.set_result_budget(ResultBudget{100, 0});
+    reg.set_result_budget("rows", ResultBudget{0, 40});
+
+    auto call = [&](const std::string& tool, json args) {
+        const auto results = reg.process_remote_response_and_execute(
+            MockChatTransport::tool_call_response({ ToolCall{"c", tool, std::move(args)} }));
+        REQUIRE(results.size() == 1);
+        return results[0];
+    };
+    // Follows next_cursor to the end; returns the reassembled text.
+    auto drain = [&](const ToolRegistry::ExecutionResult& first, size_t max_bytes, size_t max_tokens) {
+        REQUIRE_FALSE(first.cursor.empty());
+        json page = *first.result;
+        CHECK(page.at("next_cursor") == first.cursor);
+        std::string all;
+        size_t pages = 0;
+        while (true) {
+            const std::string content = page.at("content");
+            const std::string sent = json(content).dump();   // as the prompt carries it
+            if (max_bytes) CHECK(sent.size() - 2 <= max_bytes);
+            if (max_tokens) CHECK(estimate_tokens(sent.substr(1, sent.size() - 2)) <= max_tokens);
+            all += content;
+            ++pages;
+            if (!page.contains("next_cursor")) break;
+            const auto next = call("next_page", json{{"cursor", page.at("next_cursor")}});
+            REQUIRE(next.error.empty());
+            CHECK(next.cursor.empty());
+            page = *next.result;
+        }
+        CHECK(pages > 2);
+        return all;
+    };
+
+    CHECK(reg.tools_for_openai_string().find("\"next_page\"") != std::string::npos);
+    CHECK(drain(call("dump", json::object()), 100, 0) == text);
+    // Both budgets apply to rows: the global byte cap and its own token cap.
+    CHECK(drain(call("rows", json::object()), 100, 40) == rows.dump());
+    CHECK(runs == 2);
+    CHECK(reg.result_cursors()->size() == 0);
+
+    const auto small = call("small", json::object());
+    CHECK(small.cursor.empty());
+    CHECK(small.result == json{{"ok", true}});
+    CHECK(call("next_page", json{{"cursor", "cur_999"}}).error.find("unknown or expired cursor") != std::string::npos);
+    CHECK(reg.invoke("dump", json::object()) == text);    // invoke() is never cut
+    call("dump", json::object());
+    CHECK(reg.result_cursors()->size() == 1);
+    reg.result_cursors()->clear();
+    CHECK(reg.result_cursors()->size() == 0);
+
+    // next_page is reserved once budgets are on, and refused if already taken.
+    reg.register_tool("next_page", [](const json&) { return json("mine"); }, {{"name", "next_page"}});
+    CHECK(call("next_page", json{{"cursor", "cur_1"}}).error.find("unknown or expired cursor") != std::string::npos);
+    ToolRegistry taken;
+    taken.register_tool("next_page", [](const json&) { return json("mine"); }, {{"name", "next_page"}});
+    CHECK_THROWS_AS(taken.set_result_budget(ResultBudget{100, 0}), std::runtime_error);
+
+    // Escapes count against the budget: 100 newlines are 200 bytes once sent.
+    const ResultPage newlines = render_result_page(json(std::string(100, '\n')), 0, ResultBudget{50, 0});
+    CHECK(newlines.text.size() == 25);
+    CHECK(newlines.more);
+
+    // Serialization stops at the budget instead of rendering the whole result.
+    json big = json::array();
+    for (int i = 0; i < 100000; ++i) big.push_back(json{{"k", i}});
+    const AllocationScope scope;
+    const ResultPage page = render_result_page(big, 0, ResultBudget{256, 0});
+    const auto used = scope.delta();
+    CHECK(page.more);
+    CHECK(page.text == big.dump().substr(0, page.text.size()));
+    if (allocation_hook_installed()) CHECK(used.bytes < 8192);
+}
+
+TEST_CASE("result encoding tabulates homogeneous arrays and reports tokens saved") {
+    json rows = json::array();
+    for (int i = 0; i < 20; ++i) {
+        rows.push_back(json{{"id", i}, {"name", "item " + std::to_string(i)},
+                            {"price", (i + 1) / 7.0}, {"discount", nullptr}});
+    }
+    rows[3]["note"] = "  fragile  ";
+    const json result = {{"items", rows}, {"cursor", nullptr}, {"pair", json::array({json{{"a", 1}}, json{{"a", 2}}})}};
+
+    ResultEncodeOptions opts;
+    opts.float_digits = 3;
+    opts.trim_strings = true;
+    ResultEncodeReport report;
+    const json encoded = encode_result(result, opts, &report);
+
+    CHECK_FALSE(encoded.contains("cursor"));
+    const json& table = encoded.at("items");
+    CHECK(table.at("columns") == json::array({"id", "name", "price", "note"}));   // nulls stripped before tabulating
+    REQUIRE(table.at("rows").size() == 20);
+    CHECK(table.at("rows")[2] == json::array({2, "item 2", 0.429, nullptr}));
+    CHECK(table.at("rows")[3][3] == "fragile");
+    CHECK(encoded.at("pair").is_array());     // below min_rows
+    CHECK(report.tables == 1);
+    CHECK(report.stripped_nulls == 21);
+    CHECK(report.rounded_floats == 18);      // 7/7 and 14/7 are already exact
+    CHECK(report.encoded_bytes < report.original_bytes / 2);
+    CHECK(report.saved_tokens() > 0);
+    CHECK(report.encoded_tokens == estimate_tokens(encoded.dump()));
+
+    // Arrays that would grow as a table (mostly missing columns) stay as they are.
+    const json sparse = json::array({ json{{"alpha", 1}}, json{{"beta", 2}}, json{{"gamma", 3}} });
+    CHECK(encode_result(sparse, ResultEncodeOptions()) == sparse);
+
+    // In the execution layer: opt-in, per tool, and after dependents read the original.
+    ToolRegistry reg;
+    reg.register_tool("list", [&](const json&) { return rows; }, {{"name", "list"}});
+    reg.register_tool("first_name", [](const json& a) { return a.at("name"); }, {{"name", "first_name"}});
+    auto run = [&] {
+        return reg.process_remote_response_and_execute(
+            MockChatTransport::tool_call_response({ ToolCall{"l", "list", json::object()} }))[0];
+    };
+    CHECK(run().result == rows);
+    CHECK(run().tokens_saved == 0);
+    reg.set_result_encoding(opts);
+    const auto r = run();
+    CHECK(r.result.at("rows").size() == 20);
+    CHECK(r.tokens_saved > 0);
+    ResultEncodeOptions off;
+    off.tabular = false;
+    off.strip_nulls = false;
+    reg.set_result_encoding("list", off);
+    CHECK(run().result == rows);
+
+    reg.set_result_encoding("list", opts);
+    const auto dag = reg.process_remote_response_and_execute_dag(json::parse(R"({"choices":[{"message":{"tool_calls":[
+        {"id":"l","function":{"name":"list","arguments":"{}"}},
+        {"id":"f","function":{"name":"first_name","arguments":"{\"name\":{\"$ref\":\"l.result.4.name\"}}"}}
+    ]}}]})"));
+    REQUIRE(dag.size() == 2);
+    REQUIRE(dag[1].error.empty());
+    CHECK(dag[1].result == "item 4");
+    CHECK(dag[0].result.contains("rows"));
+}
+
+TEST_CASE("binary wire formats round-trip what JSON text does") {
+    const json value = {
+        {"text", "caf\xC3\xA9 \"quoted\"\n\ttabbed"}, {"nul", std::string("a\0b", 3)},
+        {"ints", json::array({0, -1, 255, 65536, -2147483649LL, 18446744073709551615ULL})},
+        {"floats", json::array({0.5, -1e300, 3.141592653589793})},
+        {"nested", {{"empty_obj", json::object()}, {"empty_arr", json::array()}, {"null", nullptr}, {"yes", true}}},
+    };
+    for (WireFormat f : {WireFormat::json, WireFormat::msgpack, WireFormat::cbor}) {
+        INFO(wire_format_name(f));
+        CHECK(parse_wire_format(wire_format_name(f)) == f);
+        const std::string bytes = wire_encode(value, f);
+        CHECK(wire_decode(bytes, f) == value);
+
+        std::string buf(bytes.size(), '\0');
+        CHECK(wire_encode_to(value, f, &buf[0], buf.size()) == bytes.size());
+        CHECK(buf == bytes);
+        CHECK(wire_encode_to(value, f, &buf[0], bytes.size() - 1) == std::string::npos);
+    }
+    CHECK(wire_encode(value, WireFormat::json) == value.dump());
+    CHECK(wire_encode(value, WireFormat::msgpack) == [&] { std::string s; json::to_msgpack(value, s); return s; }());
+    CHECK_FALSE(parse_wire_format("yaml"));
+    CHECK_THROWS_AS(wire_decode(std::string_view("\xc1"), WireFormat::msgpack), json::parse_error);
+
+    // A 64 KiB string: binary is the string plus a few bytes of header.
+    const json blob = {{"blob", std::string(65536, 'x')}};
+    CHECK(wire_encode(blob, WireFormat::msgpack).size() < 65536 + 16);
+
+#ifdef __linux__
+    ToolRegistry reg;
+    reg.register_tool("echo", [](const json& a) { return a; }, {{"name", "echo"}});
+    for (WireFormat f : {WireFormat::json, WireFormat::msgpack, WireFormat::cbor}) {
+        INFO(wire_format_name(f));
+        WorkerPool::Options opts;
+        opts.workers = 1;
+        opts.slot_bytes = 8192;
+        opts.wire = f;
+        WorkerPool pool(reg, opts);
+        CHECK(pool.call("echo", value) == value);
+        try {
+            pool.call("echo", {{"blob", std::string(9000, 'x')}});
+            FAIL("oversized request accepted");
+        } catch (const std::runtime_error& e) {
+            CHECK(std::string(e.what()).find("exceeds slot_bytes") != std::string::npos);
+        }
+        CHECK(pool.call("echo", json{{"after", 1}}) == json{{"after", 1}});
+    }
+#endif
+}